@@ -9,15 +9,6 @@
 
 #include <iostream>
 
-template <typename T> static void WriteVec(std::ostream &sout, const std::vector<T> &data)
-{
-    static_assert(std::is_trivially_constructible_v<T>);
-    static_assert(std::is_trivially_copyable_v<T>);
-    uint size = data.size();
-    sout.write(reinterpret_cast<const char *>(&size), sizeof(uint));
-    sout.write(reinterpret_cast<const char *>(data.data()), size * sizeof(T));
-}
-
 template <typename T> static void ReadVec(std::istream &sin, std::vector<T> &data)
 {
     static_assert(std::is_trivially_constructible_v<T>);
@@ -30,6 +21,13 @@ template <typename T> static void ReadVec(std::istream &sin, std::vector<T> &dat
     sin.read(reinterpret_cast<char *>(data.data()), size * sizeof(T));
 }
 
+// Копирует секцию сразу из отображённого файла, без обнуления буфера перед чтением
+template <typename T> static void ReadSection(const TModelFileView &view, ModelSection id, std::vector<T> &data)
+{
+    TConstSpan<T> section = view.Section<T>(id);
+    data.assign(section.begin(), section.end());
+}
+
 void TMonoLodCPU::LoadGLB(const std::string &path)
 {
     tinygltf::Model    inModel;
@@ -139,83 +137,766 @@ void TMonoLodCPU::LoadGLB(const std::string &path)
     }
 }
 
+static TBoundingBox EmptyBox()
+{
+    TBoundingBox box;
+    box.Min = float3(INFINITY, INFINITY, INFINITY);
+    box.Max = float3(-INFINITY, -INFINITY, -INFINITY);
+    return box;
+}
+
+static void MergeBox(TBoundingBox &box, const TBoundingBox &other)
+{
+    box.Min.x = std::min(box.Min.x, other.Min.x);
+    box.Min.y = std::min(box.Min.y, other.Min.y);
+    box.Min.z = std::min(box.Min.z, other.Min.z);
+    box.Max.x = std::max(box.Max.x, other.Max.x);
+    box.Max.y = std::max(box.Max.y, other.Max.y);
+    box.Max.z = std::max(box.Max.z, other.Max.z);
+}
+
+static TBoundingBox MeshletBox(const TMeshletModelCPU &model, const TMeshletDesc &meshlet)
+{
+    TBoundingBox box = EmptyBox();
+    for (uint iMeshletVert = 0; iMeshletVert < meshlet.VertCount; ++iMeshletVert)
+    {
+        uint          iVert = model.GlobalIndices[meshlet.VertOffset + iMeshletVert];
+        const float3 &pos   = model.Vertices[iVert & UINT32_C(0x7FFFFFFF)].Position;
+        MergeBox(box, {pos, pos});
+    }
+    return box;
+}
+
 void TMeshletModelCPU::SaveToFile(const std::filesystem::path &path) const
 {
-    std::ofstream fout(path, std::ios::binary);
-    WriteVec(fout, Vertices);
-    WriteVec(fout, GlobalIndices);
-    WriteVec(fout, Primitives);
-    WriteVec(fout, Meshlets);
-    WriteVec(fout, Meshes);
+    ASSERT_TEXT(!File, "Model with sections borrowed from a file cannot be saved");
+
+    TModelFileWriter writer;
+    writer.Add(ModelSection::Vertices, Vertices);
+    writer.Add(ModelSection::GlobalIndices, GlobalIndices);
+    if (PrimitiveStream.empty())
+    {
+        writer.Add(ModelSection::Primitives, Primitives);
+    }
+    else
+    {
+        writer.Add(ModelSection::PrimitiveStream, PrimitiveStream);
+        writer.Add(ModelSection::MeshletPrimitives, MeshletPrimitives);
+    }
+    writer.Add(ModelSection::Meshlets, Meshlets);
+    writer.Add(ModelSection::Meshes, Meshes);
+    writer.Add(ModelSection::Groups, Groups);
+    writer.Add(ModelSection::GroupMeshlets, GroupMeshlets);
+    writer.Add(ModelSection::GroupLinks, GroupLinks);
+    writer.Add(ModelSection::MeshletLods, MeshletLods);
+    writer.Add(ModelSection::MeshletCulling, MeshletCulling);
+    writer.Add(ModelSection::MeshletBoxes, MeshletBoxes);
+    writer.Add(ModelSection::MeshletBoxesHierarchy, MeshletBoxesHierarchy);
+    // Сжатые вершины необязательны, без них файл совпадает с прежним
+    if (!QuantizedVertices.empty())
+    {
+        writer.Add(ModelSection::QuantizedVertices, QuantizedVertices);
+        writer.Add(ModelSection::MeshletQuantization, MeshletQuantization);
+    }
+    writer.Write(path);
 }
 
-void TMeshletModelCPU::LoadFromFile(const std::filesystem::path &path)
+// Ошибка упрощения в мешлетах --- значение квадрики, то есть квадрат расстояния.
+// Группы и сферы LOD накапливают её в единицах длины
+static float SimplificationDistance(const TMeshletDesc &parent)
 {
-    using namespace DirectX;
+    return std::sqrt(std::max(parent.Error, 0.0f));
+}
 
-    std::ifstream fin(path, std::ios::binary);
-    size_t        pos1 = fin.tellg();
-    ReadVec(fin, Vertices);
-    ReadVec(fin, GlobalIndices);
-    ReadVec(fin, Primitives);
-    ReadVec(fin, Meshlets);
-    ReadVec(fin, Meshes);
+void TMeshletModelCPU::BuildGroups()
+{
+    uint nMeshlets = Meshlets.size();
 
-    // Восстанавливаем AABB мешлетов, имеет смысл это сразу сделать на процессоре
-    MeshletBoxes.resize(Meshlets.size());
+    // Группы в порядке создания. Родители каждой группы добавлялись после всех её мешлетов,
+    // поэтому при сортировке по ParentOffset группы ниже идут раньше
+    std::vector<uint> members;
+    for (uint iMeshlet = 0; iMeshlet < nMeshlets; ++iMeshlet)
+    {
+        if (Meshlets[iMeshlet].ParentCount > 0)
+            members.push_back(iMeshlet);
+    }
+    std::stable_sort(members.begin(), members.end(), [&](uint iLhs, uint iRhs) {
+        return Meshlets[iLhs].ParentOffset < Meshlets[iRhs].ParentOffset;
+    });
+
+    std::vector<uint>          sourceGroup(nMeshlets, MESHLET_NO_GROUP);
+    std::vector<TMeshletGroup> groups;
+    for (uint ii = 0; ii < members.size(); ++ii)
+    {
+        const TMeshletDesc &meshlet = Meshlets[members[ii]];
+        if (groups.empty() || groups.back().ParentOffset != meshlet.ParentOffset)
+        {
+            ASSERT_TEXT(groups.empty()
+                     || groups.back().ParentOffset + groups.back().ParentCount <= meshlet.ParentOffset,
+                        "Overlapping meshlet parent ranges");
+            ASSERT_TEXT(meshlet.ParentOffset + meshlet.ParentCount <= nMeshlets, "Incorrect Parent1");
+            TMeshletGroup group = {};
+            group.MeshletOffset = ii;
+            group.ParentOffset  = meshlet.ParentOffset;
+            group.ParentCount   = meshlet.ParentCount;
+            groups.push_back(group);
+            for (uint iParent = meshlet.ParentOffset; iParent < meshlet.ParentOffset + meshlet.ParentCount; ++iParent)
+                sourceGroup[iParent] = uint(groups.size() - 1);
+        }
+        ASSERT_EQ(groups.back().ParentCount, meshlet.ParentCount);
+        groups.back().MeshletCount++;
+    }
+    uint nGroups = groups.size();
+
+    // Связи и объединённые параметры, снизу вверх
+    std::vector<std::vector<uint>> children(nGroups);
+    std::vector<std::vector<uint>> parents(nGroups);
+    for (uint iGroup = 0; iGroup < nGroups; ++iGroup)
+    {
+        TMeshletGroup &group = groups[iGroup];
+        group.Box            = EmptyBox();
+        float childError     = 0.0f;
+        for (uint ii = group.MeshletOffset; ii < group.MeshletOffset + group.MeshletCount; ++ii)
+        {
+            uint iMeshlet = members[ii];
+            MergeBox(group.Box, MeshletBox(*this, Meshlets[iMeshlet]));
+
+            uint iChild = sourceGroup[iMeshlet];
+            if (iChild == MESHLET_NO_GROUP)
+                continue;
+            ASSERT(iChild < iGroup);
+            if (std::find(children[iGroup].begin(), children[iGroup].end(), iChild) != children[iGroup].end())
+                continue;
+            children[iGroup].push_back(iChild);
+            parents[iChild].push_back(iGroup);
+            MergeBox(group.Box, groups[iChild].Box);
+            childError = std::max(childError, groups[iChild].Error);
+        }
+        for (uint iParent = group.ParentOffset; iParent < group.ParentOffset + group.ParentCount; ++iParent)
+            MergeBox(group.Box, MeshletBox(*this, Meshlets[iParent]));
+        group.Error = childError + SimplificationDistance(Meshlets[group.ParentOffset]);
+    }
+
+    // Обход в ширину от групп, чьи мешлеты-родители никуда дальше не попали
+    std::vector<uint> order;
+    std::vector<uint> newIndex(nGroups, MESHLET_NO_GROUP);
+    for (uint iGroup = 0; iGroup < nGroups; ++iGroup)
+    {
+        if (parents[iGroup].empty())
+        {
+            newIndex[iGroup] = order.size();
+            order.push_back(iGroup);
+        }
+    }
+    for (size_t iQueue = 0; iQueue < order.size(); ++iQueue)
+    {
+        for (uint iChild : children[order[iQueue]])
+        {
+            if (newIndex[iChild] != MESHLET_NO_GROUP)
+                continue;
+            newIndex[iChild] = order.size();
+            order.push_back(iChild);
+        }
+    }
+    ASSERT_EQ(order.size(), size_t(nGroups));
+
+    Groups.clear();
+    GroupMeshlets.clear();
+    GroupLinks.clear();
+    for (uint iGroup : order)
+    {
+        TMeshletGroup group = groups[iGroup];
+        group.MeshletOffset = GroupMeshlets.size();
+        for (uint ii = groups[iGroup].MeshletOffset; ii < groups[iGroup].MeshletOffset + group.MeshletCount; ++ii)
+            GroupMeshlets.push_back(members[ii]);
+        group.ChildGroupOffset = GroupLinks.size();
+        group.ChildGroupCount  = children[iGroup].size();
+        for (uint iChild : children[iGroup])
+            GroupLinks.push_back(newIndex[iChild]);
+        group.ParentGroupOffset = GroupLinks.size();
+        group.ParentGroupCount  = parents[iGroup].size();
+        for (uint iParent : parents[iGroup])
+            GroupLinks.push_back(newIndex[iParent]);
+        Groups.push_back(group);
+    }
+    FillMeshletSourceGroups();
+}
+
+void TMeshletModelCPU::FillMeshletSourceGroups()
+{
+    MeshletSourceGroup.assign(Meshlets.size(), MESHLET_NO_GROUP);
+    for (uint iGroup = 0; iGroup < Groups.size(); ++iGroup)
+    {
+        const TMeshletGroup &group = Groups[iGroup];
+        ASSERT_TEXT(group.ParentOffset + group.ParentCount <= Meshlets.size(), "Incorrect group parents");
+        for (uint iParent = group.ParentOffset; iParent < group.ParentOffset + group.ParentCount; ++iParent)
+            MeshletSourceGroup[iParent] = iGroup;
+    }
+}
+
+// Сфера вокруг центра AABB мешлета, ошибка нулевая
+static TLodBounds MeshletSphere(const TMeshletModelCPU &model, const TMeshletDesc &meshlet)
+{
+    TBoundingBox box = MeshletBox(model, meshlet);
+    TLodBounds   lod = {};
+    lod.Center.x     = 0.5f * (box.Min.x + box.Max.x);
+    lod.Center.y     = 0.5f * (box.Min.y + box.Max.y);
+    lod.Center.z     = 0.5f * (box.Min.z + box.Max.z);
+    for (uint iMeshletVert = 0; iMeshletVert < meshlet.VertCount; ++iMeshletVert)
+    {
+        uint       iVert = model.GlobalIndices[meshlet.VertOffset + iMeshletVert];
+        TLodBounds point = {model.Vertices[iVert & UINT32_C(0x7FFFFFFF)].Position, 0.0f, 0.0f};
+        lod.Radius       = std::max(lod.Radius, LodSphereReach(lod, point));
+    }
+    return lod;
+}
+
+void TMeshletModelCPU::BuildLods()
+{
+    MeshletLods.resize(Meshlets.size());
     for (uint iMeshlet = 0; iMeshlet < Meshlets.size(); ++iMeshlet)
+        MeshletLods[iMeshlet] = MeshletSphere(*this, Meshlets[iMeshlet]);
+
+    // Группы ниже создавались раньше, поэтому порядок по ParentOffset --- снизу вверх
+    std::vector<uint> order(Groups.size());
+    for (uint iGroup = 0; iGroup < Groups.size(); ++iGroup)
+        order[iGroup] = iGroup;
+    std::sort(order.begin(), order.end(), [&](uint iLhs, uint iRhs) {
+        return Groups[iLhs].ParentOffset < Groups[iRhs].ParentOffset;
+    });
+
+    std::vector<TLodBounds> spheres;
+    for (uint iGroup : order)
     {
-        const TMeshletDesc &meshlet = Meshlets[iMeshlet];
-        TBoundingBox       &aabb    = MeshletBoxes[iMeshlet];
+        const TMeshletGroup &group = Groups[iGroup];
 
-        aabb.Min = float3(INFINITY, INFINITY, INFINITY);
-        aabb.Max = float3(-INFINITY, -INFINITY, -INFINITY);
+        // Мешлеты группы уже охватывают всё ниже, к ним добавляются сами упрощённые мешлеты
+        spheres.clear();
+        float childError = 0.0f;
+        for (uint ii = group.MeshletOffset; ii < group.MeshletOffset + group.MeshletCount; ++ii)
+        {
+            const TLodBounds &child = MeshletLods[GroupMeshlets[ii]];
+            spheres.push_back(child);
+            childError = std::max(childError, child.Error);
+        }
+        for (uint iParent = group.ParentOffset; iParent < group.ParentOffset + group.ParentCount; ++iParent)
+            spheres.push_back(MeshletLods[iParent]);
 
-        for (uint iMeshletVert = 0; iMeshletVert < meshlet.VertCount; ++iMeshletVert)
+        TBoundingBox box = EmptyBox();
+        for (const TLodBounds &sphere : spheres)
         {
-            uint          iVert = GlobalIndices[meshlet.VertOffset + iMeshletVert];
-            const TVertex &vert  = Vertices[iVert & UINT32_C(0x7FFFFFFF)];
-            const float3 &pos   = vert.Position;
+            float r = sphere.Radius;
+            MergeBox(box,
+                     {{sphere.Center.x - r, sphere.Center.y - r, sphere.Center.z - r},
+                      {sphere.Center.x + r, sphere.Center.y + r, sphere.Center.z + r}});
+        }
+        TLodBounds lod = {};
+        lod.Center.x   = 0.5f * (box.Min.x + box.Max.x);
+        lod.Center.y   = 0.5f * (box.Min.y + box.Max.y);
+        lod.Center.z   = 0.5f * (box.Min.z + box.Max.z);
+        for (const TLodBounds &sphere : spheres)
+            lod.Radius = std::max(lod.Radius, LodSphereReach(lod, sphere));
+
+        // Совпадает с ошибкой группы из BuildGroups
+        lod.Error = childError + SimplificationDistance(Meshlets[group.ParentOffset]);
+
+        for (uint iParent = group.ParentOffset; iParent < group.ParentOffset + group.ParentCount; ++iParent)
+            MeshletLods[iParent] = lod;
+    }
+}
 
-            aabb.Min.x = XMMin(aabb.Min.x, pos.x);
-            aabb.Min.y = XMMin(aabb.Min.y, pos.y);
-            aabb.Min.z = XMMin(aabb.Min.z, pos.z);
-            aabb.Max.x = XMMax(aabb.Max.x, pos.x);
-            aabb.Max.y = XMMax(aabb.Max.y, pos.y);
-            aabb.Max.z = XMMax(aabb.Max.z, pos.z);
+size_t TMeshletModelCPU::ValidateLods() const
+{
+    ASSERT_EQ(MeshletLods.size(), Meshlets.size());
+    size_t nViolations = 0;
+    for (uint iMeshlet = 0; iMeshlet < Meshlets.size(); ++iMeshlet)
+    {
+        const TMeshletDesc &meshlet = Meshlets[iMeshlet];
+        for (uint iParent = meshlet.ParentOffset; iParent < meshlet.ParentOffset + meshlet.ParentCount; ++iParent)
+            nViolations += !IsLodMonotone(MeshletLods[iParent], MeshletLods[iMeshlet]);
+    }
+    return nViolations;
+}
+
+// Конус строится по единичным нормалям треугольников: ось --- их нормированная сумма,
+// раствор --- по самой отклонившейся нормали. Если нормали расходятся больше чем на прямой угол
+// (или почти на него), конус бесполезен и помечается вырожденным
+constexpr float MESHLET_CONE_MIN_DOT = 0.1f;
+
+void TMeshletModelCPU::BuildCullData()
+{
+    using namespace DirectX;
+
+    MeshletCulling.resize(Meshlets.size());
+    std::vector<XMVECTOR> normals;
+    for (uint iMeshlet = 0; iMeshlet < Meshlets.size(); ++iMeshlet)
+    {
+        const TMeshletDesc &meshlet = Meshlets[iMeshlet];
+        TLodBounds          sphere  = MeshletSphere(*this, meshlet);
+        TMeshletCullData   &cull    = MeshletCulling[iMeshlet];
+        cull.Center                 = sphere.Center;
+        cull.Radius                 = sphere.Radius;
+        cull.ConeAxis               = float3(0.0f, 0.0f, 0.0f);
+        cull.ConeCutoff             = 1.0f;
+
+        normals.clear();
+        XMVECTOR sum = XMVectorZero();
+        for (uint iPrim = meshlet.PrimOffset; iPrim < meshlet.PrimOffset + meshlet.PrimCount; ++iPrim)
+        {
+            XMVECTOR pos[3];
+            for (uint iTriVert = 0; iTriVert < 3; ++iTriVert)
+            {
+                uint iMeshletVert = (Primitives[iPrim] >> (10 * iTriVert)) & 0x3FF;
+                uint iVert        = GlobalIndices[meshlet.VertOffset + iMeshletVert] & UINT32_C(0x7FFFFFFF);
+                pos[iTriVert]     = XMLoadFloat3(&Vertices[iVert].Position);
+            }
+            XMVECTOR normal = XMVector3Cross(pos[1] - pos[0], pos[2] - pos[0]);
+            if (XMVectorGetX(XMVector3LengthSq(normal)) == 0.0f)
+                continue;
+            normal = XMVector3Normalize(normal);
+            normals.push_back(normal);
+            sum += normal;
         }
+
+        float sumLength = XMVectorGetX(XMVector3Length(sum));
+        if (normals.empty() || sumLength == 0.0f)
+            continue;
+        XMVECTOR axis   = sum / sumLength;
+        float    minDot = 1.0f;
+        for (XMVECTOR normal : normals)
+            minDot = std::min(minDot, XMVectorGetX(XMVector3Dot(normal, axis)));
+        if (minDot <= MESHLET_CONE_MIN_DOT)
+            continue;
+
+        XMStoreFloat3(&cull.ConeAxis, axis);
+        cull.ConeCutoff = std::sqrt(1.0f - minDot * minDot);
     }
+}
+
+// Минимум по четырём компонентам сразу. Порядок аргументов как у std::min(box, pos):
+// при равенстве остаётся значение бокса, поэтому результат совпадает с MergeBox бит в бит
+static TBoundingBox MeshletBoxSIMD(const TMeshletModelCPU &model, const TMeshletDesc &meshlet)
+{
+    using namespace DirectX;
+
+    XMVECTOR    boxMin  = XMVectorReplicate(INFINITY);
+    XMVECTOR    boxMax  = XMVectorReplicate(-INFINITY);
+    const uint *indices = model.GlobalIndices.data() + meshlet.VertOffset;
+    for (uint iMeshletVert = 0; iMeshletVert < meshlet.VertCount; ++iMeshletVert)
+    {
+        XMVECTOR pos = XMLoadFloat3(&model.Vertices[indices[iMeshletVert] & UINT32_C(0x7FFFFFFF)].Position);
+        boxMin       = XMVectorMin(pos, boxMin);
+        boxMax       = XMVectorMax(pos, boxMax);
+    }
+
+    TBoundingBox box;
+    XMStoreFloat3(&box.Min, boxMin);
+    XMStoreFloat3(&box.Max, boxMax);
+    return box;
+}
+
+// Мешлетов в задаче ParallelFor при расчёте собственных AABB
+constexpr size_t MESHLET_BOX_CHUNK = 256;
+
+void TMeshletModelCPU::BuildHierarchyBounds(size_t nThreads)
+{
+    using namespace DirectX;
 
+    size_t nMeshlets = Meshlets.size();
+    size_t nGroups   = Groups.size();
+    ASSERT_EQ(MeshletSourceGroup.size(), nMeshlets);
+
+    MeshletBoxes.resize(nMeshlets);
+    ParallelFor((nMeshlets + MESHLET_BOX_CHUNK - 1) / MESHLET_BOX_CHUNK, nThreads, [&](size_t, size_t iChunk) {
+        size_t end = std::min(nMeshlets, (iChunk + 1) * MESHLET_BOX_CHUNK);
+        for (size_t iMeshlet = iChunk * MESHLET_BOX_CHUNK; iMeshlet < end; ++iMeshlet)
+            MeshletBoxes[iMeshlet] = MeshletBoxSIMD(*this, Meshlets[iMeshlet]);
+    });
     MeshletBoxesHierarchy = MeshletBoxes;
-    for (size_t iMeshlet = 0; iMeshlet < Meshlets.size(); ++iMeshlet)
+
+    // Волна группы --- длина самого длинного пути вниз по DAG. Мешлеты группы получены группами
+    // меньших волн, а родители у каждой группы свои, так что группы одной волны независимы.
+    // По ParentOffset группы ниже идут раньше (см. BuildGroups)
+    std::vector<uint> order(nGroups);
+    for (uint iGroup = 0; iGroup < nGroups; ++iGroup)
+        order[iGroup] = iGroup;
+    std::sort(order.begin(), order.end(),
+              [&](uint iLhs, uint iRhs) { return Groups[iLhs].ParentOffset < Groups[iRhs].ParentOffset; });
+
+    std::vector<uint> groupWave(nGroups, 0);
+    uint              nWaves = 0;
+    for (uint iGroup : order)
     {
-        const TMeshletDesc &meshlet = Meshlets[iMeshlet];
-        const TBoundingBox &aabb    = MeshletBoxesHierarchy[iMeshlet];
-        // Восстанавливаем AABB родителей
-        float maxParentError = 0.0f;
-        for (uint iiParent = 0; iiParent < meshlet.ParentCount; ++iiParent)
+        const TMeshletGroup &group = Groups[iGroup];
+        ASSERT_TEXT(group.ParentOffset + group.ParentCount <= nMeshlets, "Incorrect Parent1");
+        for (uint ii = group.MeshletOffset; ii < group.MeshletOffset + group.MeshletCount; ++ii)
+        {
+            uint iMeshlet = GroupMeshlets[ii];
+            uint iSource  = MeshletSourceGroup[iMeshlet];
+            ASSERT_TEXT(iMeshlet < group.ParentOffset, "Incorrect Parent1");
+            if (iSource != MESHLET_NO_GROUP)
+                groupWave[iGroup] = std::max(groupWave[iGroup], groupWave[iSource] + 1);
+        }
+        nWaves = std::max(nWaves, groupWave[iGroup] + 1);
+    }
+    std::vector<uint> waveOffsets(nWaves + 1, 0);
+    for (uint iGroup = 0; iGroup < nGroups; ++iGroup)
+        waveOffsets[groupWave[iGroup] + 1]++;
+    for (uint iWave = 0; iWave < nWaves; ++iWave)
+        waveOffsets[iWave + 1] += waveOffsets[iWave];
+    std::vector<uint> waveGroups(nGroups);
+    std::vector<uint> wavePos(waveOffsets.begin(), waveOffsets.end() - 1);
+    for (uint iGroup : order)
+        waveGroups[wavePos[groupWave[iGroup]]++] = iGroup;
+
+    // Высота родителя --- на единицу больше, чем у мешлетов группы. Ошибка родителей --- своя плюс
+    // накопленные ошибки мешлетов группы по возрастанию индекса, как при прежнем последовательном обходе
+    for (uint iWave = 0; iWave < nWaves; ++iWave)
+    {
+        ParallelFor(waveOffsets[iWave + 1] - waveOffsets[iWave], nThreads, [&](size_t, size_t iiGroup) {
+            const TMeshletGroup &group = Groups[waveGroups[waveOffsets[iWave] + iiGroup]];
+
+            XMVECTOR boxMin = XMVectorReplicate(INFINITY);
+            XMVECTOR boxMax = XMVectorReplicate(-INFINITY);
+            uint     height = 0;
+            float    error  = 0.0f;
+            for (uint iParent = group.ParentOffset; iParent < group.ParentOffset + group.ParentCount; ++iParent)
+                error = std::max(error, Meshlets[iParent].Error);
+            for (uint ii = group.MeshletOffset; ii < group.MeshletOffset + group.MeshletCount; ++ii)
+            {
+                uint                iMeshlet = GroupMeshlets[ii];
+                const TBoundingBox &box      = MeshletBoxesHierarchy[iMeshlet];
+                boxMin                       = XMVectorMin(boxMin, XMLoadFloat3(&box.Min));
+                boxMax                       = XMVectorMax(boxMax, XMLoadFloat3(&box.Max));
+                height                       = std::max(height, Meshlets[iMeshlet].Height + 1);
+                error += Meshlets[iMeshlet].Error;
+            }
+            for (uint iParent = group.ParentOffset; iParent < group.ParentOffset + group.ParentCount; ++iParent)
+            {
+                TBoundingBox &box = MeshletBoxesHierarchy[iParent];
+                XMStoreFloat3(&box.Min, XMVectorMin(XMLoadFloat3(&box.Min), boxMin));
+                XMStoreFloat3(&box.Max, XMVectorMax(XMLoadFloat3(&box.Max), boxMax));
+                Meshlets[iParent].Height = std::max(Meshlets[iParent].Height, height);
+                Meshlets[iParent].Error  = error;
+            }
+        });
+    }
+}
+
+void TMeshletModelCPU::EncodePrimitives(uint encodingMask, size_t nThreads)
+{
+    size_t nMeshlets = Meshlets.size();
+    size_t nChunks   = (nMeshlets + MESHLET_BOX_CHUNK - 1) / MESHLET_BOX_CHUNK;
+    ASSERT_TEXT((encodingMask & PRIMITIVE_ENCODING_ALL) != 0, "No primitive encoding selected");
+
+    // Куски кодируются независимо, смещения внутри куска потом сдвигаются на его начало в общем потоке
+    std::vector<std::vector<uint8_t>> chunkStreams(nChunks);
+    MeshletPrimitives.resize(nMeshlets);
+    ParallelFor(nChunks, nThreads, [&](size_t, size_t iChunk) {
+        std::vector<uint8_t> &stream = chunkStreams[iChunk];
+        std::vector<uint8_t>  candidate;
+        std::vector<uint>     reordered;
+        size_t                end = std::min(nMeshlets, (iChunk + 1) * MESHLET_BOX_CHUNK);
+        for (size_t iMeshlet = iChunk * MESHLET_BOX_CHUNK; iMeshlet < end; ++iMeshlet)
+        {
+            const TMeshletDesc &meshlet = Meshlets[iMeshlet];
+            uint               *prims   = Primitives.data() + meshlet.PrimOffset;
+
+            size_t            bestSize     = SIZE_MAX;
+            PrimitiveEncoding bestEncoding = PrimitiveEncoding::Packed10;
+            for (uint iEncoding = 0; iEncoding < PRIMITIVE_ENCODING_COUNT; ++iEncoding)
+            {
+                auto encoding = PrimitiveEncoding(iEncoding);
+                if (!(encodingMask & PrimitiveEncodingBit(encoding)))
+                    continue;
+                candidate.clear();
+                reordered.assign(prims, prims + meshlet.PrimCount);
+                if (::EncodePrimitives(encoding, reordered.data(), meshlet.PrimCount, candidate)
+                    && candidate.size() < bestSize)
+                {
+                    bestSize     = candidate.size();
+                    bestEncoding = encoding;
+                }
+            }
+            // Ни одна разрешённая кодировка не подошла --- остаётся исходная
+            if (bestSize == SIZE_MAX)
+                bestEncoding = PrimitiveEncoding::Packed10;
+
+            MeshletPrimitives[iMeshlet] = {uint(stream.size()), bestEncoding};
+
+            bool isEncoded = ::EncodePrimitives(bestEncoding, prims, meshlet.PrimCount, stream);
+            ASSERT(isEncoded);
+        }
+    });
+
+    size_t nBytes = 0;
+    for (size_t iChunk = 0; iChunk < nChunks; ++iChunk)
+    {
+        size_t end = std::min(nMeshlets, (iChunk + 1) * MESHLET_BOX_CHUNK);
+        for (size_t iMeshlet = iChunk * MESHLET_BOX_CHUNK; iMeshlet < end; ++iMeshlet)
+            MeshletPrimitives[iMeshlet].Offset += uint(nBytes);
+        nBytes += chunkStreams[iChunk].size();
+    }
+    ASSERT_TEXT(nBytes <= UINT32_MAX, "Primitive stream does not fit 32-bit offsets");
+    PrimitiveStream.clear();
+    PrimitiveStream.reserve(nBytes);
+    for (const std::vector<uint8_t> &stream : chunkStreams)
+        PrimitiveStream.insert(PrimitiveStream.end(), stream.begin(), stream.end());
+}
+
+void TMeshletModelCPU::DecodePrimitives(size_t nThreads)
+{
+    size_t nMeshlets = Meshlets.size();
+    ASSERT_EQ(MeshletPrimitives.size(), nMeshlets);
+
+    size_t nPrimitives = 0;
+    for (const TMeshletDesc &meshlet : Meshlets)
+        nPrimitives = std::max<size_t>(nPrimitives, size_t(meshlet.PrimOffset) + meshlet.PrimCount);
+    Primitives.resize(nPrimitives);
+
+    ParallelFor((nMeshlets + MESHLET_BOX_CHUNK - 1) / MESHLET_BOX_CHUNK, nThreads, [&](size_t, size_t iChunk) {
+        size_t end = std::min(nMeshlets, (iChunk + 1) * MESHLET_BOX_CHUNK);
+        for (size_t iMeshlet = iChunk * MESHLET_BOX_CHUNK; iMeshlet < end; ++iMeshlet)
         {
-            uint iParent = meshlet.ParentOffset + iiParent;
-            if (iParent <= iMeshlet || iParent >= Meshlets.size())
-                throw std::runtime_error("Incorrect Parent1");
-            TBoundingBox &aabbParent = MeshletBoxesHierarchy[iParent];
+            const TMeshletPrimitiveDesc &desc      = MeshletPrimitives[iMeshlet];
+            size_t                       streamEnd = iMeshlet + 1 < nMeshlets ? MeshletPrimitives[iMeshlet + 1].Offset
+                                                                              : PrimitiveStream.size();
+            ASSERT_TEXT(desc.Offset <= streamEnd && streamEnd <= PrimitiveStream.size(),
+                        "Incorrect primitive stream offsets");
+            bool isDecoded = ::DecodePrimitives(desc.Encoding,
+                                                PrimitiveStream.data() + desc.Offset,
+                                                streamEnd - desc.Offset,
+                                                Meshlets[iMeshlet].PrimCount,
+                                                Primitives.data() + Meshlets[iMeshlet].PrimOffset);
+            ASSERT_TEXT(isDecoded, "Corrupted primitive stream");
+        }
+    });
+}
 
-            aabbParent.Min.x = XMMin(aabbParent.Min.x, aabb.Min.x);
-            aabbParent.Min.y = XMMin(aabbParent.Min.y, aabb.Min.y);
-            aabbParent.Min.z = XMMin(aabbParent.Min.z, aabb.Min.z);
-            aabbParent.Max.x = XMMax(aabbParent.Max.x, aabb.Max.x);
-            aabbParent.Max.y = XMMax(aabbParent.Max.y, aabb.Max.y);
-            aabbParent.Max.z = XMMax(aabbParent.Max.z, aabb.Max.z);
+static bool HasStripPrimitives(TConstSpan<TMeshletPrimitiveDesc> meshletPrimitives)
+{
+    for (const TMeshletPrimitiveDesc &desc : meshletPrimitives)
+    {
+        if (desc.Encoding == PrimitiveEncoding::Strip)
+            return true;
+    }
+    return false;
+}
+
+bool TMeshletModelCPU::HasGpuPrimitiveStream() const
+{
+    TConstSpan<TMeshletPrimitiveDesc> meshletPrimitives = View(MeshletPrimitives, ModelSection::MeshletPrimitives);
+    return !meshletPrimitives.empty() && !View(PrimitiveStream, ModelSection::PrimitiveStream).empty()
+        && !HasStripPrimitives(meshletPrimitives);
+}
+
+void TMeshletModelCPU::BuildQuantizedVertices(size_t nThreads)
+{
+    size_t nMeshlets = Meshlets.size();
+    ASSERT_EQ(MeshletBoxes.size(), nMeshlets);
+
+    QuantizedVertices.resize(GlobalIndices.size());
+    MeshletQuantization.resize(nMeshlets);
+    ParallelFor((nMeshlets + MESHLET_BOX_CHUNK - 1) / MESHLET_BOX_CHUNK, nThreads, [&](size_t, size_t iChunk) {
+        size_t end = std::min(nMeshlets, (iChunk + 1) * MESHLET_BOX_CHUNK);
+        for (size_t iMeshlet = iChunk * MESHLET_BOX_CHUNK; iMeshlet < end; ++iMeshlet)
+        {
+            const TMeshletDesc &meshlet = Meshlets[iMeshlet];
+            const TBoundingBox &box     = MeshletBoxes[iMeshlet];
+            TVertexQuantization params  = MakeVertexQuantization(box.Min, box.Max);
+
+            MeshletQuantization[iMeshlet] = params;
+            for (uint iMeshletVert = 0; iMeshletVert < meshlet.VertCount; ++iMeshletVert)
+            {
+                uint           iVert  = GlobalIndices[meshlet.VertOffset + iMeshletVert] & UINT32_C(0x7FFFFFFF);
+                const TVertex &vertex = Vertices[iVert];
+                QuantizedVertices[meshlet.VertOffset + iMeshletVert]
+                    = EncodeQuantizedVertex(params, vertex.Position, vertex.Normal);
+            }
+        }
+    });
+}
 
-            Meshlets[iParent].Height = std::max(Meshlets[iParent].Height, meshlet.Height + 1);
-            maxParentError           = std::max(maxParentError, Meshlets[iParent].Error);
+TQuantizationReport TMeshletModelCPU::ValidateQuantizedVertices(size_t nThreads) const
+{
+    size_t nMeshlets = Meshlets.size();
+    ASSERT_EQ(QuantizedVertices.size(), GlobalIndices.size());
+    ASSERT_EQ(MeshletQuantization.size(), nMeshlets);
+
+    size_t                           nChunks = (nMeshlets + MESHLET_BOX_CHUNK - 1) / MESHLET_BOX_CHUNK;
+    std::vector<TQuantizationReport> chunkReports(nChunks);
+    ParallelFor(nChunks, nThreads, [&](size_t, size_t iChunk) {
+        TQuantizationReport &report = chunkReports[iChunk];
+        std::vector<float3>  scalar;
+        std::vector<float3>  batch;
+        size_t               end = std::min(nMeshlets, (iChunk + 1) * MESHLET_BOX_CHUNK);
+        for (size_t iMeshlet = iChunk * MESHLET_BOX_CHUNK; iMeshlet < end; ++iMeshlet)
+        {
+            const TMeshletDesc        &meshlet = Meshlets[iMeshlet];
+            const TVertexQuantization &params  = MeshletQuantization[iMeshlet];
+            const TQuantizedVertex    *q       = QuantizedVertices.data() + meshlet.VertOffset;
+
+            scalar.resize(2 * meshlet.VertCount);
+            batch.resize(2 * meshlet.VertCount);
+            for (uint iMeshletVert = 0; iMeshletVert < meshlet.VertCount; ++iMeshletVert)
+                DecodeQuantizedVertex(params, q[iMeshletVert], &scalar[2 * iMeshletVert]);
+            DecodeQuantizedVertexBatch(params, q, batch.data(), meshlet.VertCount);
+
+            float bound = QuantizationErrorBound(params);
+            if (!MeshletLods.empty() && MeshletLods[iMeshlet].Error > 0.0f && bound > MeshletLods[iMeshlet].Error)
+                report.nOverLodError++;
+
+            for (uint iMeshletVert = 0; iMeshletVert < meshlet.VertCount; ++iMeshletVert)
+            {
+                const float3  *decoded = &scalar[2 * iMeshletVert];
+                uint           iVert   = GlobalIndices[meshlet.VertOffset + iMeshletVert] & UINT32_C(0x7FFFFFFF);
+                const TVertex &vertex  = Vertices[iVert];
+                if (memcmp(decoded, &batch[2 * iMeshletVert], 2 * sizeof(float3)) != 0)
+                    report.nDecodeMismatch++;
+
+                float dx    = decoded[0].x - vertex.Position.x;
+                float dy    = decoded[0].y - vertex.Position.y;
+                float dz    = decoded[0].z - vertex.Position.z;
+                float error = std::sqrt(dx * dx + dy * dy + dz * dz);
+
+                report.MaxPositionError = std::max(report.MaxPositionError, error);
+                if (error > bound)
+                    report.nOverBound++;
+                if (bound > 0.0f)
+                    report.MaxBoundRatio = std::max(report.MaxBoundRatio, error / bound);
+
+                const float3 &n      = vertex.Normal;
+                float         length = std::sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
+                if (length > 0.0f)
+                {
+                    float dot             = (decoded[1].x * n.x + decoded[1].y * n.y + decoded[1].z * n.z) / length;
+                    report.MaxNormalAngle = std::max(report.MaxNormalAngle, std::acos(std::clamp(dot, -1.0f, 1.0f)));
+                }
+            }
         }
+    });
+
+    TQuantizationReport total;
+    for (const TQuantizationReport &report : chunkReports)
+    {
+        total.MaxPositionError = std::max(total.MaxPositionError, report.MaxPositionError);
+        total.MaxBoundRatio    = std::max(total.MaxBoundRatio, report.MaxBoundRatio);
+        total.MaxNormalAngle   = std::max(total.MaxNormalAngle, report.MaxNormalAngle);
+        total.nOverBound += report.nOverBound;
+        total.nDecodeMismatch += report.nDecodeMismatch;
+        total.nOverLodError += report.nOverLodError;
+    }
+    return total;
+}
 
-        maxParentError += meshlet.Error;
-        for (uint iiParent = 0; iiParent < meshlet.ParentCount; ++iiParent)
+void TMeshletModelCPU::LoadFromFile(const std::filesystem::path &path, const TModelLoadOptions &options)
+{
+    using namespace DirectX;
+
+    File.reset();
+    bool hasBounds = false;
+    if (TModelFileView::IsContainer(path))
+    {
+        auto file = std::make_shared<TModelFileView>();
+        file->Open(path);
+        const TModelFileView &view = *file;
+        if (options.VerifyChecksums)
         {
-            uint iParent            = meshlet.ParentOffset + iiParent;
-            Meshlets[iParent].Error = maxParentError;
+            if (const char *corrupted = view.VerifySections())
+                throw std::runtime_error(std::string("Checksum mismatch in model section ") + corrupted);
         }
+        ReadSection(view, ModelSection::Meshlets, Meshlets);
+        ReadSection(view, ModelSection::Meshes, Meshes);
+        ReadSection(view, ModelSection::Groups, Groups);
+        ReadSection(view, ModelSection::GroupMeshlets, GroupMeshlets);
+        ReadSection(view, ModelSection::GroupLinks, GroupLinks);
+
+        uint   version   = view.Header().Version;
+        size_t nMeshlets = Meshlets.size();
+
+        hasBounds = version >= MODEL_FILE_VERSION_BOUNDS
+                 && view.Section<TBoundingBox>(ModelSection::MeshletBoxes).size() == nMeshlets
+                 && view.Section<TBoundingBox>(ModelSection::MeshletBoxesHierarchy).size() == nMeshlets;
+
+        // Packed10 и Packed8 MainMS читает прямо из потока, без копии разворачивать пришлось бы только Strip
+        TConstSpan<TMeshletPrimitiveDesc> meshletPrimitives
+            = view.Section<TMeshletPrimitiveDesc>(ModelSection::MeshletPrimitives);
+        bool isEncoded = view.Section<uint>(ModelSection::Primitives).empty() && !meshletPrimitives.empty();
+        bool hasStrip  = isEncoded && HasStripPrimitives(meshletPrimitives);
+
+        size_t nIndices      = view.Section<uint>(ModelSection::GlobalIndices).size();
+        size_t nQuantized    = view.Section<TQuantizedVertex>(ModelSection::QuantizedVertices).size();
+        size_t nQuantization = view.Section<TVertexQuantization>(ModelSection::MeshletQuantization).size();
+        bool   hasQuantized  = nQuantized == nIndices && nQuantization == nMeshlets;
+
+        // Заимствовать можно только файл, по которому загрузке ничего не нужно достраивать
+        bool isComplete = !Groups.empty() && !view.Section<TLodBounds>(ModelSection::MeshletLods).empty()
+                       && !view.Section<TMeshletCullData>(ModelSection::MeshletCulling).empty() && hasBounds
+                       && !hasStrip && (hasQuantized || nQuantized + nQuantization == 0);
+        if (options.BorrowGpuSections && isComplete)
+        {
+            File = std::move(file);
+        }
+        else
+        {
+            ReadSection(view, ModelSection::Vertices, Vertices);
+            ReadSection(view, ModelSection::GlobalIndices, GlobalIndices);
+            ReadSection(view, ModelSection::Primitives, Primitives);
+            if (version >= MODEL_FILE_VERSION_STREAM)
+            {
+                ReadSection(view, ModelSection::PrimitiveStream, PrimitiveStream);
+                ReadSection(view, ModelSection::MeshletPrimitives, MeshletPrimitives);
+            }
+            ReadSection(view, ModelSection::MeshletLods, MeshletLods);
+            ReadSection(view, ModelSection::MeshletCulling, MeshletCulling);
+            if (version >= MODEL_FILE_VERSION_BOUNDS)
+            {
+                ReadSection(view, ModelSection::MeshletBoxes, MeshletBoxes);
+                ReadSection(view, ModelSection::MeshletBoxesHierarchy, MeshletBoxesHierarchy);
+            }
+            // Треугольники нужны на CPU (BuildCullData); на GPU поток всё равно уйдёт как есть, если в нём нет Strip
+            if (isEncoded)
+                DecodePrimitives();
+            if (hasQuantized)
+            {
+                ReadSection(view, ModelSection::QuantizedVertices, QuantizedVertices);
+                ReadSection(view, ModelSection::MeshletQuantization, MeshletQuantization);
+            }
+            else
+            {
+                QuantizedVertices.clear();
+                MeshletQuantization.clear();
+            }
+        }
+    }
+    else
+    {
+        // Старый формат: массивы подряд, у ранних файлов последних массивов нет вовсе
+        std::ifstream fin(path, std::ios::binary);
+        ASSERT_TEXT(fin.good(), "Could not open model file");
+        ReadVec(fin, Vertices);
+        ReadVec(fin, GlobalIndices);
+        ReadVec(fin, Primitives);
+        ReadVec(fin, Meshlets);
+        ReadVec(fin, Meshes);
+        ReadVec(fin, Groups);
+        ReadVec(fin, GroupMeshlets);
+        ReadVec(fin, GroupLinks);
+        ReadVec(fin, MeshletLods);
+        ReadVec(fin, MeshletCulling);
     }
+
+    // В файлах старого формата групп нет, тогда строим их здесь, пока ошибки мешлетов ещё не накоплены
+    if (Groups.empty())
+        BuildGroups();
+    else
+        FillMeshletSourceGroups();
+    if (View(MeshletLods, ModelSection::MeshletLods).empty())
+        BuildLods();
+    if (View(MeshletCulling, ModelSection::MeshletCulling).empty())
+        BuildCullData();
+
+    // В новых файлах AABB, высоты и накопленные ошибки уже посчитаны конвертером
+    if (!hasBounds)
+        BuildHierarchyBounds();
 }
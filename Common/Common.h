@@ -2,6 +2,12 @@
 
 #include "stdafx.h"
 
+#include "LodMetric.h"
+#include "MeshletCulling.h"
+#include "ModelFile.h"
+#include "PrimitiveEncoding.h"
+#include "VertexQuantization.h"
+
 inline void AssertFn(bool cond, std::string_view text, int line)
 {
     if (cond)
@@ -26,7 +32,96 @@ inline void AssertEqFn(const L &left, const R &right, std::string_view leftText,
 #define ASSERT(cond) AssertFn(cond, "Assertion failed: " #cond, __LINE__)
 #define ASSERT_EQ(left, right) AssertEqFn(left, right, #left, #right, __LINE__)
 
+// Уровень проверки внутренних инвариантов, задаётся при сборке:
+//   VALIDATION_OFF      --- только ASSERT, т.е. проверки входных данных и результатов библиотек;
+//   VALIDATION_CHEAP    --- плюс ASSERT_CHEAP: проверки за O(1) на операцию (индексы, размеры);
+//   VALIDATION_PARANOID --- плюс ASSERT_PARANOID и блоки if constexpr (VALIDATE_PARANOID)
+//                           с полными обходами структур после каждого изменения
+#define VALIDATION_OFF      0
+#define VALIDATION_CHEAP    1
+#define VALIDATION_PARANOID 2
+
+#ifndef VALIDATION_LEVEL
+#ifdef _DEBUG
+#define VALIDATION_LEVEL VALIDATION_CHEAP
+#else
+#define VALIDATION_LEVEL VALIDATION_OFF
+#endif
+#endif
+
+constexpr bool VALIDATE_CHEAP    = VALIDATION_LEVEL >= VALIDATION_CHEAP;
+constexpr bool VALIDATE_PARANOID = VALIDATION_LEVEL >= VALIDATION_PARANOID;
+
+#if VALIDATION_LEVEL >= VALIDATION_CHEAP
+#define ASSERT_CHEAP(cond) ASSERT(cond)
+#define ASSERT_EQ_CHEAP(left, right) ASSERT_EQ(left, right)
+#else
+#define ASSERT_CHEAP(cond) ((void)0)
+#define ASSERT_EQ_CHEAP(left, right) ((void)0)
+#endif
+
+#if VALIDATION_LEVEL >= VALIDATION_PARANOID
+#define ASSERT_PARANOID(cond) ASSERT(cond)
+#define ASSERT_EQ_PARANOID(left, right) ASSERT_EQ(left, right)
+#else
+#define ASSERT_PARANOID(cond) ((void)0)
+#define ASSERT_EQ_PARANOID(left, right) ((void)0)
+#endif
+
+// Число потоков, которое запросит ParallelFor; по нему заводятся буферы на каждый поток
+inline size_t ParallelThreadCount(size_t nThreads)
+{
+    if (nThreads == 0)
+        nThreads = std::thread::hardware_concurrency();
+    return std::max<size_t>(nThreads, 1);
+}
+
+// Параллельный цикл по [0, n): f(iThread, i) вызывается для каждого i ровно один раз,
+// iThread < ParallelThreadCount(nThreads). nThreads == 0 --- по числу ядер.
+// Первое исключение из потоков пробрасывается наружу
+template <typename F> void ParallelFor(size_t n, size_t nThreads, F &&f)
+{
+    nThreads = std::min(ParallelThreadCount(nThreads), n);
+    if (nThreads <= 1)
+    {
+        for (size_t i = 0; i < n; ++i)
+            f(size_t(0), i);
+        return;
+    }
+
+    std::atomic<size_t> next = 0;
+    std::exception_ptr  error;
+    std::mutex          errorMutex;
+
+    auto worker = [&](size_t iThread) {
+        try
+        {
+            for (size_t i = next++; i < n; i = next++)
+                f(iThread, i);
+        }
+        catch (...)
+        {
+            std::lock_guard lock(errorMutex);
+            if (!error)
+                error = std::current_exception();
+            next = n;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(nThreads - 1);
+    for (size_t iThread = 1; iThread < nThreads; ++iThread)
+        threads.emplace_back(worker, iThread);
+    worker(0);
+    for (std::thread &thread : threads)
+        thread.join();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
 constexpr uint MESHLET_MAX_PRIMITIVES = 128;
+constexpr uint MESHLET_MAX_VERTICES   = 128; // out vertices в MainMS.hlsl
 
 struct TVertex
 {
@@ -52,6 +147,24 @@ struct TBoundingBox
     float3 Max;
 };
 
+// Узел DAG: мешлеты группы (MeshletOffset.. в GroupMeshlets) были упрощены вместе
+// в мешлеты ParentOffset.. (подряд в Meshlets)
+struct TMeshletGroup
+{
+    TBoundingBox Box;   // Охватывает мешлеты группы, её упрощённые мешлеты и все группы ниже
+    float        Error; // Ошибка упрощения в единицах длины, накопленная от листьев; не меньше, чем у групп ниже
+    uint         MeshletCount;
+    uint         MeshletOffset;
+    uint         ParentCount;
+    uint         ParentOffset;
+    uint         ChildGroupCount; // Группы, из которых получены мешлеты группы, в GroupLinks
+    uint         ChildGroupOffset;
+    uint         ParentGroupCount; // Группы, в которые попали мешлеты ParentOffset.., в GroupLinks
+    uint         ParentGroupOffset;
+};
+
+constexpr uint MESHLET_NO_GROUP = UINT32_MAX;
+
 struct TMeshDesc
 {
     uint MeshletCount;
@@ -66,6 +179,28 @@ struct TMonoLodCPU
     void LoadGLB(const std::string &path);
 };
 
+// Итог проверки сжатых вершин. Ошибка квантования мешлета сравнивается с его ошибкой упрощения
+// (MeshletLods): у упрощённых мешлетов она не должна быть заметнее самого упрощения
+struct TQuantizationReport
+{
+    float  MaxPositionError = 0.0f;
+    float  MaxBoundRatio    = 0.0f; // Наибольшее отношение ошибки позиции к допуску мешлета
+    float  MaxNormalAngle   = 0.0f; // В радианах
+    size_t nOverBound       = 0;    // Вершины с ошибкой позиции больше допуска
+    size_t nDecodeMismatch  = 0;    // Вершины, на которых скалярный и SSE-декодеры разошлись
+    size_t nOverLodError    = 0;    // Упрощённые мешлеты, у которых допуск больше ошибки упрощения
+};
+
+// Как LoadFromFile читает контейнер
+struct TModelLoadOptions
+{
+    bool VerifyChecksums = MODEL_FILE_VERIFY_ON_LOAD;
+
+    // Секции, которые нужны только GPU, не копируются: модель держит файл открытым (File), и они
+    // читаются через View. Если файлу не хватает производных секций, модель всё равно копируется
+    bool BorrowGpuSections = false;
+};
+
 struct TMeshletModelCPU
 {
     std::vector<TVertex> Vertices;
@@ -76,12 +211,143 @@ struct TMeshletModelCPU
     // Индексы внутри мешлета, 10 бит на каждую из компонент
     std::vector<uint> Primitives;
 
+    // Необязательное сжатое хранение Primitives (PrimitiveEncoding.h): общий байтовый поток
+    // и кодировка каждого мешлета. Если они есть, в файл вместо Primitives пишутся они,
+    // а без Strip на GPU уходят тоже они (HasGpuPrimitiveStream)
+    std::vector<uint8_t>               PrimitiveStream;
+    std::vector<TMeshletPrimitiveDesc> MeshletPrimitives;
+
+    // У сохранённой модели Error и Height мешлетов уже накоплены вверх по DAG (BuildHierarchyBounds)
     std::vector<TMeshletDesc> Meshlets;
-    std::vector<TBoundingBox> MeshletBoxesHierarchy;
+    std::vector<TBoundingBox> MeshletBoxesHierarchy; // Охватывают мешлет и всё, что ниже в DAG
     std::vector<TBoundingBox> MeshletBoxes;
 
     std::vector<TMeshDesc> Meshes;
 
+    // Группы DAG в порядке обхода в ширину от корней, ссылки между ними и списки мешлетов групп
+    std::vector<TMeshletGroup> Groups;
+    std::vector<uint>          GroupMeshlets;
+    std::vector<uint>          GroupLinks;
+
+    // Сферы и ошибки для выбора детализации (LodMetric.h), монотонные вверх по DAG.
+    // Мешлеты, полученные упрощением одной группы, делят одни границы, они же --- границы группы
+    std::vector<TLodBounds> MeshletLods;
+
+    // Собственные сфера и конус нормалей каждого мешлета для отсечения (MeshletCulling.h)
+    std::vector<TMeshletCullData> MeshletCulling;
+
+    // Группа, упрощением которой получен мешлет; MESHLET_NO_GROUP у исходных мешлетов
+    std::vector<uint> MeshletSourceGroup;
+
+    // Необязательный сжатый поток вершин (VertexQuantization.h): по вершине на каждый элемент GlobalIndices
+    // и параметры квантования каждого мешлета. Пустые, если модель сохранена без сжатия
+    std::vector<TQuantizedVertex>    QuantizedVertices;
+    std::vector<TVertexQuantization> MeshletQuantization;
+
+    // Отображённый файл, из которого заимствованы секции при BorrowGpuSections, иначе пуст.
+    // Заимствованные векторы (Vertices, GlobalIndices, Primitives, PrimitiveStream, MeshletPrimitives, MeshletBoxes,
+    // MeshletBoxesHierarchy, MeshletLods, MeshletCulling, QuantizedVertices, MeshletQuantization) остаются пустыми.
+    // Сжатые треугольники при этом не разворачиваются, и Primitives пуст
+    std::shared_ptr<const TModelFileView> File;
+
+    // Вектор модели или, если он заимствован, та же секция отображённого файла
+    template <typename T> TConstSpan<T> View(const std::vector<T> &data, ModelSection id) const
+    {
+        if (File && data.empty())
+            return File->Section<T>(id);
+        return {data.data(), data.size()};
+    }
+
     void SaveToFile(const std::filesystem::path &path) const;
-    void LoadFromFile(const std::filesystem::path &path);
+    void LoadFromFile(const std::filesystem::path &path, const TModelLoadOptions &options = {});
+
+    // Восстанавливает группы по ParentOffset/ParentCount мешлетов:
+    // мешлеты с общими родителями упрощались вместе
+    void BuildGroups();
+    void FillMeshletSourceGroups();
+
+    // Строит MeshletLods по группам, снизу вверх. Ошибка группы --- максимум по её мешлетам
+    // плюс расстояние, соответствующее квадрике упрощения, сфера охватывает сферы мешлетов группы
+    void BuildLods();
+    // Число пар родитель-ребёнок, для которых нарушено IsLodMonotone
+    size_t ValidateLods() const;
+
+    void BuildCullData();
+
+    // Считает MeshletBoxes и MeshletBoxesHierarchy, Height и накапливает Error мешлетов от листьев.
+    // Нужны группы; вызывается последним: BuildGroups и BuildLods ждут ошибки до накопления
+    void BuildHierarchyBounds(size_t nThreads = 0);
+
+    // Кодирует треугольники каждого мешлета самой короткой из кодировок encodingMask (PrimitiveEncodingBit).
+    // Мешлеты, выбравшие Strip, получают в Primitives треугольники в порядке полос
+    void EncodePrimitives(uint encodingMask, size_t nThreads = 0);
+    // Восстанавливает Primitives из PrimitiveStream, на повреждённых данных бросает исключение
+    void DecodePrimitives(size_t nThreads = 0);
+    // Поток есть и состоит только из Packed10 и Packed8, которые MainMS.hlsl читает без распаковки
+    bool HasGpuPrimitiveStream() const;
+
+    // Заполняет QuantizedVertices и MeshletQuantization по MeshletBoxes
+    void BuildQuantizedVertices(size_t nThreads = 0);
+    // Распаковывает сжатые вершины обоими декодерами и сравнивает с исходными
+    TQuantizationReport ValidateQuantizedVertices(size_t nThreads = 0) const;
+
+    // Эталонный обход DAG сверху вниз. Каждая группа проверяется один раз: отсечённая группа
+    // и группа, упрощённых мешлетов которой уже достаточно, пропускаются вместе со всем, что ниже.
+    // Мешлет выбирается, если его группа требует детализации (или он корень), а группа, из которой
+    // он получен, --- нет (или он исходный). isCulled(box), isEnough(error, box).
+    // Выбранные мешлеты записываются в out, возвращает число проверенных групп
+    template <typename CullFn, typename EnoughFn>
+    size_t TraverseGroups(CullFn &&isCulled, EnoughFn &&isEnough, std::vector<uint> &out) const
+    {
+        enum : uint8_t
+        {
+            Unvisited,
+            Culled,
+            Enough,
+            Refined,
+        };
+
+        out.clear();
+        std::vector<uint8_t> state(Groups.size(), Unvisited);
+        std::vector<uint>    queue;
+        size_t               nChecked = 0;
+
+        auto visitMeshlet = [&](uint iMeshlet) {
+            uint iGroup = MeshletSourceGroup[iMeshlet];
+            if (iGroup == MESHLET_NO_GROUP)
+            {
+                out.push_back(iMeshlet);
+                return;
+            }
+            if (state[iGroup] == Unvisited)
+            {
+                const TMeshletGroup &group = Groups[iGroup];
+                if (isCulled(group.Box))
+                    state[iGroup] = Culled;
+                else if (isEnough(group.Error, group.Box))
+                    state[iGroup] = Enough;
+                else
+                {
+                    state[iGroup] = Refined;
+                    queue.push_back(iGroup);
+                }
+                nChecked++;
+            }
+            if (state[iGroup] == Enough)
+                out.push_back(iMeshlet);
+        };
+
+        for (uint iMeshlet = 0; iMeshlet < Meshlets.size(); ++iMeshlet)
+        {
+            if (Meshlets[iMeshlet].ParentCount == 0)
+                visitMeshlet(iMeshlet);
+        }
+        for (size_t iQueue = 0; iQueue < queue.size(); ++iQueue)
+        {
+            const TMeshletGroup &group = Groups[queue[iQueue]];
+            for (uint i = group.MeshletOffset; i < group.MeshletOffset + group.MeshletCount; ++i)
+                visitMeshlet(GroupMeshlets[i]);
+        }
+        return nChecked;
+    }
 };
@@ -0,0 +1,59 @@
+﻿#pragma once
+
+#include "BasicTypes.h"
+
+#include <cmath>
+
+// Метрика выбора уровня детализации, общая для программы на процессоре и шейдеров
+// (зеркало --- MasterThesis/LodMetric.hlsli, формулы должны совпадать).
+//
+// У мешлета есть сфера, охватывающая его и всё, что ниже в DAG, и ошибка упрощения в единицах длины,
+// которая не убывает к корням. На экране ошибка видна как Error * ProjScale / distance пикселей, где
+// ProjScale = высота окна / (2 tan(fovY / 2)) = MatProj._22 * высота / 2. Детализации достаточно,
+// если даже для ближайшей точки сферы это не больше порога, то есть
+// distance >= Error * ProjScale / threshold + Radius. Для заданных FOV и порога выбор сводится
+// к одному сравнению расстояния с заранее известным расстоянием переключения
+struct TLodBounds
+{
+    float3 Center;
+    float  Radius;
+    float  Error;
+};
+
+// Множитель перевода ошибки в расстояние; projYY --- элемент _22 матрицы проекции
+inline float LodErrorToDistance(float projYY, float viewportHeight, float thresholdPixels)
+{
+    return projYY * 0.5f * viewportHeight / thresholdPixels;
+}
+
+inline float LodSwitchDistance(const TLodBounds &lod, float errorToDistance)
+{
+    return lod.Error * errorToDistance + lod.Radius;
+}
+
+// Квадраты сравниваются, чтобы не считать корень
+inline bool IsLodEnough(const TLodBounds &lod, const float3 &cameraPos, float errorToDistance)
+{
+    float dx       = cameraPos.x - lod.Center.x;
+    float dy       = cameraPos.y - lod.Center.y;
+    float dz       = cameraPos.z - lod.Center.z;
+    float distance = LodSwitchDistance(lod, errorToDistance);
+    return dx * dx + dy * dy + dz * dz >= distance * distance;
+}
+
+// Радиус, которого хватает внешней сфере, чтобы охватить внутреннюю.
+// Им же сферы строятся и проверяются, поэтому проверка не зависит от погрешности
+inline float LodSphereReach(const TLodBounds &outer, const TLodBounds &inner)
+{
+    float dx = inner.Center.x - outer.Center.x;
+    float dy = inner.Center.y - outer.Center.y;
+    float dz = inner.Center.z - outer.Center.z;
+    return std::sqrt(dx * dx + dy * dy + dz * dz) + inner.Radius;
+}
+
+// Если родитель охватывает ребёнка и его ошибка не меньше, то из достаточности родителя
+// следует достаточность ребёнка: разрез DAG получается согласованным при любом положении камеры
+inline bool IsLodMonotone(const TLodBounds &parent, const TLodBounds &child)
+{
+    return parent.Error >= child.Error && LodSphereReach(parent, child) <= parent.Radius;
+}
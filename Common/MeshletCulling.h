@@ -0,0 +1,147 @@
+﻿#pragma once
+
+#include "BasicTypes.h"
+
+#include <cmath>
+#include <immintrin.h>
+
+// Отсечение мешлетов на процессоре: сфера против пирамиды видимости и конус нормалей против
+// положения камеры. Ядра не зависят от графики и годятся для консольных замеров
+// (зеркало проверки конуса --- MasterThesis/MeshletCulling.hlsli)
+
+// Сфера охватывает треугольники мешлета, конус --- нормали его треугольников.
+// Мешлет целиком смотрит от камеры, если dot(Center - camera, ConeAxis) >= ConeCutoff * |Center - camera| + Radius.
+// Порядок полей важен для SSE-ядра: две четвёрки float подряд
+struct TMeshletCullData
+{
+    float3 Center;
+    float  Radius;
+    float3 ConeAxis;
+    float  ConeCutoff; // Синус полураствора конуса; 1 --- конус вырожден, мешлет так не отсекается
+};
+
+static_assert(sizeof(TMeshletCullData) == 8 * sizeof(float));
+
+// Причины отсечения, результат ядер --- их объединение, 0 --- мешлет виден
+constexpr uint MESHLET_CULL_FRUSTUM  = 1;
+constexpr uint MESHLET_CULL_BACKFACE = 2;
+
+// Нормированные плоскости пирамиды видимости (внутри n . p + d >= 0) и положение камеры
+// в тех же координатах, что и мешлеты
+struct TCullView
+{
+    DirectX::XMFLOAT4 Planes[6];
+    float3            CameraPos;
+};
+
+// viewProj в соглашении DirectXMath (вектор-строка слева), без транспонирования для шейдеров.
+// Плоскости: -w <= x <= w, -w <= y <= w, 0 <= z <= w
+inline TCullView MakeCullView(const DirectX::XMMATRIX &viewProj, const float3 &cameraPos)
+{
+    DirectX::XMFLOAT4X4 m;
+    DirectX::XMStoreFloat4x4(&m, viewProj);
+    // Линейная комбинация столбцов матрицы: плоскость, на которой s0 x + s1 y + s2 z + s3 w = 0
+    auto combine = [&](float s0, float s1, float s2, float s3) {
+        DirectX::XMFLOAT4 plane;
+        plane.x = s0 * m.m[0][0] + s1 * m.m[0][1] + s2 * m.m[0][2] + s3 * m.m[0][3];
+        plane.y = s0 * m.m[1][0] + s1 * m.m[1][1] + s2 * m.m[1][2] + s3 * m.m[1][3];
+        plane.z = s0 * m.m[2][0] + s1 * m.m[2][1] + s2 * m.m[2][2] + s3 * m.m[2][3];
+        plane.w = s0 * m.m[3][0] + s1 * m.m[3][1] + s2 * m.m[3][2] + s3 * m.m[3][3];
+        return plane;
+    };
+
+    TCullView view;
+    view.Planes[0] = combine(+1.0f, 0.0f, 0.0f, 1.0f);
+    view.Planes[1] = combine(-1.0f, 0.0f, 0.0f, 1.0f);
+    view.Planes[2] = combine(0.0f, +1.0f, 0.0f, 1.0f);
+    view.Planes[3] = combine(0.0f, -1.0f, 0.0f, 1.0f);
+    view.Planes[4] = combine(0.0f, 0.0f, +1.0f, 0.0f);
+    view.Planes[5] = combine(0.0f, 0.0f, -1.0f, 1.0f);
+    for (DirectX::XMFLOAT4 &plane : view.Planes)
+    {
+        float invLength = 1.0f / std::sqrt(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+        plane.x *= invLength;
+        plane.y *= invLength;
+        plane.z *= invLength;
+        plane.w *= invLength;
+    }
+    view.CameraPos = cameraPos;
+    return view;
+}
+
+// Порядок операций совпадает с SSE-ядром ниже, поэтому результаты совпадают побитово
+inline uint CullMeshlet(const TCullView &view, const TMeshletCullData &cull)
+{
+    uint result = 0;
+    for (const DirectX::XMFLOAT4 &plane : view.Planes)
+    {
+        float distance = plane.x * cull.Center.x + plane.y * cull.Center.y + plane.z * cull.Center.z + plane.w;
+        if (distance < -cull.Radius)
+            result |= MESHLET_CULL_FRUSTUM;
+    }
+
+    float dx     = cull.Center.x - view.CameraPos.x;
+    float dy     = cull.Center.y - view.CameraPos.y;
+    float dz     = cull.Center.z - view.CameraPos.z;
+    float along  = cull.ConeAxis.x * dx + cull.ConeAxis.y * dy + cull.ConeAxis.z * dz;
+    float length = std::sqrt(dx * dx + dy * dy + dz * dz);
+    if (along >= cull.ConeCutoff * length + cull.Radius)
+        result |= MESHLET_CULL_BACKFACE;
+    return result;
+}
+
+// Четыре мешлета подряд: записи транспонируются в регистры по компонентам
+inline void CullMeshletsSSE(const TCullView &view, const TMeshletCullData *cull, uint8_t *out)
+{
+    __m128 cx = _mm_loadu_ps(&cull[0].Center.x);
+    __m128 cy = _mm_loadu_ps(&cull[1].Center.x);
+    __m128 cz = _mm_loadu_ps(&cull[2].Center.x);
+    __m128 r  = _mm_loadu_ps(&cull[3].Center.x);
+    _MM_TRANSPOSE4_PS(cx, cy, cz, r);
+    __m128 ax  = _mm_loadu_ps(&cull[0].ConeAxis.x);
+    __m128 ay  = _mm_loadu_ps(&cull[1].ConeAxis.x);
+    __m128 az  = _mm_loadu_ps(&cull[2].ConeAxis.x);
+    __m128 cut = _mm_loadu_ps(&cull[3].ConeAxis.x);
+    _MM_TRANSPOSE4_PS(ax, ay, az, cut);
+
+    __m128 negR    = _mm_sub_ps(_mm_setzero_ps(), r);
+    __m128 frustum = _mm_setzero_ps();
+    for (const DirectX::XMFLOAT4 &plane : view.Planes)
+    {
+        __m128 distance = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), cx),
+                                                           _mm_mul_ps(_mm_set1_ps(plane.y), cy)),
+                                                _mm_mul_ps(_mm_set1_ps(plane.z), cz)),
+                                     _mm_set1_ps(plane.w));
+        frustum         = _mm_or_ps(frustum, _mm_cmplt_ps(distance, negR));
+    }
+
+    __m128 dx       = _mm_sub_ps(cx, _mm_set1_ps(view.CameraPos.x));
+    __m128 dy       = _mm_sub_ps(cy, _mm_set1_ps(view.CameraPos.y));
+    __m128 dz       = _mm_sub_ps(cz, _mm_set1_ps(view.CameraPos.z));
+    __m128 along    = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, dx), _mm_mul_ps(ay, dy)), _mm_mul_ps(az, dz));
+    __m128 length   = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+    __m128 backface = _mm_cmpge_ps(along, _mm_add_ps(_mm_mul_ps(cut, length), r));
+
+    int frustumMask  = _mm_movemask_ps(frustum);
+    int backfaceMask = _mm_movemask_ps(backface);
+    for (int i = 0; i < 4; ++i)
+    {
+        out[i] = uint8_t(((frustumMask >> i) & 1) * MESHLET_CULL_FRUSTUM
+                       | ((backfaceMask >> i) & 1) * MESHLET_CULL_BACKFACE);
+    }
+}
+
+// Причины отсечения n мешлетов подряд. Возвращает число видимых
+inline size_t CullMeshletBatch(const TCullView &view, const TMeshletCullData *cull, uint8_t *out, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        CullMeshletsSSE(view, cull + i, out + i);
+    for (; i < n; ++i)
+        out[i] = uint8_t(CullMeshlet(view, cull[i]));
+
+    size_t nVisible = 0;
+    for (i = 0; i < n; ++i)
+        nVisible += out[i] == 0;
+    return nVisible;
+}
@@ -0,0 +1,227 @@
+﻿#include "stdafx.h"
+
+#include "Common.h"
+
+#include <nmmintrin.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+const char *ModelSectionName(ModelSection section)
+{
+    switch (section)
+    {
+    case ModelSection::Vertices: return "Vertices";
+    case ModelSection::GlobalIndices: return "GlobalIndices";
+    case ModelSection::Primitives: return "Primitives";
+    case ModelSection::Meshlets: return "Meshlets";
+    case ModelSection::Meshes: return "Meshes";
+    case ModelSection::Groups: return "Groups";
+    case ModelSection::GroupMeshlets: return "GroupMeshlets";
+    case ModelSection::GroupLinks: return "GroupLinks";
+    case ModelSection::MeshletLods: return "MeshletLods";
+    case ModelSection::MeshletCulling: return "MeshletCulling";
+    case ModelSection::MeshletBoxes: return "MeshletBoxes";
+    case ModelSection::MeshletBoxesHierarchy: return "MeshletBoxesHierarchy";
+    case ModelSection::QuantizedVertices: return "QuantizedVertices";
+    case ModelSection::MeshletQuantization: return "MeshletQuantization";
+    case ModelSection::PrimitiveStream: return "PrimitiveStream";
+    case ModelSection::MeshletPrimitives: return "MeshletPrimitives";
+    }
+    return "Unknown";
+}
+
+// Инструкция crc32 из SSE 4.2 считает именно CRC-32C, по 8 байт за раз на x64
+uint ModelChecksum(const void *data, size_t size, uint crc)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    crc                  = ~crc;
+#if defined(_M_X64) || defined(__x86_64__)
+    uint64_t crc64 = crc;
+    for (; size >= 8; size -= 8, bytes += 8)
+    {
+        uint64_t word = 0;
+        memcpy(&word, bytes, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = uint(crc64);
+#endif
+    for (; size >= 4; size -= 4, bytes += 4)
+    {
+        uint word = 0;
+        memcpy(&word, bytes, sizeof(word));
+        crc = _mm_crc32_u32(crc, word);
+    }
+    for (; size > 0; --size, ++bytes)
+        crc = _mm_crc32_u8(crc, *bytes);
+    return ~crc;
+}
+
+static size_t AlignModelOffset(size_t offset)
+{
+    return (offset + MODEL_FILE_ALIGNMENT - 1) / MODEL_FILE_ALIGNMENT * MODEL_FILE_ALIGNMENT;
+}
+
+void TModelFileWriter::Write(const std::filesystem::path &path) const
+{
+    TModelFileHeader               header = {};
+    std::vector<TModelSectionDesc> table(mSections.size());
+
+    size_t offset = AlignModelOffset(sizeof(TModelFileHeader) + table.size() * sizeof(TModelSectionDesc));
+    for (size_t iSection = 0; iSection < mSections.size(); ++iSection)
+    {
+        const TPendingSection &section = mSections[iSection];
+        TModelSectionDesc     &desc    = table[iSection];
+        desc.Id                        = section.Id;
+        desc.ElementSize               = section.ElementSize;
+        desc.Offset                    = offset;
+        desc.Count                     = section.Count;
+        desc.Checksum                  = ModelChecksum(section.Data, section.Count * section.ElementSize);
+        offset                         = AlignModelOffset(offset + section.Count * section.ElementSize);
+    }
+    header.SectionCount  = uint(table.size());
+    header.TableChecksum = ModelChecksum(table.data(), table.size() * sizeof(TModelSectionDesc));
+    header.FileSize      = offset;
+
+    std::ofstream fout(path, std::ios::binary);
+    ASSERT_TEXT(fout.good(), "Could not open model file for writing");
+    fout.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    fout.write(reinterpret_cast<const char *>(table.data()), table.size() * sizeof(TModelSectionDesc));
+
+    const char padding[MODEL_FILE_ALIGNMENT] = {};
+    size_t     written                       = sizeof(header) + table.size() * sizeof(TModelSectionDesc);
+    for (size_t iSection = 0; iSection < mSections.size(); ++iSection)
+    {
+        fout.write(padding, table[iSection].Offset - written);
+        size_t nBytes = mSections[iSection].Count * mSections[iSection].ElementSize;
+        fout.write(static_cast<const char *>(mSections[iSection].Data), nBytes);
+        written = table[iSection].Offset + nBytes;
+    }
+    fout.write(padding, header.FileSize - written);
+    ASSERT_TEXT(fout.good(), "Could not write model file");
+}
+
+bool TModelFileView::IsContainer(const std::filesystem::path &path)
+{
+    std::ifstream fin(path, std::ios::binary);
+    uint          magic = 0;
+    fin.read(reinterpret_cast<char *>(&magic), sizeof(magic));
+    return fin.good() && magic == MODEL_FILE_MAGIC;
+}
+
+void TModelFileView::Open(const std::filesystem::path &path)
+{
+    Close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    ASSERT_TEXT(file != INVALID_HANDLE_VALUE, "Could not open model file");
+    mFile = file;
+
+    LARGE_INTEGER fileSize = {};
+    ASSERT_TEXT(GetFileSizeEx(file, &fileSize), "Could not get model file size");
+    mSize = size_t(fileSize.QuadPart);
+    ASSERT_TEXT(mSize >= sizeof(TModelFileHeader), "Model file is too small");
+
+    mMapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    ASSERT_TEXT(mMapping != nullptr, "Could not map model file");
+    mData = static_cast<const uint8_t *>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+    ASSERT_TEXT(mData != nullptr, "Could not map model file");
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    ASSERT_TEXT(fd >= 0, "Could not open model file");
+    struct stat st = {};
+    bool        ok = fstat(fd, &st) == 0;
+    mSize          = ok ? size_t(st.st_size) : 0;
+
+    void *data = MAP_FAILED;
+    if (ok && mSize >= sizeof(TModelFileHeader))
+        data = mmap(nullptr, mSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    ASSERT_TEXT(mSize >= sizeof(TModelFileHeader), "Model file is too small");
+    ASSERT_TEXT(data != MAP_FAILED, "Could not map model file");
+    mData = static_cast<const uint8_t *>(data);
+#endif
+
+    try
+    {
+        const TModelFileHeader &header = Header();
+        ASSERT_TEXT(header.Magic == MODEL_FILE_MAGIC, "Not a meshlet model file");
+        ASSERT_TEXT(header.Version >= MODEL_FILE_VERSION_MIN && header.Version <= MODEL_FILE_VERSION,
+                    "Unsupported meshlet model file version");
+        ASSERT_TEXT(header.FileSize == mSize, "Model file is truncated");
+
+        size_t tableSize = size_t(header.SectionCount) * sizeof(TModelSectionDesc);
+        ASSERT_TEXT(header.SectionCount <= (mSize - sizeof(TModelFileHeader)) / sizeof(TModelSectionDesc),
+                    "Model section table is out of file");
+        ASSERT_TEXT(ModelChecksum(mData + sizeof(TModelFileHeader), tableSize) == header.TableChecksum,
+                    "Model section table is corrupted");
+
+        for (const TModelSectionDesc &desc : Sections())
+        {
+            ASSERT_TEXT(desc.Offset % MODEL_FILE_ALIGNMENT == 0, "Model section is misaligned");
+            ASSERT_TEXT(desc.Offset <= mSize && desc.ElementSize > 0
+                     && desc.Count <= (mSize - desc.Offset) / desc.ElementSize,
+                        "Model section is out of file");
+        }
+    }
+    catch (...)
+    {
+        Close();
+        throw;
+    }
+}
+
+void TModelFileView::Close()
+{
+#ifdef _WIN32
+    if (mData)
+        UnmapViewOfFile(mData);
+    if (mMapping)
+        CloseHandle(mMapping);
+    if (mFile)
+        CloseHandle(mFile);
+#else
+    if (mData)
+        munmap(const_cast<uint8_t *>(mData), mSize);
+#endif
+    mData    = nullptr;
+    mSize    = 0;
+    mFile    = nullptr;
+    mMapping = nullptr;
+}
+
+const TModelSectionDesc *TModelFileView::FindSection(ModelSection id) const noexcept
+{
+    for (const TModelSectionDesc &desc : Sections())
+    {
+        if (desc.Id == id)
+            return &desc;
+    }
+    return nullptr;
+}
+
+const char *TModelFileView::VerifySections() const
+{
+    TConstSpan<TModelSectionDesc> sections = Sections();
+    std::vector<uint8_t>          isValid(sections.size(), 0);
+    ParallelFor(sections.size(), 0, [&](size_t, size_t iSection) {
+        const TModelSectionDesc &desc = sections[iSection];
+        isValid[iSection] = ModelChecksum(mData + desc.Offset, size_t(desc.Count * desc.ElementSize)) == desc.Checksum;
+    });
+    for (size_t iSection = 0; iSection < sections.size(); ++iSection)
+    {
+        if (!isValid[iSection])
+            return ModelSectionName(sections[iSection].Id);
+    }
+    return nullptr;
+}
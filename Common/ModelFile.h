@@ -0,0 +1,181 @@
+﻿#pragma once
+
+#include "BasicTypes.h"
+
+#include <filesystem>
+
+// Контейнер модели из мешлетов (model.bin).
+//
+// Формат: заголовок TModelFileHeader, за ним таблица из SectionCount описаний TModelSectionDesc,
+// затем данные секций. Каждая секция --- массив Count элементов по ElementSize байт, начинается
+// со смещения, кратного MODEL_FILE_ALIGNMENT, поэтому при отображении файла в память секции можно
+// читать на месте без копирования. У таблицы и у каждой секции своя контрольная сумма CRC-32C.
+// Порядок байт машинный. Неизвестные секции пропускаются, отсутствующие считаются пустыми.
+//
+// Версия 2 добавила секции MeshletBoxes и MeshletBoxesHierarchy; в ней Error и Height мешлетов
+// уже накоплены вверх по DAG, и загрузка не делает ни одного прохода по геометрии.
+//
+// Старый формат --- те же массивы подряд, каждый с 32-битной длиной впереди, без заголовка.
+// Его первое слово --- число вершин, с MODEL_FILE_MAGIC оно не совпадает
+
+constexpr uint   MODEL_FILE_MAGIC          = 0x4C48534D; // "MSHL"
+constexpr uint   MODEL_FILE_VERSION        = 3;
+constexpr uint   MODEL_FILE_VERSION_MIN    = 1; // Самая старая версия, которую ещё можно прочитать
+constexpr uint   MODEL_FILE_VERSION_BOUNDS = 2; // С этой версии AABB и накопленные ошибки хранятся в файле
+constexpr uint   MODEL_FILE_VERSION_STREAM = 3; // С этой версии Primitives может заменять сжатый поток
+constexpr size_t MODEL_FILE_ALIGNMENT      = 64;
+
+// VerifySections читает файл целиком, поэтому при обычной загрузке контрольные суммы сверяются
+// только в отладочной сборке; --inspect-model конвертера проверяет их всегда
+#ifdef _DEBUG
+constexpr bool MODEL_FILE_VERIFY_ON_LOAD = true;
+#else
+constexpr bool MODEL_FILE_VERIFY_ON_LOAD = false;
+#endif
+
+enum class ModelSection : uint
+{
+    Vertices       = 1,
+    GlobalIndices  = 2,
+    Primitives     = 3,
+    Meshlets       = 4,
+    Meshes         = 5,
+    Groups         = 6,
+    GroupMeshlets  = 7,
+    GroupLinks     = 8,
+    MeshletLods    = 9,
+    MeshletCulling = 10,
+
+    MeshletBoxes          = 11,
+    MeshletBoxesHierarchy = 12,
+
+    // Необязательные, пишутся только для моделей со сжатыми вершинами
+    QuantizedVertices   = 13,
+    MeshletQuantization = 14,
+
+    // Вместо Primitives, если треугольники сохранены в сжатом виде
+    PrimitiveStream   = 15,
+    MeshletPrimitives = 16,
+};
+
+const char *ModelSectionName(ModelSection section);
+
+struct TModelFileHeader
+{
+    uint     Magic         = MODEL_FILE_MAGIC;
+    uint     Version       = MODEL_FILE_VERSION;
+    uint     SectionCount  = 0;
+    uint     TableChecksum = 0; // CRC-32C таблицы секций
+    uint64_t FileSize      = 0;
+};
+
+struct TModelSectionDesc
+{
+    ModelSection Id          = {};
+    uint         ElementSize = 0;
+    uint64_t     Offset      = 0;
+    uint64_t     Count       = 0;
+    uint         Checksum    = 0; // CRC-32C данных секции
+    uint         Reserved    = 0;
+};
+
+static_assert(sizeof(TModelFileHeader) == 24);
+static_assert(sizeof(TModelSectionDesc) == 32);
+
+// CRC-32C (Castagnoli); crc --- значение для предыдущей части данных
+uint ModelChecksum(const void *data, size_t size, uint crc = 0);
+
+// Массив внутри отображённого файла. Живёт не дольше TModelFileView, из которого получен
+template <typename T> struct TConstSpan
+{
+    const T *Data = nullptr;
+    size_t   Size = 0;
+
+    const T *begin() const noexcept { return Data; }
+    const T *end() const noexcept { return Data + Size; }
+    bool     empty() const noexcept { return Size == 0; }
+    size_t   size() const noexcept { return Size; }
+
+    const T &operator[](size_t i) const noexcept { return Data[i]; }
+};
+
+// Файл модели, отображённый в память только для чтения. Open проверяет заголовок, таблицу секций
+// и границы секций, но не читает сами данные: открытие не зависит от размера файла,
+// а страницы подгружаются системой при первом обращении и делятся между процессами.
+// Контрольные суммы данных проверяет VerifySections, она читает файл целиком
+class TModelFileView
+{
+  public:
+    TModelFileView() = default;
+    TModelFileView(const TModelFileView &) = delete;
+    TModelFileView &operator=(const TModelFileView &) = delete;
+    ~TModelFileView() { Close(); }
+
+    // Бросает исключение, если файл не открылся или повреждён
+    void Open(const std::filesystem::path &path);
+    void Close();
+
+    bool IsOpen() const noexcept { return mData != nullptr; }
+
+    // Файл в новом формате, иначе --- в старом или не модель вовсе
+    static bool IsContainer(const std::filesystem::path &path);
+
+    const TModelFileHeader &Header() const noexcept { return *reinterpret_cast<const TModelFileHeader *>(mData); }
+
+    TConstSpan<TModelSectionDesc> Sections() const noexcept
+    {
+        return {reinterpret_cast<const TModelSectionDesc *>(mData + sizeof(TModelFileHeader)), Header().SectionCount};
+    }
+
+    const TModelSectionDesc *FindSection(ModelSection id) const noexcept;
+
+    // Пустой массив, если секции нет. Если размер элемента не совпадает с sizeof(T), бросает исключение
+    template <typename T> TConstSpan<T> Section(ModelSection id) const
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        static_assert(alignof(T) <= MODEL_FILE_ALIGNMENT);
+
+        const TModelSectionDesc *desc = FindSection(id);
+        if (!desc)
+            return {};
+        if (desc->ElementSize != sizeof(T))
+            throw std::runtime_error(std::string("Unexpected element size in model section ") + ModelSectionName(id));
+        return {reinterpret_cast<const T *>(mData + desc->Offset), size_t(desc->Count)};
+    }
+
+    // Возвращает nullptr или имя первой секции, у которой не сошлась контрольная сумма
+    const char *VerifySections() const;
+
+  private:
+    const uint8_t *mData    = nullptr;
+    size_t         mSize    = 0;
+    void          *mFile    = nullptr; // Дескрипторы отображения, зависят от системы
+    void          *mMapping = nullptr;
+};
+
+// Последовательная запись контейнера: секции добавляются по одной, Write раскладывает их
+// с выравниванием и считает контрольные суммы. Данные секций не копируются и должны
+// жить до вызова Write
+class TModelFileWriter
+{
+  public:
+    template <typename T> void Add(ModelSection id, const std::vector<T> &data)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        static_assert(alignof(T) <= MODEL_FILE_ALIGNMENT);
+        mSections.push_back({id, uint(sizeof(T)), data.data(), data.size()});
+    }
+
+    void Write(const std::filesystem::path &path) const;
+
+  private:
+    struct TPendingSection
+    {
+        ModelSection Id;
+        uint         ElementSize;
+        const void  *Data;
+        size_t       Count;
+    };
+
+    std::vector<TPendingSection> mSections;
+};
@@ -0,0 +1,280 @@
+﻿#pragma once
+
+#include "BasicTypes.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <vector>
+
+// Сжатые представления треугольников мешлета. Индексы локальные, меньше числа вершин мешлета.
+// Packed10 и Packed8 MainMS.hlsl читает из потока по номеру треугольника (PrimitiveEncoding.hlsli).
+// Strip читается только последовательно, поэтому модели с ним при загрузке разворачиваются в Primitives
+enum class PrimitiveEncoding : uint
+{
+    Packed10 = 0, // uint на треугольник, по 10 бит на индекс
+    Packed8  = 1, // 3 байта на треугольник
+    Strip    = 2, // 2 бита на треугольник и 1 байт на каждый продолжающий полосу, 3 на начинающий
+};
+
+constexpr uint PRIMITIVE_ENCODING_COUNT = 3;
+
+// Маска для выбора кодировок: у каждого мешлета остаётся самая короткая из разрешённых
+constexpr uint PrimitiveEncodingBit(PrimitiveEncoding encoding) { return 1u << uint(encoding); }
+
+constexpr uint PRIMITIVE_ENCODING_ALL = (1u << PRIMITIVE_ENCODING_COUNT) - 1;
+
+// Кодировки, которые MainMS читает прямо из потока. Один мешлет в Strip заставляет развернуть
+// всю модель при загрузке, поэтому автоматический выбор Strip не рассматривает
+constexpr uint PRIMITIVE_ENCODING_GPU
+    = PrimitiveEncodingBit(PrimitiveEncoding::Packed10) | PrimitiveEncodingBit(PrimitiveEncoding::Packed8);
+
+inline const char *PrimitiveEncodingName(PrimitiveEncoding encoding)
+{
+    switch (encoding)
+    {
+    case PrimitiveEncoding::Packed10: return "packed10";
+    case PrimitiveEncoding::Packed8: return "packed8";
+    case PrimitiveEncoding::Strip: return "strip";
+    }
+    return "unknown";
+}
+
+// Байты мешлета лежат в общем потоке с Offset до Offset следующего мешлета (или до конца потока)
+struct TMeshletPrimitiveDesc
+{
+    uint              Offset;
+    PrimitiveEncoding Encoding;
+};
+
+inline uint PackPrimitive(uint i0, uint i1, uint i2) { return i0 | (i1 << 10) | (i2 << 20); }
+
+inline void UnpackPrimitive(uint packed, uint idx[3])
+{
+    idx[0] = packed & 0x3FF;
+    idx[1] = (packed >> 10) & 0x3FF;
+    idx[2] = (packed >> 20) & 0x3FF;
+}
+
+// Коды треугольников в Strip. Предыдущий треугольник (a, b, c), v --- новый индекс:
+//   Restart --- три индекса треугольника,
+//   ReuseBC --- (c, b, v), сосед через ребро bc,
+//   ReuseCA --- (a, c, v), сосед через ребро ca.
+// Сосед обходит общее ребро в обратную сторону, поэтому ориентация треугольников сохраняется
+enum : uint
+{
+    STRIP_RESTART  = 0,
+    STRIP_REUSE_BC = 1,
+    STRIP_REUSE_CA = 2,
+};
+
+// Жадно собирает полосы: продолжает через ребро bc или ca того соседа, у которого меньше свободных соседей,
+// новую полосу начинает с треугольника, у которого их меньше всего. Треугольники в primitives
+// переставляются и поворачиваются так, как их вернёт декодер
+inline void EncodeStrip(uint *primitives, uint nPrimitives, std::vector<uint8_t> &out)
+{
+    struct TDirectedEdge
+    {
+        uint Key;
+        uint Triangle;
+        uint Corner; // Ребро от вершины Corner к следующей
+    };
+
+    std::vector<std::array<uint, 3>> triangles(nPrimitives);
+    std::vector<TDirectedEdge>       edges;
+    edges.reserve(3 * nPrimitives);
+    for (uint iTri = 0; iTri < nPrimitives; ++iTri)
+    {
+        UnpackPrimitive(primitives[iTri], triangles[iTri].data());
+        for (uint iCorner = 0; iCorner < 3; ++iCorner)
+            edges.push_back({(triangles[iTri][iCorner] << 8) | triangles[iTri][(iCorner + 1) % 3], iTri, iCorner});
+    }
+    std::sort(edges.begin(), edges.end(), [](const TDirectedEdge &lhs, const TDirectedEdge &rhs) {
+        return lhs.Key < rhs.Key || (lhs.Key == rhs.Key && lhs.Triangle < rhs.Triangle);
+    });
+
+    std::vector<bool> isUsed(nPrimitives, false);
+    // Свободный треугольник с ребром from -> to; nullptr, если такого нет
+    auto findEdge = [&](uint from, uint to) -> const TDirectedEdge * {
+        uint key  = (from << 8) | to;
+        auto iter = std::lower_bound(
+            edges.begin(), edges.end(), key, [](const TDirectedEdge &edge, uint k) { return edge.Key < k; });
+        for (; iter != edges.end() && iter->Key == key; ++iter)
+        {
+            if (!isUsed[iter->Triangle])
+                return &*iter;
+        }
+        return nullptr;
+    };
+    auto freeNeighbours = [&](uint iTri) {
+        const std::array<uint, 3> &tri   = triangles[iTri];
+        uint                       nFree = 0;
+        for (uint iCorner = 0; iCorner < 3; ++iCorner)
+            nFree += findEdge(tri[(iCorner + 1) % 3], tri[iCorner]) != nullptr;
+        return nFree;
+    };
+
+    size_t controlBegin = out.size();
+    out.resize(out.size() + (2 * nPrimitives + 7) / 8, 0);
+    std::vector<uint> encoded;
+    encoded.reserve(nPrimitives);
+
+    std::array<uint, 3> prev = {};
+    for (uint iCode = 0; iCode < nPrimitives; ++iCode)
+    {
+        uint                 code = STRIP_RESTART;
+        const TDirectedEdge *next = nullptr;
+        if (iCode > 0)
+        {
+            const TDirectedEdge *viaBC = findEdge(prev[2], prev[1]);
+            const TDirectedEdge *viaCA = findEdge(prev[0], prev[2]);
+            if (viaBC && (!viaCA || freeNeighbours(viaBC->Triangle) <= freeNeighbours(viaCA->Triangle)))
+            {
+                code = STRIP_REUSE_BC;
+                next = viaBC;
+            }
+            else if (viaCA)
+            {
+                code = STRIP_REUSE_CA;
+                next = viaCA;
+            }
+        }
+
+        std::array<uint, 3> tri;
+        if (next)
+        {
+            const std::array<uint, 3> &source = triangles[next->Triangle];
+            uint                       corner = next->Corner;
+
+            tri                    = {source[corner], source[(corner + 1) % 3], source[(corner + 2) % 3]};
+            isUsed[next->Triangle] = true;
+            out.push_back(uint8_t(tri[2]));
+        }
+        else
+        {
+            uint iBest = nPrimitives;
+            uint nBest = 4;
+            for (uint iTri = 0; iTri < nPrimitives && nBest > 0; ++iTri)
+            {
+                if (isUsed[iTri])
+                    continue;
+                uint nFree = freeNeighbours(iTri);
+                if (nFree < nBest)
+                {
+                    iBest = iTri;
+                    nBest = nFree;
+                }
+            }
+            tri          = triangles[iBest];
+            isUsed[iBest] = true;
+            for (uint iVert : tri)
+                out.push_back(uint8_t(iVert));
+        }
+
+        out[controlBegin + iCode / 4] |= uint8_t(code << (2 * (iCode % 4)));
+        encoded.push_back(PackPrimitive(tri[0], tri[1], tri[2]));
+        prev = tri;
+    }
+    std::copy(encoded.begin(), encoded.end(), primitives);
+}
+
+// Дописывает закодированные треугольники в out. Для Packed8 и Strip индексы должны помещаться в байт,
+// иначе возвращает false и out не трогает. Strip переставляет треугольники в primitives (см. EncodeStrip)
+inline bool EncodePrimitives(PrimitiveEncoding encoding, uint *primitives, uint nPrimitives, std::vector<uint8_t> &out)
+{
+    if (encoding == PrimitiveEncoding::Packed10)
+    {
+        size_t offset = out.size();
+        out.resize(offset + nPrimitives * sizeof(uint));
+        memcpy(out.data() + offset, primitives, nPrimitives * sizeof(uint));
+        return true;
+    }
+
+    for (uint iTri = 0; iTri < nPrimitives; ++iTri)
+    {
+        uint idx[3];
+        UnpackPrimitive(primitives[iTri], idx);
+        if (std::max({idx[0], idx[1], idx[2]}) > UINT8_MAX)
+            return false;
+    }
+
+    if (encoding == PrimitiveEncoding::Packed8)
+    {
+        for (uint iTri = 0; iTri < nPrimitives; ++iTri)
+        {
+            uint idx[3];
+            UnpackPrimitive(primitives[iTri], idx);
+            for (uint iVert : idx)
+                out.push_back(uint8_t(iVert));
+        }
+        return true;
+    }
+
+    EncodeStrip(primitives, nPrimitives, out);
+    return true;
+}
+
+// Восстанавливает nPrimitives треугольников в формате Packed10. Возвращает false, если данные
+// повреждены: не та длина, неизвестный код или продолжение полосы без начала
+inline bool DecodePrimitives(PrimitiveEncoding encoding, const uint8_t *data, size_t size, uint nPrimitives,
+                             uint *out)
+{
+    switch (encoding)
+    {
+    case PrimitiveEncoding::Packed10:
+        if (size != nPrimitives * sizeof(uint))
+            return false;
+        memcpy(out, data, size);
+        return true;
+
+    case PrimitiveEncoding::Packed8:
+        if (size != 3 * size_t(nPrimitives))
+            return false;
+        for (uint iTri = 0; iTri < nPrimitives; ++iTri)
+            out[iTri] = PackPrimitive(data[3 * iTri], data[3 * iTri + 1], data[3 * iTri + 2]);
+        return true;
+
+    case PrimitiveEncoding::Strip: {
+        size_t pos = (2 * size_t(nPrimitives) + 7) / 8;
+        if (size < pos)
+            return false;
+        uint a = 0;
+        uint b = 0;
+        uint c = 0;
+        for (uint iTri = 0; iTri < nPrimitives; ++iTri)
+        {
+            uint code = (data[iTri / 4] >> (2 * (iTri % 4))) & 3;
+            if (code == STRIP_RESTART)
+            {
+                if (size - pos < 3)
+                    return false;
+                a = data[pos];
+                b = data[pos + 1];
+                c = data[pos + 2];
+                pos += 3;
+            }
+            else
+            {
+                if (iTri == 0 || pos == size)
+                    return false;
+                uint v = data[pos++];
+                if (code == STRIP_REUSE_BC)
+                {
+                    a = c;
+                    c = v;
+                }
+                else if (code == STRIP_REUSE_CA)
+                {
+                    b = c;
+                    c = v;
+                }
+                else
+                    return false;
+            }
+            out[iTri] = PackPrimitive(a, b, c);
+        }
+        return pos == size;
+    }
+    }
+    return false;
+}
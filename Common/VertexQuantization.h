@@ -0,0 +1,214 @@
+﻿#pragma once
+
+#include "BasicTypes.h"
+
+#include <algorithm>
+#include <cmath>
+#include <immintrin.h>
+
+// Сжатые вершины мешлетов: 8 байт вместо 24 у TVertex.
+// Позиция --- три 16-битных числа внутри AABB своего мешлета, p = Offset + q * Scale.
+// Нормаль --- октаэдрическая развёртка, по 8 бит на координату.
+// Поток сжатых вершин идёт параллельно GlobalIndices (по вершине на каждое вхождение в мешлет),
+// как его читает MainMS.hlsl, поэтому параметры квантования у каждого мешлета свои.
+// Скалярное и SSE-декодирование совпадают побитово, шейдерная версия --- MasterThesis/VertexQuantization.hlsli
+struct TQuantizedVertex
+{
+    uint16_t Position[3];
+    uint8_t  Normal[2];
+};
+
+static_assert(sizeof(TQuantizedVertex) == 8);
+
+// Scale = (Max - Min) / 65535 по AABB мешлета; у вырожденной оси 0
+struct TVertexQuantization
+{
+    float3 Offset;
+    float3 Scale;
+};
+
+constexpr float QUANTIZED_POSITION_MAX = 65535.0f;
+constexpr float QUANTIZED_NORMAL_MAX   = 255.0f;
+constexpr float QUANTIZED_NORMAL_STEP  = 2.0f / QUANTIZED_NORMAL_MAX;
+
+inline TVertexQuantization MakeVertexQuantization(const float3 &boxMin, const float3 &boxMax)
+{
+    TVertexQuantization params;
+    params.Offset  = boxMin;
+    params.Scale.x = (boxMax.x - boxMin.x) / QUANTIZED_POSITION_MAX;
+    params.Scale.y = (boxMax.y - boxMin.y) / QUANTIZED_POSITION_MAX;
+    params.Scale.z = (boxMax.z - boxMin.z) / QUANTIZED_POSITION_MAX;
+    return params;
+}
+
+// Допуск ошибки позиции по всем осям сразу: половина шага сетки плюс запас на округление float
+// при восстановлении (несколько ulp от модуля координат)
+inline float QuantizationErrorBound(const TVertexQuantization &params)
+{
+    auto axis = [](float offset, float scale) {
+        float magnitude = std::fabs(offset) + QUANTIZED_POSITION_MAX * scale;
+        return 0.5f * scale + std::ldexp(magnitude, -21);
+    };
+    float ex = axis(params.Offset.x, params.Scale.x);
+    float ey = axis(params.Offset.y, params.Scale.y);
+    float ez = axis(params.Offset.z, params.Scale.z);
+    return std::sqrt(ex * ex + ey * ey + ez * ez);
+}
+
+inline float DecodeQuantizedCoord(float offset, float scale, uint16_t q) { return offset + float(q) * scale; }
+
+// Из трёх соседних узлов сетки берётся тот, что после восстановления ближе к исходной координате
+inline uint16_t EncodeQuantizedCoord(float offset, float scale, float x)
+{
+    if (!(scale > 0.0f))
+        return 0;
+    double q     = std::round((double(x) - double(offset)) / double(scale));
+    int    iBest = int(std::clamp(q, 0.0, double(QUANTIZED_POSITION_MAX)));
+    float  best  = std::fabs(DecodeQuantizedCoord(offset, scale, uint16_t(iBest)) - x);
+    for (int i = std::max(iBest - 1, 0); i <= std::min(iBest + 1, int(QUANTIZED_POSITION_MAX)); ++i)
+    {
+        float error = std::fabs(DecodeQuantizedCoord(offset, scale, uint16_t(i)) - x);
+        if (error < best)
+        {
+            best  = error;
+            iBest = i;
+        }
+    }
+    return uint16_t(iBest);
+}
+
+// Порядок операций совпадает с SSE-ядром ниже и с шейдером
+inline float3 DecodeOctahedralNormal(uint8_t qu, uint8_t qv)
+{
+    float u = float(qu) * QUANTIZED_NORMAL_STEP - 1.0f;
+    float v = float(qv) * QUANTIZED_NORMAL_STEP - 1.0f;
+    float z = 1.0f - std::fabs(u) - std::fabs(v);
+    // Нижняя половина октаэдра отогнута к углам квадрата
+    float t = std::max(-z, 0.0f);
+    u       = u >= 0.0f ? u - t : u + t;
+    v       = v >= 0.0f ? v - t : v + t;
+
+    float length = std::sqrt(u * u + v * v + z * z);
+    return {u / length, v / length, z / length};
+}
+
+// Из четырёх ближайших кодов выбирается тот, что после восстановления ближе всего к нормали по углу
+inline void EncodeOctahedralNormal(const float3 &normal, uint8_t &qu, uint8_t &qv)
+{
+    float l1 = std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+    if (!(l1 > 0.0f))
+    {
+        qu = qv = uint8_t(QUANTIZED_NORMAL_MAX / 2 + 1); // Ближе всего к (0, 0, 1)
+        return;
+    }
+    float u = normal.x / l1;
+    float v = normal.y / l1;
+    if (normal.z < 0.0f)
+    {
+        float uFolded = (1.0f - std::fabs(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+        float vFolded = (1.0f - std::fabs(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+        u             = uFolded;
+        v             = vFolded;
+    }
+
+    float fu      = std::clamp((u + 1.0f) * 0.5f * QUANTIZED_NORMAL_MAX, 0.0f, QUANTIZED_NORMAL_MAX);
+    float fv      = std::clamp((v + 1.0f) * 0.5f * QUANTIZED_NORMAL_MAX, 0.0f, QUANTIZED_NORMAL_MAX);
+    float bestDot = -INFINITY;
+    for (float cu : {std::floor(fu), std::ceil(fu)})
+    {
+        for (float cv : {std::floor(fv), std::ceil(fv)})
+        {
+            float3 decoded = DecodeOctahedralNormal(uint8_t(cu), uint8_t(cv));
+            float  dot     = decoded.x * normal.x + decoded.y * normal.y + decoded.z * normal.z;
+            if (dot > bestDot)
+            {
+                bestDot = dot;
+                qu      = uint8_t(cu);
+                qv      = uint8_t(cv);
+            }
+        }
+    }
+}
+
+inline TQuantizedVertex EncodeQuantizedVertex(const TVertexQuantization &params, const float3 &position,
+                                              const float3 &normal)
+{
+    TQuantizedVertex q;
+    q.Position[0] = EncodeQuantizedCoord(params.Offset.x, params.Scale.x, position.x);
+    q.Position[1] = EncodeQuantizedCoord(params.Offset.y, params.Scale.y, position.y);
+    q.Position[2] = EncodeQuantizedCoord(params.Offset.z, params.Scale.z, position.z);
+    EncodeOctahedralNormal(normal, q.Normal[0], q.Normal[1]);
+    return q;
+}
+
+// Результат --- позиция и нормаль подряд, как в TVertex
+inline void DecodeQuantizedVertex(const TVertexQuantization &params, const TQuantizedVertex &q, float3 *out)
+{
+    out[0].x = DecodeQuantizedCoord(params.Offset.x, params.Scale.x, q.Position[0]);
+    out[0].y = DecodeQuantizedCoord(params.Offset.y, params.Scale.y, q.Position[1]);
+    out[0].z = DecodeQuantizedCoord(params.Offset.z, params.Scale.z, q.Position[2]);
+    out[1]   = DecodeOctahedralNormal(q.Normal[0], q.Normal[1]);
+}
+
+// Четыре вершины одного мешлета: 16-битные поля разбираются по компонентам, считаются в регистрах
+// по четыре и транспонируются обратно в пары позиция-нормаль
+inline void DecodeQuantizedVerticesSSE(const TVertexQuantization &params, const TQuantizedVertex *q, float3 *out)
+{
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(q));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(q + 2));
+    // {x0 x2 y0 y2 z0 z2 n0 n2}, {x1 x3 y1 y3 z1 z3 n1 n3} -> {x0 x1 x2 x3 y0 y1 y2 y3}, {z0 .. z3 n0 .. n3}
+    __m128i lo   = _mm_unpacklo_epi16(a, b);
+    __m128i hi   = _mm_unpackhi_epi16(a, b);
+    __m128i xy   = _mm_unpacklo_epi16(lo, hi);
+    __m128i zn   = _mm_unpackhi_epi16(lo, hi);
+    __m128i zero = _mm_setzero_si128();
+    __m128i n    = _mm_unpackhi_epi16(zn, zero);
+
+    __m128 px = _mm_cvtepi32_ps(_mm_unpacklo_epi16(xy, zero));
+    __m128 py = _mm_cvtepi32_ps(_mm_unpackhi_epi16(xy, zero));
+    __m128 pz = _mm_cvtepi32_ps(_mm_unpacklo_epi16(zn, zero));
+    px        = _mm_add_ps(_mm_set1_ps(params.Offset.x), _mm_mul_ps(px, _mm_set1_ps(params.Scale.x)));
+    py        = _mm_add_ps(_mm_set1_ps(params.Offset.y), _mm_mul_ps(py, _mm_set1_ps(params.Scale.y)));
+    pz        = _mm_add_ps(_mm_set1_ps(params.Offset.z), _mm_mul_ps(pz, _mm_set1_ps(params.Scale.z)));
+
+    __m128 one  = _mm_set1_ps(1.0f);
+    __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 step = _mm_set1_ps(QUANTIZED_NORMAL_STEP);
+    __m128 u    = _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(n, _mm_set1_epi32(0xFF))), step), one);
+    __m128 v    = _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(n, 8)), step), one);
+    __m128 nz   = _mm_sub_ps(_mm_sub_ps(one, _mm_andnot_ps(sign, u)), _mm_andnot_ps(sign, v));
+    // max(0, -z) выбирает те же значения, что std::max(-z, 0.0f), включая знак нуля
+    __m128 t  = _mm_max_ps(_mm_setzero_ps(), _mm_xor_ps(nz, sign));
+    __m128 nx = _mm_add_ps(u, _mm_xor_ps(t, _mm_and_ps(_mm_cmpge_ps(u, _mm_setzero_ps()), sign)));
+    __m128 ny = _mm_add_ps(v, _mm_xor_ps(t, _mm_and_ps(_mm_cmpge_ps(v, _mm_setzero_ps()), sign)));
+
+    __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz)));
+    nx            = _mm_div_ps(nx, length);
+    ny            = _mm_div_ps(ny, length);
+    nz            = _mm_div_ps(nz, length);
+
+    __m128 pad0 = _mm_setzero_ps();
+    __m128 pad1 = _mm_setzero_ps();
+    _MM_TRANSPOSE4_PS(px, py, pz, nx);
+    _MM_TRANSPOSE4_PS(ny, nz, pad0, pad1);
+    float *dst = &out[0].x;
+    _mm_storeu_ps(dst + 0, px);
+    _mm_storel_pi(reinterpret_cast<__m64 *>(dst + 4), ny);
+    _mm_storeu_ps(dst + 6, py);
+    _mm_storel_pi(reinterpret_cast<__m64 *>(dst + 10), nz);
+    _mm_storeu_ps(dst + 12, pz);
+    _mm_storel_pi(reinterpret_cast<__m64 *>(dst + 16), pad0);
+    _mm_storeu_ps(dst + 18, nx);
+    _mm_storel_pi(reinterpret_cast<__m64 *>(dst + 22), pad1);
+}
+
+// n вершин одного мешлета, out --- 2n float3 (раскладка TVertex)
+inline void DecodeQuantizedVertexBatch(const TVertexQuantization &params, const TQuantizedVertex *q, float3 *out,
+                                       size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        DecodeQuantizedVerticesSSE(params, q + i, out + 2 * i);
+    for (; i < n; ++i)
+        DecodeQuantizedVertex(params, q[i], out + 2 * i);
+}
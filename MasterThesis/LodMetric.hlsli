@@ -0,0 +1,27 @@
+#pragma once
+
+// Mirror of Common/LodMetric.h, the formulas must stay identical
+
+struct TLodBounds
+{
+    float3 Center;
+    float Radius;
+    float Error;
+};
+
+float LodErrorToDistance(float projYY, float viewportHeight, float thresholdPixels)
+{
+    return projYY * 0.5f * viewportHeight / thresholdPixels;
+}
+
+float LodSwitchDistance(TLodBounds lod, float errorToDistance)
+{
+    return lod.Error * errorToDistance + lod.Radius;
+}
+
+bool IsLodEnough(TLodBounds lod, float3 cameraPos, float errorToDistance)
+{
+    float3 d = cameraPos - lod.Center;
+    float distance = LodSwitchDistance(lod, errorToDistance);
+    return dot(d, d) >= distance * distance;
+}
@@ -50,12 +50,15 @@ float PixelRadius(TBoundingBox box)
     return AngularRadius(box) * min(MainCB.IntInfo.x, MainCB.IntInfo.y);
 }
 
-bool IsEnough(float err, TBoundingBox box)
+// Pixels of projected error allowed per unit of distance, see LodMetric.hlsli
+float ErrorToDistance()
 {
-    // float r = AngularRadius(box);
-    float r = PixelRadius(box);
-    return r * r / 128 < MainCB.FloatInfo.w;
-    // return err * r < MainCB.FloatInfo.w;
+    return LodErrorToDistance(MainCB.MatProj._22, float(MainCB.IntInfo.y), MainCB.FloatInfo.w);
+}
+
+bool IsEnough(uint iMeshlet)
+{
+    return IsLodEnough(MeshletLods[iMeshlet], MainCB.CameraPos.xyz - MeshPosition, ErrorToDistance());
 }
 
 bool ShouldDisplay(uint iMeshlet, out TMeshlet meshlet)
@@ -76,17 +79,18 @@ bool ShouldDisplay(uint iMeshlet, out TMeshlet meshlet)
     
     if (!isRoot)
     {
-        TMeshlet parent = Meshlets[iParent];
         TBoundingBox parentBox = MeshletBoxesHierarchy[iParent];
         if (IsCulled(parentBox))
             return false;
-        if (IsEnough(parent.Error, parentBox))
+        if (IsEnough(iParent))
             return false;
     }
     
     if (IsCulled(box))
         return false;
-    return isLeaf || IsEnough(meshlet.Error, box);
+    if (!isLeaf && !IsEnough(iMeshlet))
+        return false;
+    return !IsConeBackfacing(MeshletCulling[iMeshlet], MainCB.CameraPos.xyz - MeshPosition);
 }
 
 [numthreads(GROUP_SIZE_AS, 1, 1)]
@@ -13,17 +13,23 @@ uint3 UnpackPrimitive(uint primitive)
     return uint3(primitive & 0x3FF, (primitive >> 10) & 0x3FF, (primitive >> 20) & 0x3FF);
 }
 
-uint3 GetPrimitive(uint index)
+uint3 GetPrimitive(uint iMeshlet, uint index)
 {
+    if (MainCB.IntInfo.w & MODEL_FLAG_ENCODED_PRIMITIVES)
+        return DecodeMeshletPrimitive(PrimitiveStream, MeshletPrimitives[iMeshlet], index);
     uint prim = Primitives[Meshlet.PrimOffset + index];
     return UnpackPrimitive(prim);
 }
 
-TVertexOut GetVertexAttributes(float3 pos, uint iLocVert)
+TVertexOut GetVertexAttributes(float3 pos, uint iMeshlet, uint iLocVert)
 {
     // uint iVert = GlobalIndices[Meshlet.VertOffset + iLocVert];
     uint iVert = Meshlet.VertOffset + iLocVert;
-    TVertex v = Vertices[iVert];
+    TVertex v;
+    if (MainCB.IntInfo.w & MODEL_FLAG_QUANTIZED)
+        DecodeQuantizedVertex(QuantizedVertices[iVert], MeshletQuantization[iMeshlet], v.Position, v.Normal);
+    else
+        v = Vertices[iVert];
     TVertexOut vout;
     vout.PositionVS = mul(float4(v.Position + pos, 1), MainCB.MatView).xyz;
     vout.PositionHS = mul(float4(v.Position + pos, 1), MainCB.MatViewProj);
@@ -72,8 +78,8 @@ void main(
     SetMeshOutputCounts(Meshlet.VertCount, Meshlet.PrimCount);
     
     if (gtid < Meshlet.VertCount)
-        Verts[gtid] = GetVertexAttributes(Payload.Position.xyz, gtid);
+        Verts[gtid] = GetVertexAttributes(Payload.Position.xyz, Payload.MeshletIndex[gid], gtid);
 
     if (gtid < Meshlet.PrimCount)
-        Idx[gtid] = GetPrimitive(gtid);
+        Idx[gtid] = GetPrimitive(Payload.MeshletIndex[gid], gtid);
 }
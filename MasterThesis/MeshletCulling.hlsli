@@ -0,0 +1,18 @@
+#pragma once
+
+// Mirror of the cone test in Common/MeshletCulling.h
+
+struct TMeshletCullData
+{
+    float3 Center;
+    float Radius;
+    float3 ConeAxis;
+    float ConeCutoff;
+};
+
+// All triangles of the meshlet face away from the camera
+bool IsConeBackfacing(TMeshletCullData cull, float3 cameraPos)
+{
+    float3 d = cull.Center - cameraPos;
+    return dot(cull.ConeAxis, d) >= cull.ConeCutoff * length(d) + cull.Radius;
+}
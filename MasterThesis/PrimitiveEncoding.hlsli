@@ -0,0 +1,33 @@
+#pragma once
+
+// Mirror of the GPU-readable encodings in Common/PrimitiveEncoding.h.
+// Packed10 is a uint per triangle, Packed8 is three index bytes per triangle.
+// Strip meshlets are decoded on the CPU at load and never reach the shader
+
+#define PRIMITIVE_ENCODING_PACKED10 0
+#define PRIMITIVE_ENCODING_PACKED8 1
+
+struct TMeshletPrimitiveDesc
+{
+    uint Offset;
+    uint Encoding;
+};
+
+// Four bytes from any byte address; the stream is padded so the second word always exists
+uint LoadStreamWord(ByteAddressBuffer stream, uint address)
+{
+    uint2 words = stream.Load2(address & ~3u);
+    uint shift = 8 * (address & 3);
+    return shift == 0 ? words.x : (words.x >> shift) | (words.y << (32 - shift));
+}
+
+uint3 DecodeMeshletPrimitive(ByteAddressBuffer stream, TMeshletPrimitiveDesc desc, uint index)
+{
+    if (desc.Encoding == PRIMITIVE_ENCODING_PACKED8)
+    {
+        uint bytes = LoadStreamWord(stream, desc.Offset + 3 * index);
+        return uint3(bytes & 0xFF, (bytes >> 8) & 0xFF, (bytes >> 16) & 0xFF);
+    }
+    uint packed = LoadStreamWord(stream, desc.Offset + 4 * index);
+    return uint3(packed & 0x3FF, (packed >> 10) & 0x3FF, (packed >> 20) & 0x3FF);
+}
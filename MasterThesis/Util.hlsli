@@ -1,8 +1,17 @@
 #pragma once
 
+#include "LodMetric.hlsli"
+#include "MeshletCulling.hlsli"
+#include "PrimitiveEncoding.hlsli"
+#include "VertexQuantization.hlsli"
+
 #define WAVE_SIZE 32
 #define GROUP_SIZE_AS WAVE_SIZE
 
+// Bits of MainCB.IntInfo.w, MODEL_FLAG_* in UtilD3D.h
+#define MODEL_FLAG_QUANTIZED 1
+#define MODEL_FLAG_ENCODED_PRIMITIVES 2
+
 struct TMainCB
 {
     float4x4 MatView;
@@ -60,7 +69,13 @@ struct TPayload
     "SRV(t2),"                                                                                                         \
     "SRV(t3),"                                                                                                         \
     "SRV(t4),"                                                                                                         \
-    "SRV(t5)"
+    "SRV(t5),"                                                                                                         \
+    "SRV(t6),"                                                                                                         \
+    "SRV(t7),"                                                                                                         \
+    "SRV(t8),"                                                                                                         \
+    "SRV(t9),"                                                                                                         \
+    "SRV(t10),"                                                                                                        \
+    "SRV(t11)"
 
 ConstantBuffer<TMainCB> MainCB : register(b0);
 ConstantBuffer<TMesh> MeshInfo : register(b1);
@@ -71,6 +86,14 @@ StructuredBuffer<uint> Primitives : register(t2);
 StructuredBuffer<TMeshlet> Meshlets : register(t3);
 StructuredBuffer<TBoundingBox> MeshletBoxesHierarchy : register(t4);
 StructuredBuffer<TBoundingBox> MeshletBoxes : register(t5);
+StructuredBuffer<TLodBounds> MeshletLods : register(t6);
+StructuredBuffer<TMeshletCullData> MeshletCulling : register(t7);
+// Used instead of Vertices with MODEL_FLAG_QUANTIZED; both are bound to the same buffer
+StructuredBuffer<uint2> QuantizedVertices : register(t8);
+StructuredBuffer<TVertexQuantization> MeshletQuantization : register(t9);
+// Used instead of Primitives with MODEL_FLAG_ENCODED_PRIMITIVES; PrimitiveStream shares its buffer with Primitives
+ByteAddressBuffer PrimitiveStream : register(t10);
+StructuredBuffer<TMeshletPrimitiveDesc> MeshletPrimitives : register(t11);
 
 float3 PaletteColor(uint idx)
 {
@@ -400,11 +400,16 @@ void TMeshletPipeline::Load(const std::filesystem::path &pathMS,
     LoadBytecode(dataAS, dataMS, dataPS);
 }
 
-template <typename T>
-static void QueryUploadVector(const std::vector<T> &data, PResource *outBuffer, PResource *outUpload)
+// Fill writes dataSize bytes into the mapped upload heap; padding zero bytes follow them
+// for shaders that read whole words past the end
+template <typename FillFn>
+static void QueryUploadBuffer(size_t     dataSize,
+                              PResource *outBuffer,
+                              PResource *outUpload,
+                              size_t     padding,
+                              FillFn   &&fill)
 {
-    size_t dataSize = sizeof(T) * data.size();
-    UINT64 bufWidth = (dataSize + 3) / 4 * 4;
+    UINT64 bufWidth = (dataSize + padding + 3) / 4 * 4;
     auto   bufDesc  = CD3DX12_RESOURCE_DESC::Buffer(bufWidth);
 
     auto defaultHeap = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
@@ -425,7 +430,8 @@ static void QueryUploadVector(const std::vector<T> &data, PResource *outBuffer,
 
     void *memory = nullptr;
     ThrowIfFailed((*outUpload)->Map(0, nullptr, &memory));
-    std::memcpy(memory, data.data(), dataSize);
+    fill(memory);
+    std::memset(static_cast<uint8_t *>(memory) + dataSize, 0, size_t(bufWidth - dataSize));
     (*outUpload)->Unmap(0, nullptr);
 
     pCommandList->CopyResource(outBuffer->Get(), outUpload->Get());
@@ -435,6 +441,21 @@ static void QueryUploadVector(const std::vector<T> &data, PResource *outBuffer,
     pCommandList->ResourceBarrier(1, &barrier);
 }
 
+template <typename T>
+static void QueryUploadSpan(TConstSpan<T> data, PResource *outBuffer, PResource *outUpload, size_t padding = 0)
+{
+    size_t dataSize = sizeof(T) * data.size();
+    QueryUploadBuffer(dataSize, outBuffer, outUpload, padding, [&](void *memory) {
+        std::memcpy(memory, data.Data, dataSize);
+    });
+}
+
+template <typename T>
+static void QueryUploadVector(const std::vector<T> &data, PResource *outBuffer, PResource *outUpload)
+{
+    QueryUploadSpan(TConstSpan<T>{data.data(), data.size()}, outBuffer, outUpload);
+}
+
 void TMonoLodGPU::Upload(const TMonoLodCPU &model)
 {
     PResource pUploadVertices;
@@ -618,15 +639,25 @@ void TMeshletModelGPU::Upload(const TMeshletModelCPU &model)
     PResource pUploadMeshlets;
     PResource pUploadMeshletBoxesHierarchy;
     PResource pUploadMeshletBoxes;
+    PResource pUploadMeshletLods;
+    PResource pUploadMeshletCulling;
+    PResource pUploadMeshletQuantization;
+    PResource pUploadMeshletPrimitives;
 
     meshes = model.Meshes;
 
     ThrowIfFailed(pCommandList->Reset(pCommandAllocator.Get(), nullptr));
 
-    std::vector<TVertex> appliedVertices;
-    appliedVertices.reserve(model.GlobalIndices.size());
-    for (uint iVert : model.GlobalIndices)
-        appliedVertices.push_back(model.Vertices[iVert & UINT32_C(0x7FFFFFFF)]);
+    // Sections borrowed from the mapped model file are copied straight into the upload heaps
+    TConstSpan<TVertex>          vertices      = model.View(model.Vertices, ModelSection::Vertices);
+    TConstSpan<uint>             globalIndices = model.View(model.GlobalIndices, ModelSection::GlobalIndices);
+    TConstSpan<TQuantizedVertex> quantized     = model.View(model.QuantizedVertices, ModelSection::QuantizedVertices);
+
+    // Quantized vertices are already laid out per meshlet and take a third of the memory
+    mIsQuantized = !quantized.empty();
+
+    // Packed10 and packed8 meshlets are uploaded as stored, MainMS decodes them from the byte stream
+    mHasEncodedPrimitives = model.HasGpuPrimitiveStream();
 
     uint MaxVertCount = 0;
     uint MaxPrimCount = 0;
@@ -642,13 +673,48 @@ void TMeshletModelGPU::Upload(const TMeshletModelCPU &model)
         OutputDebugStringW(str.c_str());
     }
 
-    QueryUploadVector(appliedVertices, &pVertices, &pUploadVertices);
+    if (mIsQuantized)
+    {
+        QueryUploadSpan(quantized, &pVertices, &pUploadVertices);
+        QueryUploadSpan(model.View(model.MeshletQuantization, ModelSection::MeshletQuantization),
+                        &pMeshletQuantization,
+                        &pUploadMeshletQuantization);
+    }
+    else
+    {
+        // The shader reads one vertex per GlobalIndices entry; they are gathered straight into the upload heap,
+        // so the vertices are copied once on their way from the file
+        QueryUploadBuffer(globalIndices.size() * sizeof(TVertex), &pVertices, &pUploadVertices, 0, [&](void *memory) {
+            TVertex *applied = static_cast<TVertex *>(memory);
+            for (size_t ii = 0; ii < globalIndices.size(); ++ii)
+                applied[ii] = vertices[globalIndices[ii] & UINT32_C(0x7FFFFFFF)];
+        });
+    }
     // QueryUploadVector(model.Vertices, &pVertices, &pUploadVertices);
     // QueryUploadVector(model.GlobalIndices, &pGlobalIndices, &pUploadGlobalIndices);
-    QueryUploadVector(model.Primitives, &pPrimitives, &pUploadPrimitives);
+    if (mHasEncodedPrimitives)
+    {
+        // LoadStreamWord reads the word after the one holding the last byte
+        QueryUploadSpan(model.View(model.PrimitiveStream, ModelSection::PrimitiveStream),
+                        &pPrimitives,
+                        &pUploadPrimitives,
+                        sizeof(uint));
+        QueryUploadSpan(model.View(model.MeshletPrimitives, ModelSection::MeshletPrimitives),
+                        &pMeshletPrimitives,
+                        &pUploadMeshletPrimitives);
+    }
+    else
+    {
+        QueryUploadSpan(model.View(model.Primitives, ModelSection::Primitives), &pPrimitives, &pUploadPrimitives);
+    }
     QueryUploadVector(model.Meshlets, &pMeshlets, &pUploadMeshlets);
-    QueryUploadVector(model.MeshletBoxesHierarchy, &pMeshletBoxesHierarchy, &pUploadMeshletBoxesHierarchy);
-    QueryUploadVector(model.MeshletBoxes, &pMeshletBoxes, &pUploadMeshletBoxes);
+    QueryUploadSpan(model.View(model.MeshletBoxesHierarchy, ModelSection::MeshletBoxesHierarchy),
+                    &pMeshletBoxesHierarchy,
+                    &pUploadMeshletBoxesHierarchy);
+    QueryUploadSpan(model.View(model.MeshletBoxes, ModelSection::MeshletBoxes), &pMeshletBoxes, &pUploadMeshletBoxes);
+    QueryUploadSpan(model.View(model.MeshletLods, ModelSection::MeshletLods), &pMeshletLods, &pUploadMeshletLods);
+    QueryUploadSpan(
+        model.View(model.MeshletCulling, ModelSection::MeshletCulling), &pMeshletCulling, &pUploadMeshletCulling);
     ThrowIfFailed(pCommandList->Close());
     ExecuteCommandList();
 
@@ -687,6 +753,15 @@ void TMeshletModelGPU::Render(int nInstances)
         pCommandList->SetGraphicsRootShaderResourceView(5, pMeshlets->GetGPUVirtualAddress());
         pCommandList->SetGraphicsRootShaderResourceView(6, pMeshletBoxesHierarchy->GetGPUVirtualAddress());
         pCommandList->SetGraphicsRootShaderResourceView(7, pMeshletBoxes->GetGPUVirtualAddress());
+        pCommandList->SetGraphicsRootShaderResourceView(8, pMeshletLods->GetGPUVirtualAddress());
+        pCommandList->SetGraphicsRootShaderResourceView(9, pMeshletCulling->GetGPUVirtualAddress());
+        // MainMS picks the formats by the MainCB.IntInfo.w flags, but every view has to be bound
+        pCommandList->SetGraphicsRootShaderResourceView(10, pVertices->GetGPUVirtualAddress());
+        pCommandList->SetGraphicsRootShaderResourceView(
+            11, (mIsQuantized ? pMeshletQuantization : pMeshlets)->GetGPUVirtualAddress());
+        pCommandList->SetGraphicsRootShaderResourceView(12, pPrimitives->GetGPUVirtualAddress());
+        pCommandList->SetGraphicsRootShaderResourceView(
+            13, (mHasEncodedPrimitives ? pMeshletPrimitives : pMeshlets)->GetGPUVirtualAddress());
 
         constexpr uint GROUP_SIZE_AS = 32;
 
@@ -36,7 +36,7 @@ struct TMainData
     float4x4 MatViewProj;
     float4x4 MatNormal;
     float4   CameraPos;
-    float4   FloatInfo; // xyz = InstanceOffset, w = ErrorThreshold
+    float4   FloatInfo; // xyz = InstanceOffset, w = ErrorThreshold (pixels)
     uint4    IntInfo;   // xy = ScreenSize, z = DisplayType
 };
 
@@ -129,6 +129,10 @@ class TMonoModelGPU
     size_t LodCount() const noexcept { return mLods.size(); }
 };
 
+//  MainCB.IntInfo.w, MODEL_FLAG_*  Util.hlsli
+constexpr uint MODEL_FLAG_QUANTIZED          = 1;
+constexpr uint MODEL_FLAG_ENCODED_PRIMITIVES = 2;
+
 class TMeshletModelGPU
 {
     PResource pVertices;
@@ -137,13 +141,24 @@ class TMeshletModelGPU
     PResource pMeshlets;
     PResource pMeshletBoxesHierarchy;
     PResource pMeshletBoxes;
+    PResource pMeshletLods;
+    PResource pMeshletCulling;
+    PResource pMeshletQuantization;
+    PResource pMeshletPrimitives;
     uint      mMaxLayer;
+    bool      mIsQuantized          = false; // pVertices  TQuantizedVertex  TVertex
+    bool      mHasEncodedPrimitives = false; // pPrimitives   PrimitiveStream  Primitives
 
     //        
     std::vector<TMeshDesc> meshes;
 
   public:
     constexpr uint MaxLayer() const noexcept { return mMaxLayer; }
+    constexpr bool IsQuantized() const noexcept { return mIsQuantized; }
+    constexpr uint ShaderFlags() const noexcept
+    {
+        return (mIsQuantized ? MODEL_FLAG_QUANTIZED : 0) | (mHasEncodedPrimitives ? MODEL_FLAG_ENCODED_PRIMITIVES : 0);
+    }
 
     void Upload(const TMeshletModelCPU &model);
     void Render(int nInstances);
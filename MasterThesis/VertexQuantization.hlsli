@@ -0,0 +1,29 @@
+#pragma once
+
+// Mirror of the decoder in Common/VertexQuantization.h.
+// Packed vertex: uint2 {x | y << 16, z | normal << 16}, normal = u | v << 8
+
+struct TVertexQuantization
+{
+    float3 Offset;
+    float3 Scale;
+};
+
+float3 DecodeOctahedralNormal(uint packed)
+{
+    float u = float(packed & 0xFF) * (2.0 / 255.0) - 1.0;
+    float v = float((packed >> 8) & 0xFF) * (2.0 / 255.0) - 1.0;
+    float z = 1.0 - abs(u) - abs(v);
+    // The lower half of the octahedron is folded out to the corners of the square
+    float t = max(-z, 0.0);
+    u += u >= 0.0 ? -t : t;
+    v += v >= 0.0 ? -t : t;
+    return normalize(float3(u, v, z));
+}
+
+void DecodeQuantizedVertex(uint2 packed, TVertexQuantization params, out float3 position, out float3 normal)
+{
+    uint3 q = uint3(packed.x & 0xFFFF, packed.x >> 16, packed.y & 0xFFFF);
+    position = params.Offset + float3(q) * params.Scale;
+    normal = DecodeOctahedralNormal(packed.y >> 16);
+}
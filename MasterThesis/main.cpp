@@ -116,8 +116,11 @@ static void LoadAssets()
 #ifdef USE_MONO_LODS
     model.LoadGLBs("../Assets/Statue", 7, MAX_NUM_INSTANCES);
 #else
+    // The file stays mapped only until the upload: GPU-only sections are read from it in place
+    TModelLoadOptions loadOptions;
+    loadOptions.BorrowGpuSections = true;
     TMeshletModelCPU modelCPU;
-    modelCPU.LoadFromFile("../Assets/model.bin");
+    modelCPU.LoadFromFile("../Assets/model.bin", loadOptions);
     model.Upload(modelCPU);
 #endif
 }
@@ -387,6 +390,12 @@ static void OnRender()
                                   0.0f,
                                   1.0f);
 
+#ifdef USE_MONO_LODS
+    uint modelFlags = 0;
+#else
+    uint modelFlags = model.ShaderFlags();
+#endif
+
     MainData.CameraPos = CamFocus - CamOffset * vecForward;
     XMMATRIX matTrans  = XMMatrixTranslationFromVector(-MainData.CameraPos);
 
@@ -395,7 +404,10 @@ static void OnRender()
     MainData.MatViewProj = MainData.MatProj * MainData.MatView;
     MainData.MatNormal   = XMMatrixTranspose(XMMatrixInverse(nullptr, MainData.MatView));
     MainData.FloatInfo   = XMVectorSet(InstanceOffset.x, InstanceOffset.y, InstanceOffset.z, ErrorThreshold);
-    MainData.IntInfo     = XMVectorSetInt(WindowWidth, WindowHeight, DisplayType < 0 ? UINT32_MAX : DisplayType, 0);
+    MainData.IntInfo     = XMVectorSetInt(WindowWidth,
+                                      WindowHeight,
+                                      DisplayType < 0 ? UINT32_MAX : DisplayType,
+                                      modelFlags);
 
     void         *pCameraDataBegin = nullptr;
     CD3DX12_RANGE readRange(0, 0);
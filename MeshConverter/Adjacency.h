@@ -0,0 +1,240 @@
+﻿#pragma once
+
+#include <metis.h>
+
+// Построение графов смежности для METIS без хеш-таблиц.
+// Каждый объект (треугольник, мешлет) владеет несколькими слотами с 64-битными ключами (обычно упакованное ребро).
+// Объекты с одинаковым ключом смежны. Ключи сортируются поразрядно, после чего
+// равные ключи идут подряд, и по этим отрезкам сразу выписываются массивы xadj/adjncy/adjwgt
+
+// Ребро (i, j), i < j, упакованное в один ключ. Индексы вершин должны помещаться в 32 бита
+inline uint64_t PackEdgeKey(size_t iVert, size_t jVert)
+{
+    if (iVert > jVert)
+        std::swap(iVert, jVert);
+    return (uint64_t(iVert) << 32) | uint64_t(jVert);
+}
+
+struct KeyedSlot
+{
+    uint64_t Key  = 0;
+    size_t   Slot = 0;
+};
+
+// Граф в формате CSR, как его принимает METIS
+struct CsrGraph
+{
+    std::vector<idx_t> Xadj;
+    std::vector<idx_t> Adjncy;
+    std::vector<idx_t> Adjwgt;
+
+    idx_t VertexCount() const noexcept { return Xadj.empty() ? 0 : idx_t(Xadj.size() - 1); }
+};
+
+// Меньше этого числа ключей потоки не запускаем
+constexpr size_t ADJACENCY_PARALLEL_THRESHOLD = 1 << 16;
+
+// Устойчивая поразрядная сортировка по Key, разряды по 8 бит.
+// Разряды, одинаковые у всех ключей, пропускаются. Для больших входов гистограммы
+// и раскладка считаются по кускам в nThreads потоков, порядок равных ключей сохраняется
+inline void RadixSortByKey(std::vector<KeyedSlot> &entries, std::vector<KeyedSlot> &temp, size_t nThreads)
+{
+    constexpr size_t N_BUCKETS = 256;
+
+    size_t n = entries.size();
+    if (n < ADJACENCY_PARALLEL_THRESHOLD)
+        nThreads = 1;
+    size_t nChunks   = std::min(ParallelThreadCount(nThreads), std::max<size_t>(n, 1));
+    size_t chunkSize = (n + nChunks - 1) / nChunks;
+
+    uint64_t keyOr  = 0;
+    uint64_t keyAnd = ~uint64_t(0);
+    for (const KeyedSlot &entry : entries)
+    {
+        keyOr |= entry.Key;
+        keyAnd &= entry.Key;
+    }
+    uint64_t varying = keyOr ^ keyAnd;
+
+    temp.resize(n);
+    std::vector<size_t> histograms(nChunks * N_BUCKETS);
+    for (size_t shift = 0; shift < 64; shift += 8)
+    {
+        if (((varying >> shift) & 0xFF) == 0)
+            continue;
+
+        std::fill(histograms.begin(), histograms.end(), 0);
+        ParallelFor(nChunks, nThreads, [&](size_t, size_t iChunk) {
+            size_t *hist = &histograms[iChunk * N_BUCKETS];
+            size_t  beg  = std::min(n, iChunk * chunkSize);
+            size_t  end  = std::min(n, beg + chunkSize);
+            for (size_t i = beg; i < end; ++i)
+                hist[(entries[i].Key >> shift) & 0xFF]++;
+        });
+
+        // Смещения: сначала по разряду, внутри разряда по кускам, так сортировка остаётся устойчивой
+        size_t offset = 0;
+        for (size_t iBucket = 0; iBucket < N_BUCKETS; ++iBucket)
+        {
+            for (size_t iChunk = 0; iChunk < nChunks; ++iChunk)
+            {
+                size_t count                             = histograms[iChunk * N_BUCKETS + iBucket];
+                histograms[iChunk * N_BUCKETS + iBucket] = offset;
+                offset += count;
+            }
+        }
+
+        ParallelFor(nChunks, nThreads, [&](size_t, size_t iChunk) {
+            size_t *pos = &histograms[iChunk * N_BUCKETS];
+            size_t  beg = std::min(n, iChunk * chunkSize);
+            size_t  end = std::min(n, beg + chunkSize);
+            for (size_t i = beg; i < end; ++i)
+                temp[pos[(entries[i].Key >> shift) & 0xFF]++] = entries[i];
+        });
+        entries.swap(temp);
+    }
+}
+
+// Вход заполняется вызывающим кодом: ключи слотов подряд по объектам и границы объектов.
+// Все буферы переиспользуются между вызовами
+struct AdjacencyBuilder
+{
+    std::vector<uint64_t> SlotKeys;
+    std::vector<size_t>   ItemOffsets{0};
+    CsrGraph              Graph;
+
+    std::vector<KeyedSlot> Entries;
+    std::vector<KeyedSlot> Temp;
+    std::vector<size_t>    SlotItem;
+    std::vector<size_t>    SlotRun;
+    std::vector<size_t>    RunBeg;
+    std::vector<size_t>    NeighbourPos;
+
+    void Clear()
+    {
+        SlotKeys.clear();
+        ItemOffsets.clear();
+        ItemOffsets.push_back(0);
+    }
+
+    // Закрывает объект: все добавленные с прошлого вызова ключи принадлежат ему
+    void PushItem() { ItemOffsets.push_back(SlotKeys.size()); }
+
+    size_t ItemCount() const noexcept { return ItemOffsets.size() - 1; }
+
+    // Слоты объекта iItem --- [ItemOffsets[iItem], ItemOffsets[iItem + 1]).
+    // Если mergeDuplicates, объекты с несколькими общими ключами соединяются одним ребром с суммой весов,
+    // иначе ребро выписывается на каждый общий ключ. Соседи идут в порядке слотов объекта,
+    // внутри ключа --- в порядке слотов. slotWeight(iSlot) --- вес ребра через данный слот
+    template <typename WeightFn> void Build(bool mergeDuplicates, size_t nThreads, WeightFn &&slotWeight)
+    {
+        size_t nSlots = SlotKeys.size();
+        size_t nItems = ItemOffsets.size() - 1;
+        ASSERT_EQ(ItemOffsets[nItems], nSlots);
+
+        Entries.resize(nSlots);
+        SlotItem.resize(nSlots);
+        for (size_t iItem = 0; iItem < nItems; ++iItem)
+        {
+            for (size_t iSlot = ItemOffsets[iItem]; iSlot < ItemOffsets[iItem + 1]; ++iSlot)
+            {
+                Entries[iSlot].Key  = SlotKeys[iSlot];
+                Entries[iSlot].Slot = iSlot;
+                SlotItem[iSlot]     = iItem;
+            }
+        }
+        RadixSortByKey(Entries, Temp, nThreads);
+
+        // Отрезки равных ключей
+        RunBeg.clear();
+        SlotRun.resize(nSlots);
+        for (size_t i = 0; i < nSlots; ++i)
+        {
+            if (i == 0 || Entries[i].Key != Entries[i - 1].Key)
+                RunBeg.push_back(i);
+            SlotRun[Entries[i].Slot] = RunBeg.size() - 1;
+        }
+        RunBeg.push_back(nSlots);
+
+        Graph.Xadj.resize(nItems + 1);
+        Graph.Xadj[0] = 0;
+        if (mergeDuplicates)
+        {
+            Graph.Adjncy.clear();
+            Graph.Adjwgt.clear();
+            // Позиция соседа в текущей строке; устаревшие значения распознаются сравнением с началом строки
+            NeighbourPos.assign(nItems, 0);
+            for (size_t iItem = 0; iItem < nItems; ++iItem)
+            {
+                size_t rowBeg = Graph.Adjncy.size();
+                for (size_t iSlot = ItemOffsets[iItem]; iSlot < ItemOffsets[iItem + 1]; ++iSlot)
+                {
+                    size_t iRun   = SlotRun[iSlot];
+                    idx_t  weight = slotWeight(iSlot);
+                    for (size_t i = RunBeg[iRun]; i < RunBeg[iRun + 1]; ++i)
+                    {
+                        size_t jItem = SlotItem[Entries[i].Slot];
+                        if (jItem == iItem)
+                            continue;
+                        size_t pos = NeighbourPos[jItem];
+                        if (pos < rowBeg || pos >= Graph.Adjncy.size() || size_t(Graph.Adjncy[pos]) != jItem)
+                        {
+                            pos                 = Graph.Adjncy.size();
+                            NeighbourPos[jItem] = pos;
+                            Graph.Adjncy.push_back(idx_t(jItem));
+                            Graph.Adjwgt.push_back(0);
+                        }
+                        Graph.Adjwgt[pos] += weight;
+                    }
+                }
+                Graph.Xadj[iItem + 1] = idx_t(Graph.Adjncy.size());
+            }
+            return;
+        }
+
+        // Без слияния степени известны заранее, поэтому строки заполняются независимо
+        size_t nChunks   = nSlots < ADJACENCY_PARALLEL_THRESHOLD ? 1 : ParallelThreadCount(nThreads);
+        size_t chunkSize = (nItems + nChunks - 1) / std::max<size_t>(nChunks, 1);
+        auto   forItems  = [&](auto &&f) {
+            ParallelFor(nChunks, nChunks == 1 ? 1 : nThreads, [&](size_t, size_t iChunk) {
+                size_t beg = std::min(nItems, iChunk * chunkSize);
+                size_t end = std::min(nItems, beg + chunkSize);
+                for (size_t iItem = beg; iItem < end; ++iItem)
+                    f(iItem);
+            });
+        };
+
+        forItems([&](size_t iItem) {
+            idx_t degree = 0;
+            for (size_t iSlot = ItemOffsets[iItem]; iSlot < ItemOffsets[iItem + 1]; ++iSlot)
+            {
+                size_t iRun = SlotRun[iSlot];
+                for (size_t i = RunBeg[iRun]; i < RunBeg[iRun + 1]; ++i)
+                    degree += SlotItem[Entries[i].Slot] != iItem;
+            }
+            Graph.Xadj[iItem + 1] = degree;
+        });
+        for (size_t iItem = 0; iItem < nItems; ++iItem)
+            Graph.Xadj[iItem + 1] += Graph.Xadj[iItem];
+
+        Graph.Adjncy.resize(size_t(Graph.Xadj[nItems]));
+        Graph.Adjwgt.resize(size_t(Graph.Xadj[nItems]));
+        forItems([&](size_t iItem) {
+            size_t pos = size_t(Graph.Xadj[iItem]);
+            for (size_t iSlot = ItemOffsets[iItem]; iSlot < ItemOffsets[iItem + 1]; ++iSlot)
+            {
+                size_t iRun   = SlotRun[iSlot];
+                idx_t  weight = slotWeight(iSlot);
+                for (size_t i = RunBeg[iRun]; i < RunBeg[iRun + 1]; ++i)
+                {
+                    size_t jItem = SlotItem[Entries[i].Slot];
+                    if (jItem == iItem)
+                        continue;
+                    Graph.Adjncy[pos] = idx_t(jItem);
+                    Graph.Adjwgt[pos] = weight;
+                    pos++;
+                }
+            }
+        });
+    }
+};
@@ -0,0 +1,39 @@
+﻿#include "AllocationCounter.h"
+
+#include <cstdlib>
+#include <new>
+
+// Глобальная замена operator new/delete действует на всю программу, поэтому она
+// вынесена сюда из main.cpp и собирается только с COUNT_ALLOCATIONS
+
+#if COUNT_ALLOCATIONS
+static thread_local size_t tAllocationCount = 0;
+
+size_t ThreadAllocationCount() noexcept
+{
+    return tAllocationCount;
+}
+
+void *operator new(size_t size)
+{
+    ++tAllocationCount;
+    if (void *ptr = std::malloc(size != 0 ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+#else
+size_t ThreadAllocationCount() noexcept
+{
+    return 0;
+}
+#endif
@@ -0,0 +1,15 @@
+﻿#pragma once
+
+#include <cstddef>
+
+// Подсчёт выделений подменяет глобальные operator new/delete на всю программу, поэтому в обычной
+// сборке он выключен. Для замеров конвертер собирается с COUNT_ALLOCATIONS=1
+#ifndef COUNT_ALLOCATIONS
+#define COUNT_ALLOCATIONS 0
+#endif
+
+constexpr bool ALLOCATIONS_COUNTED = COUNT_ALLOCATIONS != 0;
+
+// Число вызовов operator new в текущем потоке с его запуска, без COUNT_ALLOCATIONS всегда 0.
+// По разности двух замеров проверяется, что децимация групп после прогрева буферов не обращается к куче
+size_t ThreadAllocationCount() noexcept;
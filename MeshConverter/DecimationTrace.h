@@ -0,0 +1,283 @@
+﻿#pragma once
+
+#include <array>
+
+// Двоичный журнал децимации групп. Заменяет выгрузку OBJ после каждого стягивания:
+// при конвертации пишутся только события, а снимки сетки строятся потом отдельным проходом.
+//
+// Формат: заголовок {Magic, Version}, затем записи подряд, каждая начинается с тега uint.
+//   GroupBegin: layer, group, nVertices, nTriangles,
+//               nVertices x {x, y, z, flags}, nTriangles x {i0, i1, i2}
+//   Collapse:   iVert, jVert, iKept, x, y, z, error
+//   GroupEnd:   nCollapses (всего, включая не попавшие в журнал), nTriangles после децимации
+// Кластеризация вершин для застрявших групп пишется теми же Collapse: вершины ячейки
+// по одной стягиваются в оставшуюся, поэтому проигрывание доходит до итоговой сетки группы
+// Индексы вершин локальные для группы. Все поля по 4 байта, порядок байт машинный
+
+constexpr uint DECIMATION_TRACE_MAGIC   = 0x43525444; // "DTRC"
+constexpr uint DECIMATION_TRACE_VERSION = 1;
+
+constexpr uint DECIMATION_TRACE_BORDER = 1; // Флаг граничной вершины
+
+enum class DecimationTraceTag : uint
+{
+    GroupBegin = 1,
+    Collapse   = 2,
+    GroupEnd   = 3,
+};
+
+// Журнал одной группы. Живёт в рабочем мешлете потока и переиспользуется,
+// в общий журнал переносится при слиянии групп, поэтому порядок записей не зависит от числа потоков
+struct DecimationTraceBuffer
+{
+    std::vector<uint> Words;
+    bool              Enabled      = false;
+    size_t            MaxCollapses = 0; // Ограничение на число записанных стягиваний
+    size_t            nCollapses   = 0;
+
+    void Start(bool enabled, size_t maxCollapses)
+    {
+        Words.clear();
+        Enabled      = enabled;
+        MaxCollapses = maxCollapses;
+        nCollapses   = 0;
+    }
+
+    void PushFloat(float x)
+    {
+        uint word = 0;
+        memcpy(&word, &x, sizeof(word));
+        Words.push_back(word);
+    }
+
+    void PushTag(DecimationTraceTag tag) { Words.push_back(uint(tag)); }
+
+    // За заголовком группы должны последовать ровно nVertices вызовов Vertex и nTriangles вызовов Triangle
+    void Begin(size_t iLayer, size_t iGroup, size_t nVertices, size_t nTriangles)
+    {
+        if (!Enabled)
+            return;
+        PushTag(DecimationTraceTag::GroupBegin);
+        Words.push_back(uint(iLayer));
+        Words.push_back(uint(iGroup));
+        Words.push_back(uint(nVertices));
+        Words.push_back(uint(nTriangles));
+    }
+
+    void Vertex(const float3 &pos, bool isBorder)
+    {
+        if (!Enabled)
+            return;
+        PushFloat(pos.x);
+        PushFloat(pos.y);
+        PushFloat(pos.z);
+        Words.push_back(isBorder ? DECIMATION_TRACE_BORDER : 0);
+    }
+
+    void Triangle(size_t i0, size_t i1, size_t i2)
+    {
+        if (!Enabled)
+            return;
+        Words.push_back(uint(i0));
+        Words.push_back(uint(i1));
+        Words.push_back(uint(i2));
+    }
+
+    void Collapse(size_t iVert, size_t jVert, size_t iKept, const float3 &pos, float error)
+    {
+        if (!Enabled)
+            return;
+        if (nCollapses++ >= MaxCollapses)
+            return;
+        PushTag(DecimationTraceTag::Collapse);
+        Words.push_back(uint(iVert));
+        Words.push_back(uint(jVert));
+        Words.push_back(uint(iKept));
+        PushFloat(pos.x);
+        PushFloat(pos.y);
+        PushFloat(pos.z);
+        PushFloat(error);
+    }
+
+    void End(size_t nTriangles)
+    {
+        if (!Enabled)
+            return;
+        PushTag(DecimationTraceTag::GroupEnd);
+        Words.push_back(uint(nCollapses));
+        Words.push_back(uint(nTriangles));
+    }
+};
+
+// Последовательное чтение журнала. При выходе за конец бросает исключение
+struct DecimationTraceReader
+{
+    const std::vector<uint> &Words;
+    size_t                   Pos = 0;
+
+    explicit DecimationTraceReader(const std::vector<uint> &words) : Words(words) {}
+
+    bool IsEnd() const noexcept { return Pos >= Words.size(); }
+
+    uint ReadUint()
+    {
+        ASSERT_TEXT(Pos < Words.size(), "Unexpected end of decimation trace");
+        return Words[Pos++];
+    }
+
+    float ReadFloat()
+    {
+        uint  word = ReadUint();
+        float x    = 0.0f;
+        memcpy(&x, &word, sizeof(x));
+        return x;
+    }
+};
+
+inline void SaveDecimationTrace(const std::filesystem::path &path, const std::vector<uint> &words)
+{
+    std::ofstream fout(path, std::ios::binary);
+    ASSERT_TEXT(fout.good(), "Could not open decimation trace for writing");
+    uint header[2] = {DECIMATION_TRACE_MAGIC, DECIMATION_TRACE_VERSION};
+    fout.write(reinterpret_cast<const char *>(header), sizeof(header));
+    fout.write(reinterpret_cast<const char *>(words.data()), words.size() * sizeof(uint));
+}
+
+inline std::vector<uint> LoadDecimationTrace(const std::filesystem::path &path)
+{
+    std::ifstream fin(path, std::ios::binary | std::ios::ate);
+    ASSERT_TEXT(fin.good(), "Could not open decimation trace");
+    size_t nBytes = size_t(fin.tellg());
+    fin.seekg(0);
+    ASSERT_TEXT(nBytes >= 2 * sizeof(uint) && nBytes % sizeof(uint) == 0, "Invalid decimation trace size");
+
+    uint header[2] = {};
+    fin.read(reinterpret_cast<char *>(header), sizeof(header));
+    ASSERT_EQ(header[0], DECIMATION_TRACE_MAGIC);
+    ASSERT_EQ(header[1], DECIMATION_TRACE_VERSION);
+
+    std::vector<uint> words(nBytes / sizeof(uint) - 2);
+    fin.read(reinterpret_cast<char *>(words.data()), words.size() * sizeof(uint));
+    return words;
+}
+
+// Проигрывает журнал и сохраняет OBJ-снимки групп в outDir: до децимации,
+// после каждых step стягиваний (0 --- без промежуточных) и после последнего записанного.
+// Возвращает число записанных файлов
+inline size_t ReplayDecimationTrace(const std::vector<uint> &words, const std::filesystem::path &outDir, size_t step)
+{
+    std::vector<float3>              positions;
+    std::vector<uint>                flags;
+    std::vector<std::array<uint, 3>> triangles;
+
+    uint   iLayer = 0;
+    uint   iGroup = 0;
+    size_t nFiles = 0;
+
+    auto saveSnapshot = [&](size_t iCollapse) {
+        std::ostringstream ossFilename;
+        ossFilename << "trace_L" << iLayer << "_G" << iGroup << "_" << std::setfill('0') << std::setw(4) << iCollapse
+                    << ".obj";
+        std::ofstream fout(outDir / ossFilename.str());
+        for (const float3 &p : positions)
+            fout << "v " << p.x << " " << p.y << " " << p.z << "\n";
+        for (uint flag : flags)
+            fout << "vt " << ((flag & DECIMATION_TRACE_BORDER) ? 1 : 0) << "\n";
+        for (const auto &tri : triangles)
+        {
+            fout << "f";
+            for (uint iVert : tri)
+                fout << " " << iVert + 1 << "/" << iVert + 1;
+            fout << "\n";
+        }
+        nFiles++;
+    };
+
+    std::filesystem::create_directories(outDir);
+
+    DecimationTraceReader reader(words);
+    size_t                iCollapse     = 0;
+    bool                  lastIsSnapped = true;
+    while (!reader.IsEnd())
+    {
+        auto tag = DecimationTraceTag(reader.ReadUint());
+        switch (tag)
+        {
+        case DecimationTraceTag::GroupBegin: {
+            iLayer          = reader.ReadUint();
+            iGroup          = reader.ReadUint();
+            uint nVertices  = reader.ReadUint();
+            uint nTriangles = reader.ReadUint();
+            positions.resize(nVertices);
+            flags.resize(nVertices);
+            triangles.resize(nTriangles);
+            for (uint iVert = 0; iVert < nVertices; ++iVert)
+            {
+                positions[iVert].x = reader.ReadFloat();
+                positions[iVert].y = reader.ReadFloat();
+                positions[iVert].z = reader.ReadFloat();
+                flags[iVert]       = reader.ReadUint();
+            }
+            for (auto &tri : triangles)
+            {
+                for (uint &iVert : tri)
+                {
+                    iVert = reader.ReadUint();
+                    ASSERT_TEXT(iVert < nVertices, "Vertex index out of range in decimation trace");
+                }
+            }
+            iCollapse = 0;
+            saveSnapshot(iCollapse);
+            lastIsSnapped = true;
+            break;
+        }
+        case DecimationTraceTag::Collapse: {
+            uint   iVert = reader.ReadUint();
+            uint   jVert = reader.ReadUint();
+            uint   iKept = reader.ReadUint();
+            float3 pos   = {};
+            pos.x        = reader.ReadFloat();
+            pos.y        = reader.ReadFloat();
+            pos.z        = reader.ReadFloat();
+            reader.ReadFloat(); // Ошибка для снимков не нужна
+            ASSERT_TEXT(iVert < positions.size() && jVert < positions.size(),
+                        "Vertex index out of range in decimation trace");
+            ASSERT_TEXT(iKept == iVert || iKept == jVert, "Kept vertex is not an edge end in decimation trace");
+
+            // Треугольники на ребре вырождаются и пропадают, остальные переходят на оставшуюся вершину
+            uint iGone       = iKept == iVert ? jVert : iVert;
+            positions[iKept] = pos;
+            for (auto &tri : triangles)
+            {
+                for (uint &jTriVert : tri)
+                {
+                    if (jTriVert == iGone)
+                        jTriVert = iKept;
+                }
+            }
+            triangles.erase(std::remove_if(triangles.begin(),
+                                           triangles.end(),
+                                           [](const std::array<uint, 3> &tri) {
+                                               return tri[0] == tri[1] || tri[1] == tri[2] || tri[2] == tri[0];
+                                           }),
+                            triangles.end());
+
+            ++iCollapse;
+            lastIsSnapped = step != 0 && iCollapse % step == 0;
+            if (lastIsSnapped)
+                saveSnapshot(iCollapse);
+            break;
+        }
+        case DecimationTraceTag::GroupEnd: {
+            reader.ReadUint(); // Полное число стягиваний
+            reader.ReadUint(); // Число треугольников после децимации
+            if (!lastIsSnapped)
+                saveSnapshot(iCollapse);
+            lastIsSnapped = true;
+            break;
+        }
+        default: ASSERT_TEXT(false, "Unknown record in decimation trace"); break;
+        }
+    }
+    return nFiles;
+}
@@ -0,0 +1,278 @@
+﻿#pragma once
+
+#include <array>
+
+// Быстрый путь для регулярных сеток и карт высот. Если проекции вершин на плоскость образуют
+// решётку W x H, а каждая клетка покрыта двумя треугольниками, иерархия строится без METIS и квадрик:
+//   - слой 0 --- квадратные мешлеты по GRID_TILE_CELLS клеток;
+//   - группа --- GRID_GROUP_TILES x GRID_GROUP_TILES мешлетов; внутри группы решётка прореживается
+//     вдвое, граница группы (кроме края сетки) остаётся как есть, группа режется по средним линиям
+//     на 2 x 2 мешлета следующего слоя;
+//   - группы каждого следующего слоя сдвинуты на половину группы предыдущего, поэтому его границы
+//     оказываются внутри новых групп и прореживаются, а новые границы проходят по средним линиям,
+//     уже прореженным на предыдущем шаге. Граница всегда только на шаг подробнее внутренности.
+// Все вершины --- исходные узлы решётки, новые не создаются
+
+// Клеток по стороне мешлета: 2 * 7 * 7 = 98 треугольников, с двумя заблокированными сторонами,
+// на которых в каждой клетке по лишней вершине, 98 + 2 * 7 = 112 <= MESHLET_MAX_PRIMITIVES
+constexpr int64_t GRID_TILE_CELLS  = 7;
+constexpr int64_t GRID_GROUP_TILES = 4;
+
+static_assert(2 * GRID_TILE_CELLS * (GRID_TILE_CELLS + 1) <= MESHLET_MAX_PRIMITIVES);
+static_assert((GRID_TILE_CELLS + 1) * (GRID_TILE_CELLS + 1) + 2 * GRID_TILE_CELLS <= MESHLET_MAX_VERTICES);
+
+enum class GridMode
+{
+    Auto,  // Быстрый путь, если сетка распознана
+    Off,   // Всегда общий путь
+    Force, // Быстрый путь; если сетка не распознана, конвертация прерывается
+};
+
+struct GridNode
+{
+    int64_t X = 0;
+    int64_t Z = 0;
+};
+
+// Узлы [X0, X1] x [Z0, Z1]
+struct GridRect
+{
+    int64_t X0 = 0;
+    int64_t Z0 = 0;
+    int64_t X1 = 0;
+    int64_t Z1 = 0;
+};
+
+// Мешлеты слоя iLayer --- квадраты со стороной Tile, группы --- квадраты со стороной 4 * Tile,
+// их границы проходят через Offset + k * 4 * Tile. Внутри групп шаг решётки становится 2 * Step
+struct GridLayerParams
+{
+    int64_t Step   = 1;
+    int64_t Tile   = GRID_TILE_CELLS;
+    int64_t Offset = 0;
+
+    explicit GridLayerParams(size_t iLayer)
+    {
+        Step   = int64_t(1) << iLayer;
+        Tile   = GRID_TILE_CELLS << iLayer;
+        Offset = 2 * GRID_TILE_CELLS * (Step - 1); // Сумма сдвигов на половину группы по всем слоям ниже
+    }
+
+    int64_t GroupSize() const noexcept { return GRID_GROUP_TILES * Tile; }
+
+    // Номер группы по координате узла внутри неё
+    int64_t GroupIndex(int64_t x) const noexcept
+    {
+        int64_t d = x - Offset;
+        return d >= 0 ? d / GroupSize() : -((-d + GroupSize() - 1) / GroupSize());
+    }
+};
+
+inline int64_t GridCross(const GridNode &a, const GridNode &b, const GridNode &c)
+{
+    return (b.X - a.X) * (c.Z - a.Z) - (b.Z - a.Z) * (c.X - a.X);
+}
+
+// Решётка, на которую ложатся вершины сетки. Ось UpAxis --- высота, две другие --- координаты узла
+struct GridLattice
+{
+    int                   UpAxis    = -1; // -1 --- сетка не распознана
+    int                   AxisX     = 0;
+    int                   AxisZ     = 2;
+    int64_t               Width     = 0;     // Узлов вдоль AxisX
+    int64_t               Height    = 0;     // Узлов вдоль AxisZ
+    bool                  Clockwise = false; // Обход треугольников в координатах узлов
+    std::vector<size_t>   NodeVertex;        // Width * Height
+    std::vector<uint32_t> VertexX;
+    std::vector<uint32_t> VertexZ;
+    std::vector<size_t>   CellTriangles; // По два треугольника на клетку, клетки по строкам
+
+    bool IsValid() const noexcept { return UpAxis >= 0; }
+
+    float Elevation(const float3 &p) const { return Component(p, UpAxis); }
+
+    size_t Vertex(const GridNode &node) const { return NodeVertex[size_t(node.Z * Width + node.X)]; }
+    GridNode Node(size_t iVert) const { return {VertexX[iVert], VertexZ[iVert]}; }
+
+    // Пробует высоту по Y, затем по Z и X. Возвращает nullptr или причину, по которой сетка не подошла.
+    // position(iVert) -> const float3 &, triangle(iTriangle) -> std::array<size_t, 3>
+    template <typename PositionFn, typename TriangleFn>
+    const char *Detect(size_t nVertices, PositionFn &&position, size_t nTriangles, TriangleFn &&triangle)
+    {
+        const char *reason = nullptr;
+        for (int upAxis : {1, 2, 0})
+        {
+            reason = DetectAxis(upAxis, nVertices, position, nTriangles, triangle);
+            if (!reason)
+                return nullptr;
+        }
+        UpAxis = -1;
+        return reason;
+    }
+
+    static float Component(const float3 &p, int axis) { return axis == 0 ? p.x : axis == 1 ? p.y : p.z; }
+
+  private:
+    template <typename PositionFn, typename TriangleFn>
+    const char *DetectAxis(
+        int upAxis, size_t nVertices, PositionFn &&position, size_t nTriangles, TriangleFn &&triangle)
+    {
+        UpAxis = -1;
+        AxisX  = upAxis == 0 ? 1 : 0;
+        AxisZ  = upAxis == 2 ? 1 : 2;
+
+        std::vector<float> xs(nVertices);
+        std::vector<float> zs(nVertices);
+        for (size_t iVert = 0; iVert < nVertices; ++iVert)
+        {
+            xs[iVert] = Component(position(iVert), AxisX);
+            zs[iVert] = Component(position(iVert), AxisZ);
+        }
+        std::sort(xs.begin(), xs.end());
+        std::sort(zs.begin(), zs.end());
+        xs.erase(std::unique(xs.begin(), xs.end()), xs.end());
+        zs.erase(std::unique(zs.begin(), zs.end()), zs.end());
+        Width  = xs.size();
+        Height = zs.size();
+        if (Width < 2 || Height < 2)
+            return "lattice is degenerate";
+        if (size_t(Width * Height) != nVertices)
+            return "vertex coordinates do not form a lattice";
+
+        NodeVertex.assign(nVertices, SIZE_MAX);
+        VertexX.resize(nVertices);
+        VertexZ.resize(nVertices);
+        for (size_t iVert = 0; iVert < nVertices; ++iVert)
+        {
+            float  x     = Component(position(iVert), AxisX);
+            float  z     = Component(position(iVert), AxisZ);
+            size_t ix    = std::lower_bound(xs.begin(), xs.end(), x) - xs.begin();
+            size_t iz    = std::lower_bound(zs.begin(), zs.end(), z) - zs.begin();
+            size_t iNode = iz * Width + ix;
+            if (NodeVertex[iNode] != SIZE_MAX)
+                return "several vertices share a lattice node";
+            NodeVertex[iNode] = iVert;
+            VertexX[iVert]    = uint32_t(ix);
+            VertexZ[iVert]    = uint32_t(iz);
+        }
+
+        int64_t nCells = (Width - 1) * (Height - 1);
+        if (int64_t(nTriangles) != 2 * nCells)
+            return "triangle count does not match the lattice";
+
+        // Угол клетки, которого нет у треугольника; у пары треугольников клетки они должны быть противоположными
+        std::vector<uint8_t> cellMissing(nCells, 0);
+        CellTriangles.assign(2 * nCells, SIZE_MAX);
+        for (size_t iTriangle = 0; iTriangle < nTriangles; ++iTriangle)
+        {
+            std::array<size_t, 3>   tri = triangle(iTriangle);
+            std::array<GridNode, 3> nodes;
+            for (size_t iTriVert = 0; iTriVert < 3; ++iTriVert)
+                nodes[iTriVert] = Node(tri[iTriVert]);
+
+            int64_t minX = std::min({nodes[0].X, nodes[1].X, nodes[2].X});
+            int64_t minZ = std::min({nodes[0].Z, nodes[1].Z, nodes[2].Z});
+            int64_t maxX = std::max({nodes[0].X, nodes[1].X, nodes[2].X});
+            int64_t maxZ = std::max({nodes[0].Z, nodes[1].Z, nodes[2].Z});
+            if (maxX - minX != 1 || maxZ - minZ != 1)
+                return "triangle does not fit a lattice cell";
+
+            int64_t cross = GridCross(nodes[0], nodes[1], nodes[2]);
+            if (cross == 0)
+                return "degenerate triangle";
+            if (iTriangle == 0)
+                Clockwise = cross < 0;
+            else if ((cross < 0) != Clockwise)
+                return "inconsistent triangle winding";
+
+            // Бит угла --- dx + 2 * dz, противоположные углы дают маски 0x9 и 0x6
+            uint8_t corners = 0;
+            for (const GridNode &node : nodes)
+                corners |= 1 << ((node.X - minX) + 2 * (node.Z - minZ));
+            uint8_t missing = 0xF & ~corners;
+
+            int64_t iCell = minZ * (Width - 1) + minX;
+            if (CellTriangles[2 * iCell] == SIZE_MAX)
+            {
+                CellTriangles[2 * iCell] = iTriangle;
+                cellMissing[iCell]       = missing;
+            }
+            else if (CellTriangles[2 * iCell + 1] == SIZE_MAX
+                     && ((missing | cellMissing[iCell]) == 0x9 || (missing | cellMissing[iCell]) == 0x6))
+                CellTriangles[2 * iCell + 1] = iTriangle;
+            else
+                return "lattice cell is not covered by two triangles";
+        }
+        UpAxis = upAxis;
+        return nullptr;
+    }
+};
+
+// Триангулирует клетку [X0, X1] x [Z0, Z1]. sides --- дополнительные узлы строго между углами,
+// по возрастанию координаты: 0 --- нижняя сторона (Z0), 1 --- правая (X1), 2 --- верхняя (Z1), 3 --- левая (X0).
+// Треугольники идут против часовой стрелки в координатах узлов. Если у клетки есть угол без узлов
+// на прилежащих сторонах, она разбивается веером из него, иначе отрезанием ушей
+inline void TriangulateGridCell(const GridRect                             &cell,
+                                const std::array<std::vector<int64_t>, 4> &sides,
+                                std::vector<GridNode>                     &polygon,
+                                std::vector<std::array<GridNode, 3>>      &out)
+{
+    std::array<size_t, 4> corners = {};
+
+    polygon.clear();
+    corners[0] = polygon.size();
+    polygon.push_back({cell.X0, cell.Z0});
+    for (int64_t x : sides[0])
+        polygon.push_back({x, cell.Z0});
+    corners[1] = polygon.size();
+    polygon.push_back({cell.X1, cell.Z0});
+    for (int64_t z : sides[1])
+        polygon.push_back({cell.X1, z});
+    corners[2] = polygon.size();
+    polygon.push_back({cell.X1, cell.Z1});
+    for (auto it = sides[2].rbegin(); it != sides[2].rend(); ++it)
+        polygon.push_back({*it, cell.Z1});
+    corners[3] = polygon.size();
+    polygon.push_back({cell.X0, cell.Z1});
+    for (auto it = sides[3].rbegin(); it != sides[3].rend(); ++it)
+        polygon.push_back({cell.X0, *it});
+
+    // Для клетки без лишних узлов диагональ та же, что в IntermediateMesh::MakePlane
+    size_t n = polygon.size();
+    for (size_t iCorner : {1, 3, 0, 2})
+    {
+        if (!sides[(iCorner + 3) % 4].empty() || !sides[iCorner].empty())
+            continue;
+        size_t apex = corners[iCorner];
+        for (size_t t = 1; t + 1 < n; ++t)
+            out.push_back({polygon[apex], polygon[(apex + t) % n], polygon[(apex + t + 1) % n]});
+        return;
+    }
+
+    // Многоугольник выпуклый, лишние узлы лежат на сторонах. Ухо --- строго выпуклая вершина, после
+    // отрезания которой не все оставшиеся узлы лежат на одной прямой. Оно есть, пока узлов больше трёх:
+    // подходит хотя бы крайний узел самой длинной цепочки узлов на одной прямой. Поэтому треугольники
+    // невырожденные, оставшийся многоугольник снова выпуклый и цикл кончается за n - 3 шага
+    while (polygon.size() > 3)
+    {
+        n           = polygon.size();
+        size_t iEar = n;
+        for (size_t i = 0; i < n && iEar == n; ++i)
+        {
+            const GridNode &prev = polygon[(i + n - 1) % n];
+            const GridNode &next = polygon[(i + 1) % n];
+            if (GridCross(prev, polygon[i], next) <= 0)
+                continue;
+            bool isFlatRest = true;
+            for (size_t j = 0; j < n && isFlatRest; ++j)
+                isFlatRest = j == i || GridCross(prev, next, polygon[j]) == 0;
+            if (!isFlatRest)
+                iEar = i;
+        }
+        ASSERT_TEXT(iEar < n, "Grid cell polygon has no ear to clip");
+        out.push_back({polygon[(iEar + n - 1) % n], polygon[iEar], polygon[(iEar + 1) % n]});
+        polygon.erase(polygon.begin() + iEar);
+    }
+    ASSERT_TEXT(GridCross(polygon[0], polygon[1], polygon[2]) > 0, "Grid cell triangulation is degenerate");
+    out.push_back({polygon[0], polygon[1], polygon[2]});
+}
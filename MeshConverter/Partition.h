@@ -0,0 +1,908 @@
+﻿#pragma once
+
+#include "Adjacency.h"
+
+#include <algorithm>
+
+// Раздвигает младшие 21 бит так, чтобы между ними было по два нулевых
+inline uint64_t SpreadMortonBits(uint64_t x)
+{
+    x &= 0x1FFFFFull;
+    x = (x | (x << 32)) & 0x1F00000000FFFFull;
+    x = (x | (x << 16)) & 0x1F0000FF0000FFull;
+    x = (x | (x << 8)) & 0x100F00F00F00F00Full;
+    x = (x | (x << 4)) & 0x10C30C30C30C30C3ull;
+    x = (x | (x << 2)) & 0x1249249249249249ull;
+    return x;
+}
+
+// Код Мортона точки внутри [boxMin, boxMax], по 21 биту на координату
+inline uint64_t MortonCode(const float3 &p, DirectX::XMVECTOR boxMin, DirectX::XMVECTOR boxMax)
+{
+    constexpr float MAX_CELL = float((1 << 21) - 1);
+
+    DirectX::XMVECTOR extent = DirectX::XMVectorMax(boxMax - boxMin, DirectX::XMVectorReplicate(FLT_MIN));
+    DirectX::XMVECTOR t      = (DirectX::XMLoadFloat3(&p) - boxMin) / extent;
+    t                        = DirectX::XMVectorClamp(t, DirectX::XMVectorZero(), DirectX::XMVectorSplatOne());
+
+    DirectX::XMFLOAT3 cell;
+    DirectX::XMStoreFloat3(&cell, t * MAX_CELL);
+    return SpreadMortonBits(uint64_t(cell.x)) | (SpreadMortonBits(uint64_t(cell.y)) << 1)
+         | (SpreadMortonBits(uint64_t(cell.z)) << 2);
+}
+
+// Сколько треугольников по обе стороны от центра области в порядке Мортона
+// просматривается при поиске ближайшего свободного
+constexpr size_t REGION_NEAREST_WINDOW = 256;
+
+// Разбиение треугольников на мешлеты наращиванием областей.
+// В отличие от METIS ограничения жёсткие: ни одна часть не превышает maxPrimitives треугольников
+// и maxVertices вершин. Область растёт по смежным треугольникам; из кандидатов выбирается тот,
+// что добавляет меньше всего новых вершин, затем имеющий больше общих рёбер с областью,
+// затем ближайший к её центру. Когда ни один кандидат не влезает, область закрывается.
+// Если же у области не осталось свободных соседей, она продолжается с ближайшего свободного треугольника
+// среди REGION_NEAREST_WINDOW соседей центра области в порядке Мортона, а не найдя его, закрывается
+struct RegionGrowingPartitioner
+{
+    // Вход заполняется вызывающим кодом: по 3 индекса вершин и по центру на треугольник
+    std::vector<uint>   TriangleVertices;
+    std::vector<float3> Centroids;
+
+    std::vector<size_t> VertexStamp;   // Номер области + 1, в которой вершина уже есть
+    std::vector<size_t> TriangleStamp; // Номер области + 1, в границе которой лежит треугольник
+    std::vector<idx_t>  Frontier;
+    DirectX::XMVECTOR   CenterSum = DirectX::XMVectorZero();
+
+    // Треугольники по возрастанию кода Мортона центра, для поиска ближайшего свободного
+    std::vector<KeyedSlot> MortonOrder;
+    std::vector<KeyedSlot> MortonTemp;
+    DirectX::XMVECTOR      BoxMin = DirectX::XMVectorZero();
+    DirectX::XMVECTOR      BoxMax = DirectX::XMVectorZero();
+
+    void Clear()
+    {
+        TriangleVertices.clear();
+        Centroids.clear();
+    }
+
+    // Индексы вершин должны быть меньше nVertices, graph --- смежность треугольников.
+    // Возвращает число частей, номера частей записывает в part
+    idx_t Partition(size_t              nVertices,
+                    const CsrGraph     &graph,
+                    size_t              maxPrimitives,
+                    size_t              maxVertices,
+                    std::vector<idx_t> &part)
+    {
+        const std::vector<uint>   &triangleVertices = TriangleVertices;
+        const std::vector<float3> &centroids        = Centroids;
+
+        size_t nTriangles = centroids.size();
+        ASSERT_EQ(triangleVertices.size(), 3 * nTriangles);
+        ASSERT_EQ(size_t(graph.VertexCount()), nTriangles);
+        ASSERT(maxPrimitives > 0 && maxVertices >= 3);
+
+        part.assign(nTriangles, -1);
+        VertexStamp.assign(nVertices, 0);
+        TriangleStamp.assign(nTriangles, 0);
+        SortByMorton(centroids);
+
+        idx_t  nParts = 0;
+        size_t cursor = 0;
+        idx_t  seed   = -1;
+        for (;;)
+        {
+            if (seed < 0)
+            {
+                while (cursor < nTriangles && part[cursor] >= 0)
+                    ++cursor;
+                if (cursor == nTriangles)
+                    break;
+                seed = idx_t(cursor);
+            }
+
+            size_t regionStamp = size_t(nParts) + 1;
+            size_t nPrimitives = 0;
+            size_t nRegionVert = 0;
+            Frontier.clear();
+            CenterSum = DirectX::XMVectorZero();
+
+            idx_t iNext = seed;
+            while (iNext >= 0)
+            {
+                AddTriangle(iNext, nParts, regionStamp, triangleVertices, centroids, graph, part, nRegionVert);
+                nPrimitives++;
+                if (nPrimitives >= maxPrimitives)
+                    break;
+                iNext = PickCandidate(nParts, regionStamp, nPrimitives, nRegionVert, maxVertices, triangleVertices,
+                                      centroids, graph, part);
+                // Связная компонента кончилась, а место ещё есть: продолжаем с ближайшей
+                // свободной, иначе каждый мелкий островок станет отдельным мешлетом
+                if (iNext < 0 && !HasFreeFrontier(part))
+                    iNext = PickNearestFree(regionStamp, nPrimitives, nRegionVert, maxVertices, triangleVertices,
+                                            centroids, part);
+            }
+
+            // Следующую область начинаем от оставшейся границы: берём треугольник
+            // с наименьшим числом свободных соседей, чтобы не оставлять мелких островков
+            seed               = -1;
+            size_t bestFreeDeg = SIZE_MAX;
+            for (idx_t iTriangle : Frontier)
+            {
+                if (part[iTriangle] >= 0)
+                    continue;
+                size_t freeDeg = 0;
+                for (idx_t e = graph.Xadj[iTriangle]; e < graph.Xadj[size_t(iTriangle) + 1]; ++e)
+                    freeDeg += part[graph.Adjncy[e]] < 0;
+                if (freeDeg < bestFreeDeg)
+                {
+                    bestFreeDeg = freeDeg;
+                    seed        = iTriangle;
+                }
+            }
+            nParts++;
+        }
+        return nParts;
+    }
+
+  private:
+    bool HasFreeFrontier(const std::vector<idx_t> &part) const
+    {
+        for (idx_t iTriangle : Frontier)
+        {
+            if (part[iTriangle] < 0)
+                return true;
+        }
+        return false;
+    }
+
+    void SortByMorton(const std::vector<float3> &centroids)
+    {
+        BoxMin = DirectX::XMVectorReplicate(FLT_MAX);
+        BoxMax = DirectX::XMVectorReplicate(-FLT_MAX);
+        for (const float3 &centroid : centroids)
+        {
+            BoxMin = DirectX::XMVectorMin(BoxMin, DirectX::XMLoadFloat3(&centroid));
+            BoxMax = DirectX::XMVectorMax(BoxMax, DirectX::XMLoadFloat3(&centroid));
+        }
+
+        MortonOrder.resize(centroids.size());
+        for (size_t i = 0; i < centroids.size(); ++i)
+        {
+            MortonOrder[i].Key  = MortonCode(centroids[i], BoxMin, BoxMax);
+            MortonOrder[i].Slot = i;
+        }
+        // Вызывается и внутри параллельного цикла по группам, поэтому в один поток
+        RadixSortByKey(MortonOrder, MortonTemp, 1);
+    }
+
+    // Просматривает только окно порядка Мортона вокруг центра области, так что каждый вызов
+    // стоит O(REGION_NEAREST_WINDOW), а не O(n). Найденный треугольник может оказаться не самым
+    // близким; если в окне всё занято, область закрывается и следующая начнётся с курсора
+    idx_t PickNearestFree(size_t                     regionStamp,
+                          size_t                     nPrimitives,
+                          size_t                     nRegionVert,
+                          size_t                     maxVertices,
+                          const std::vector<uint>   &triangleVertices,
+                          const std::vector<float3> &centroids,
+                          const std::vector<idx_t>  &part) const
+    {
+        DirectX::XMVECTOR center = CenterSum / float(nPrimitives);
+
+        float3 centerPoint;
+        DirectX::XMStoreFloat3(&centerPoint, center);
+        KeyedSlot probe;
+        probe.Key = MortonCode(centerPoint, BoxMin, BoxMax);
+
+        auto   byKey = [](const KeyedSlot &a, const KeyedSlot &b) { return a.Key < b.Key; };
+        size_t iMid  = std::lower_bound(MortonOrder.begin(), MortonOrder.end(), probe, byKey) - MortonOrder.begin();
+        size_t iiBeg = iMid > REGION_NEAREST_WINDOW ? iMid - REGION_NEAREST_WINDOW : 0;
+        size_t iiEnd = std::min(iMid + REGION_NEAREST_WINDOW, MortonOrder.size());
+
+        idx_t iBest    = -1;
+        float bestDist = 0.0f;
+        for (size_t ii = iiBeg; ii < iiEnd; ++ii)
+        {
+            size_t iTriangle = MortonOrder[ii].Slot;
+            if (part[iTriangle] >= 0)
+                continue;
+
+            size_t nNew = 0;
+            for (size_t k = 0; k < 3; ++k)
+                nNew += VertexStamp[triangleVertices[3 * iTriangle + k]] != regionStamp;
+            if (nRegionVert + nNew > maxVertices)
+                continue;
+
+            DirectX::XMVECTOR offset = DirectX::XMLoadFloat3(&centroids[iTriangle]) - center;
+            float             dist   = DirectX::XMVectorGetX(DirectX::XMVector3LengthSq(offset));
+            if (iBest < 0 || dist < bestDist)
+            {
+                iBest    = idx_t(iTriangle);
+                bestDist = dist;
+            }
+        }
+        return iBest;
+    }
+
+    void AddTriangle(idx_t                      iTriangle,
+                     idx_t                      iPart,
+                     size_t                     regionStamp,
+                     const std::vector<uint>   &triangleVertices,
+                     const std::vector<float3> &centroids,
+                     const CsrGraph            &graph,
+                     std::vector<idx_t>        &part,
+                     size_t                    &nRegionVert)
+    {
+        part[iTriangle] = iPart;
+        CenterSum += DirectX::XMLoadFloat3(&centroids[iTriangle]);
+        for (size_t k = 0; k < 3; ++k)
+        {
+            uint iVert = triangleVertices[3 * size_t(iTriangle) + k];
+            if (VertexStamp[iVert] != regionStamp)
+            {
+                VertexStamp[iVert] = regionStamp;
+                nRegionVert++;
+            }
+        }
+        for (idx_t e = graph.Xadj[iTriangle]; e < graph.Xadj[size_t(iTriangle) + 1]; ++e)
+        {
+            idx_t jTriangle = graph.Adjncy[e];
+            if (part[jTriangle] >= 0 || TriangleStamp[jTriangle] == regionStamp)
+                continue;
+            TriangleStamp[jTriangle] = regionStamp;
+            Frontier.push_back(jTriangle);
+        }
+    }
+
+    idx_t PickCandidate(idx_t                      iPart,
+                        size_t                     regionStamp,
+                        size_t                     nPrimitives,
+                        size_t                     nRegionVert,
+                        size_t                     maxVertices,
+                        const std::vector<uint>   &triangleVertices,
+                        const std::vector<float3> &centroids,
+                        const CsrGraph            &graph,
+                        const std::vector<idx_t>  &part)
+    {
+        DirectX::XMVECTOR center = CenterSum / float(nPrimitives);
+
+        idx_t  iBest      = -1;
+        size_t iiBest     = 0;
+        size_t bestNew    = 0;
+        size_t bestShared = 0;
+        float  bestDist   = 0.0f;
+        for (size_t ii = 0; ii < Frontier.size(); ++ii)
+        {
+            idx_t iTriangle = Frontier[ii];
+            if (part[iTriangle] >= 0)
+                continue;
+
+            size_t nNew = 0;
+            for (size_t k = 0; k < 3; ++k)
+                nNew += VertexStamp[triangleVertices[3 * size_t(iTriangle) + k]] != regionStamp;
+            if (nRegionVert + nNew > maxVertices)
+                continue;
+
+            size_t nShared = 0;
+            for (idx_t e = graph.Xadj[iTriangle]; e < graph.Xadj[size_t(iTriangle) + 1]; ++e)
+                nShared += part[graph.Adjncy[e]] == iPart;
+            DirectX::XMVECTOR offset = DirectX::XMLoadFloat3(&centroids[iTriangle]) - center;
+            float             dist   = DirectX::XMVectorGetX(DirectX::XMVector3LengthSq(offset));
+
+            bool better = iBest < 0 || nNew < bestNew || (nNew == bestNew && nShared > bestShared)
+                       || (nNew == bestNew && nShared == bestShared && dist < bestDist);
+            if (!better)
+                continue;
+            iBest      = iTriangle;
+            iiBest     = ii;
+            bestNew    = nNew;
+            bestShared = nShared;
+            bestDist   = dist;
+        }
+
+        if (iBest >= 0)
+        {
+            Frontier[iiBest] = Frontier.back();
+            Frontier.pop_back();
+        }
+        return iBest;
+    }
+};
+
+// Быстрое разбиение для предварительного просмотра: объекты упорядочиваются по коду Мортона
+// их центров, и этот порядок режется на nParts почти равных кусков. Смежность не учитывается,
+// поэтому разрез и дублирование вершин больше, чем у METIS
+struct MortonPartitioner
+{
+    std::vector<float3> Centroids; // Вход: по центру на объект
+
+    std::vector<KeyedSlot> Entries;
+    std::vector<KeyedSlot> Temp;
+
+    void Partition(DirectX::XMVECTOR   boxMin,
+                   DirectX::XMVECTOR   boxMax,
+                   idx_t               nParts,
+                   size_t              nThreads,
+                   std::vector<idx_t> &part)
+    {
+        size_t n = Centroids.size();
+        ASSERT(nParts > 0);
+
+        Entries.resize(n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            Entries[i].Key  = MortonCode(Centroids[i], boxMin, boxMax);
+            Entries[i].Slot = i;
+        }
+        // Сортировка устойчивая, так что при равных кодах порядок задают индексы
+        RadixSortByKey(Entries, Temp, nThreads);
+
+        part.resize(n);
+        for (size_t i = 0; i < n; ++i)
+            part[Entries[i].Slot] = idx_t(i * size_t(nParts) / n);
+    }
+};
+
+// Приближённые k ближайших соседей по центрам объектов. Объекты упорядочиваются по коду Мортона,
+// и соседи ищутся только в окне из window объектов по обе стороны в этом порядке.
+// Результат симметричный: пары (i, j), i < j, без повторов, и их списки по объектам
+struct SpatialNeighbourFinder
+{
+    std::vector<float3> Centroids; // Вход: по центру на объект
+
+    std::vector<std::pair<size_t, size_t>> Pairs;
+    std::vector<size_t>                    Offsets; // Соседи объекта i --- Neighbours[Offsets[i], Offsets[i + 1])
+    std::vector<size_t>                    Neighbours;
+
+    std::vector<KeyedSlot>                Entries;
+    std::vector<KeyedSlot>                Temp;
+    std::vector<std::pair<float, size_t>> Candidates;
+
+    void Build(DirectX::XMVECTOR boxMin, DirectX::XMVECTOR boxMax, size_t k, size_t window, size_t nThreads)
+    {
+        size_t n = Centroids.size();
+
+        Entries.resize(n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            Entries[i].Key  = MortonCode(Centroids[i], boxMin, boxMax);
+            Entries[i].Slot = i;
+        }
+        RadixSortByKey(Entries, Temp, nThreads);
+
+        Pairs.clear();
+        for (size_t ii = 0; ii < n; ++ii)
+        {
+            size_t            i      = Entries[ii].Slot;
+            DirectX::XMVECTOR center = DirectX::XMLoadFloat3(&Centroids[i]);
+
+            Candidates.clear();
+            size_t beg = ii > window ? ii - window : 0;
+            size_t end = std::min(n, ii + window + 1);
+            for (size_t jj = beg; jj < end; ++jj)
+            {
+                if (jj == ii)
+                    continue;
+                size_t            j      = Entries[jj].Slot;
+                DirectX::XMVECTOR offset = DirectX::XMLoadFloat3(&Centroids[j]) - center;
+                Candidates.emplace_back(DirectX::XMVectorGetX(DirectX::XMVector3LengthSq(offset)), j);
+            }
+            size_t nNearest = std::min(k, Candidates.size());
+            std::partial_sort(Candidates.begin(), Candidates.begin() + nNearest, Candidates.end());
+            for (size_t iCandidate = 0; iCandidate < nNearest; ++iCandidate)
+            {
+                size_t j = Candidates[iCandidate].second;
+                Pairs.emplace_back(std::min(i, j), std::max(i, j));
+            }
+        }
+        std::sort(Pairs.begin(), Pairs.end());
+        Pairs.erase(std::unique(Pairs.begin(), Pairs.end()), Pairs.end());
+
+        Offsets.assign(n + 1, 0);
+        for (const auto &[i, j] : Pairs)
+        {
+            Offsets[i + 1]++;
+            Offsets[j + 1]++;
+        }
+        for (size_t i = 0; i < n; ++i)
+            Offsets[i + 1] += Offsets[i];
+        Neighbours.resize(Offsets[n]);
+        for (const auto &[i, j] : Pairs)
+        {
+            Neighbours[Offsets[i]++] = j;
+            Neighbours[Offsets[j]++] = i;
+        }
+        // Возвращаем смещения к началам списков
+        for (size_t i = n; i > 0; --i)
+            Offsets[i] = Offsets[i - 1];
+        Offsets[0] = 0;
+    }
+};
+
+// Итоги уточнения разбиения
+struct RefinementStats
+{
+    size_t DuplicatedBefore = 0; // Лишних копий вершин: сумма вершин по частям минус разные вершины
+    size_t DuplicatedAfter  = 0;
+    double VolumeBefore     = 0.0; // Суммарный объём ограничивающих параллелепипедов частей
+    double VolumeAfter      = 0.0;
+    size_t Moves            = 0;
+
+    RefinementStats &operator+=(const RefinementStats &rhs) noexcept
+    {
+        DuplicatedBefore += rhs.DuplicatedBefore;
+        DuplicatedAfter += rhs.DuplicatedAfter;
+        VolumeBefore += rhs.VolumeBefore;
+        VolumeAfter += rhs.VolumeAfter;
+        Moves += rhs.Moves;
+        return *this;
+    }
+};
+
+// Локальное уточнение готового разбиения треугольников. Граничный треугольник переходит
+// к соседней части, если от этого уменьшается число копий вершин, а при равном числе ---
+// суммарный объём параллелепипедов частей. Принимающая часть не может превысить
+// maxPrimitives треугольников и maxVertices вершин, опустошать части тоже нельзя
+struct BoundaryRefiner
+{
+    // Вход заполняется вызывающим кодом: по 3 индекса вершин на треугольник и позиции вершин
+    std::vector<uint>   TriangleVertices;
+    std::vector<float3> Positions;
+
+    // Пары (вершина, треугольник) по возрастанию вершины: треугольники вершины i ---
+    // VertexTriangles[VertexOffsets[i], VertexOffsets[i + 1]). Число треугольников вершины
+    // в части считается по этому срезу, так что хэш-таблица по парам (вершина, часть) не нужна
+    std::vector<KeyedSlot>          VertexTriangles;
+    std::vector<KeyedSlot>          SortTemp;
+    std::vector<size_t>             VertexOffsets;
+    std::vector<size_t>             PartStamp; // Вершина + 1, уже посчитанная в части
+    std::vector<size_t>             PartTriangleCount;
+    std::vector<size_t>             PartVertexCount;
+    std::vector<std::vector<idx_t>> PartTriangles; // Может содержать ушедшие треугольники
+    std::vector<TBoundingBox>       PartBoxes;
+
+    void Clear()
+    {
+        TriangleVertices.clear();
+        Positions.clear();
+    }
+
+    RefinementStats Refine(const CsrGraph     &graph,
+                           idx_t               nParts,
+                           size_t              maxPrimitives,
+                           size_t              maxVertices,
+                           size_t              nPasses,
+                           std::vector<idx_t> &part)
+    {
+        size_t nTriangles = part.size();
+        ASSERT_EQ(TriangleVertices.size(), 3 * nTriangles);
+        ASSERT_EQ(size_t(graph.VertexCount()), nTriangles);
+
+        PartTriangleCount.assign(nParts, 0);
+        PartVertexCount.assign(nParts, 0);
+        PartTriangles.resize(nParts);
+        for (std::vector<idx_t> &triangles : PartTriangles)
+            triangles.clear();
+
+        VertexTriangles.resize(3 * nTriangles);
+        for (size_t iTriangle = 0; iTriangle < nTriangles; ++iTriangle)
+        {
+            idx_t iPart = part[iTriangle];
+            PartTriangleCount[iPart]++;
+            PartTriangles[iPart].push_back(idx_t(iTriangle));
+            for (size_t k = 0; k < 3; ++k)
+            {
+                VertexTriangles[3 * iTriangle + k].Key  = TriangleVertices[3 * iTriangle + k];
+                VertexTriangles[3 * iTriangle + k].Slot = iTriangle;
+            }
+        }
+        // Вызывается и внутри параллельного цикла по группам, поэтому в один поток
+        RadixSortByKey(VertexTriangles, SortTemp, 1);
+
+        size_t nVertices = Positions.size();
+        VertexOffsets.assign(nVertices + 1, 0);
+        for (const KeyedSlot &entry : VertexTriangles)
+            VertexOffsets[entry.Key + 1]++;
+        for (size_t iVert = 0; iVert < nVertices; ++iVert)
+            VertexOffsets[iVert + 1] += VertexOffsets[iVert];
+
+        size_t nUniqueVertices = 0;
+        PartStamp.assign(nParts, 0);
+        for (size_t iVert = 0; iVert < nVertices; ++iVert)
+        {
+            nUniqueVertices += VertexOffsets[iVert + 1] > VertexOffsets[iVert];
+            for (size_t ii = VertexOffsets[iVert]; ii < VertexOffsets[iVert + 1]; ++ii)
+            {
+                idx_t iPart = part[VertexTriangles[ii].Slot];
+                if (PartStamp[iPart] != iVert + 1)
+                {
+                    PartStamp[iPart] = iVert + 1;
+                    PartVertexCount[iPart]++;
+                }
+            }
+        }
+        PartBoxes.resize(nParts);
+        for (idx_t iPart = 0; iPart < nParts; ++iPart)
+            PartBoxes[iPart] = PartBox(iPart, -1, part);
+
+        RefinementStats stats;
+        stats.DuplicatedBefore = TotalPartVertices() - nUniqueVertices;
+        stats.VolumeBefore     = TotalVolume();
+
+        for (size_t iPass = 0; iPass < nPasses; ++iPass)
+        {
+            size_t nMoves = 0;
+            for (size_t iTriangle = 0; iTriangle < nTriangles; ++iTriangle)
+                nMoves += TryMove(idx_t(iTriangle), graph, maxPrimitives, maxVertices, part);
+            stats.Moves += nMoves;
+            if (nMoves == 0)
+                break;
+        }
+
+        stats.DuplicatedAfter = TotalPartVertices() - nUniqueVertices;
+        stats.VolumeAfter     = TotalVolume();
+        return stats;
+    }
+
+  private:
+    // Число треугольников части iPart при вершине. У вершины лишь несколько треугольников,
+    // поэтому просмотр среза дешевле поиска в хэш-таблице и не требует её обновлять
+    uint VertexCountIn(uint iVert, idx_t iPart, const std::vector<idx_t> &part) const
+    {
+        uint count = 0;
+        for (size_t ii = VertexOffsets[iVert]; ii < VertexOffsets[size_t(iVert) + 1]; ++ii)
+            count += part[VertexTriangles[ii].Slot] == iPart;
+        return count;
+    }
+
+    static double BoxVolume(const TBoundingBox &box)
+    {
+        return double(box.Max.x - box.Min.x) * double(box.Max.y - box.Min.y) * double(box.Max.z - box.Min.z);
+    }
+
+    static void ExpandBox(TBoundingBox &box, const float3 &p)
+    {
+        box.Min.x = std::min(box.Min.x, p.x);
+        box.Min.y = std::min(box.Min.y, p.y);
+        box.Min.z = std::min(box.Min.z, p.z);
+        box.Max.x = std::max(box.Max.x, p.x);
+        box.Max.y = std::max(box.Max.y, p.y);
+        box.Max.z = std::max(box.Max.z, p.z);
+    }
+
+    // Параллелепипед части без треугольника iExcluded. Для пустой части --- вырожденный в нуле
+    TBoundingBox PartBox(idx_t iPart, idx_t iExcluded, const std::vector<idx_t> &part) const
+    {
+        TBoundingBox box     = {};
+        bool         isEmpty = true;
+        for (idx_t iTriangle : PartTriangles[iPart])
+        {
+            if (iTriangle == iExcluded || part[iTriangle] != iPart)
+                continue;
+            for (size_t k = 0; k < 3; ++k)
+            {
+                const float3 &p = Positions[TriangleVertices[3 * size_t(iTriangle) + k]];
+                if (isEmpty)
+                {
+                    box.Min = box.Max = p;
+                    isEmpty           = false;
+                }
+                ExpandBox(box, p);
+            }
+        }
+        return box;
+    }
+
+    size_t TotalPartVertices() const
+    {
+        size_t total = 0;
+        for (size_t count : PartVertexCount)
+            total += count;
+        return total;
+    }
+
+    double TotalVolume() const
+    {
+        double total = 0.0;
+        for (const TBoundingBox &box : PartBoxes)
+            total += BoxVolume(box);
+        return total;
+    }
+
+    bool TryMove(idx_t               iTriangle,
+                 const CsrGraph     &graph,
+                 size_t              maxPrimitives,
+                 size_t              maxVertices,
+                 std::vector<idx_t> &part)
+    {
+        idx_t iFrom = part[iTriangle];
+        if (PartTriangleCount[iFrom] <= 1)
+            return false;
+
+        const uint *tri = &TriangleVertices[3 * size_t(iTriangle)];
+
+        // Сколько вершин освободится в исходной части
+        ptrdiff_t nFreed = 0;
+        for (size_t k = 0; k < 3; ++k)
+            nFreed += VertexCountIn(tri[k], iFrom, part) == 1;
+
+        idx_t        iBest      = -1;
+        ptrdiff_t    bestDelta  = 0;
+        double       bestVolume = 0.0;
+        TBoundingBox bestBox    = {};
+        bool         hasFromBox = false;
+        TBoundingBox fromBox    = {};
+        double       fromVolume = 0.0;
+        for (idx_t e = graph.Xadj[iTriangle]; e < graph.Xadj[size_t(iTriangle) + 1]; ++e)
+        {
+            idx_t iTo = part[graph.Adjncy[e]];
+            if (iTo == iFrom || iTo == iBest || PartTriangleCount[iTo] + 1 > maxPrimitives)
+                continue;
+
+            ptrdiff_t nAdded = 0;
+            for (size_t k = 0; k < 3; ++k)
+                nAdded += VertexCountIn(tri[k], iTo, part) == 0;
+            if (PartVertexCount[iTo] + nAdded > maxVertices)
+                continue;
+            ptrdiff_t delta = nAdded - nFreed;
+            if (delta > 0)
+                continue;
+
+            // Объём считаем только для подходящих по вершинам переходов: пересчёт исходной части дорогой
+            if (!hasFromBox)
+            {
+                fromBox    = PartBox(iFrom, iTriangle, part);
+                fromVolume = BoxVolume(fromBox) - BoxVolume(PartBoxes[iFrom]);
+                hasFromBox = true;
+            }
+            TBoundingBox toBox = PartBoxes[iTo];
+            for (size_t k = 0; k < 3; ++k)
+                ExpandBox(toBox, Positions[tri[k]]);
+            double volume = fromVolume + BoxVolume(toBox) - BoxVolume(PartBoxes[iTo]);
+
+            bool better = iBest < 0 || delta < bestDelta || (delta == bestDelta && volume < bestVolume);
+            if (!better)
+                continue;
+            iBest      = iTo;
+            bestDelta  = delta;
+            bestVolume = volume;
+            bestBox    = toBox;
+        }
+
+        if (iBest < 0 || (bestDelta == 0 && !(bestVolume < 0.0)))
+            return false;
+
+        // Счётчики вершин частей сравниваются до и после переноса, повторы вершин в треугольнике пропускаются
+        bool wasInBest[3] = {};
+        for (size_t k = 0; k < 3; ++k)
+            wasInBest[k] = VertexCountIn(tri[k], iBest, part) > 0;
+        part[iTriangle] = iBest;
+        for (size_t k = 0; k < 3; ++k)
+        {
+            if ((k > 0 && tri[k] == tri[0]) || (k > 1 && tri[k] == tri[1]))
+                continue;
+            if (VertexCountIn(tri[k], iFrom, part) == 0)
+                PartVertexCount[iFrom]--;
+            if (!wasInBest[k])
+                PartVertexCount[iBest]++;
+        }
+        PartTriangleCount[iFrom]--;
+        PartTriangleCount[iBest]++;
+        PartTriangles[iBest].push_back(iTriangle);
+        PartBoxes[iFrom] = fromBox;
+        PartBoxes[iBest] = bestBox;
+        return true;
+    }
+};
+
+// Цель, по которой из нескольких разбиений METIS выбирается лучшее
+enum class PartitionObjective
+{
+    EdgeCut,    // Суммарный вес разрезанных рёбер графа
+    MaxPart,    // Число объектов в наибольшей части
+    Duplicated, // Лишние копии вершин: сумма вершин по частям минус разные вершины
+};
+
+inline const char *PartitionObjectiveName(PartitionObjective objective)
+{
+    switch (objective)
+    {
+    case PartitionObjective::EdgeCut: return "edgecut";
+    case PartitionObjective::MaxPart: return "maxpart";
+    case PartitionObjective::Duplicated: return "duplicated";
+    }
+    return "unknown";
+}
+
+// Затравки попыток разнесены, чтобы не совпадать с затравками перегруппировки застрявших слоёв
+constexpr idx_t PARTITION_TRIAL_SEED_STEP = 1000;
+
+struct PartitionScore
+{
+    uint64_t EdgeCut    = 0;
+    uint64_t MaxPart    = 0;
+    uint64_t Duplicated = 0;
+
+    uint64_t Value(PartitionObjective objective) const noexcept
+    {
+        switch (objective)
+        {
+        case PartitionObjective::EdgeCut: return EdgeCut;
+        case PartitionObjective::MaxPart: return MaxPart;
+        case PartitionObjective::Duplicated: return Duplicated;
+        }
+        return EdgeCut;
+    }
+};
+
+// Итоги попыток: цель у первой попытки (обычный вызов METIS) и у выбранной
+struct PartitionTrialStats
+{
+    size_t   Calls      = 0;
+    size_t   Improved   = 0; // Вызовов, в которых выбрана не первая попытка
+    uint64_t FirstValue = 0;
+    uint64_t BestValue  = 0;
+
+    PartitionTrialStats &operator+=(const PartitionTrialStats &rhs) noexcept
+    {
+        Calls += rhs.Calls;
+        Improved += rhs.Improved;
+        FirstValue += rhs.FirstValue;
+        BestValue += rhs.BestValue;
+        return *this;
+    }
+};
+
+// Несколько вызовов METIS_PartGraphKway с разными затравками, остаётся лучший по Objective.
+// Попытка 0 --- обычный вызов (с затравкой seed, если она задана), попытка t --- с затравкой
+// seed + t * PARTITION_TRIAL_SEED_STEP. Попытки распределяются по nThreads потокам, а выбор зависит
+// только от оценок и номеров попыток, поэтому результат не зависит от числа потоков.
+// Для цели Duplicated вызывающий код задаёт вершины объектов через ClearItems/ItemVertices/PushItem
+struct MetisTrials
+{
+    size_t             TrialCount = 1;
+    PartitionObjective Objective  = PartitionObjective::EdgeCut;
+
+    std::vector<size_t> ItemVertexOffsets{0};
+    std::vector<uint>   ItemVertices;
+    PartitionTrialStats Stats;
+
+    std::vector<std::vector<idx_t>>    TrialParts;
+    std::vector<std::vector<uint64_t>> TrialKeys;
+    std::vector<PartitionScore>        TrialScores;
+
+    bool NeedsItemVertices() const noexcept { return TrialCount > 1 && Objective == PartitionObjective::Duplicated; }
+
+    void ClearItems()
+    {
+        ItemVertexOffsets.clear();
+        ItemVertexOffsets.push_back(0);
+        ItemVertices.clear();
+    }
+
+    void PushItem() { ItemVertexOffsets.push_back(ItemVertices.size()); }
+
+    // Если useWeights, учитываются веса рёбер graph.Adjwgt. Номера частей записываются в part
+    void Partition(const CsrGraph     &graph,
+                   bool                useWeights,
+                   idx_t               nParts,
+                   idx_t               seed,
+                   size_t              nThreads,
+                   std::vector<idx_t> &part)
+    {
+        idx_t  nItems  = graph.VertexCount();
+        size_t nTrials = std::max<size_t>(TrialCount, 1);
+        part.resize(size_t(nItems));
+        if (nTrials == 1)
+        {
+            RunMetis(graph, useWeights, nParts, seed, part);
+            return;
+        }
+        if (Objective == PartitionObjective::Duplicated)
+            ASSERT_EQ(ItemVertexOffsets.size(), size_t(nItems) + 1);
+
+        if (TrialParts.size() < nTrials)
+        {
+            TrialParts.resize(nTrials);
+            TrialKeys.resize(nTrials);
+        }
+        TrialScores.resize(nTrials);
+        ParallelFor(nTrials, nThreads, [&](size_t, size_t iTrial) {
+            idx_t trialSeed = seed;
+            if (iTrial > 0)
+                trialSeed = std::max<idx_t>(seed, 0) + idx_t(iTrial) * PARTITION_TRIAL_SEED_STEP;
+            std::vector<idx_t> &trialPart = TrialParts[iTrial];
+            trialPart.resize(size_t(nItems));
+            RunMetis(graph, useWeights, nParts, trialSeed, trialPart);
+            TrialScores[iTrial] = Score(graph, useWeights, nParts, trialPart, TrialKeys[iTrial]);
+        });
+
+        size_t iBest = 0;
+        for (size_t iTrial = 1; iTrial < nTrials; ++iTrial)
+        {
+            if (TrialScores[iTrial].Value(Objective) < TrialScores[iBest].Value(Objective))
+                iBest = iTrial;
+        }
+        part.swap(TrialParts[iBest]);
+
+        Stats.Calls++;
+        Stats.Improved += iBest != 0;
+        Stats.FirstValue += TrialScores[0].Value(Objective);
+        Stats.BestValue += TrialScores[iBest].Value(Objective);
+    }
+
+    static void RunMetis(const CsrGraph &graph, bool useWeights, idx_t nParts, idx_t seed, std::vector<idx_t> &part)
+    {
+        idx_t nvtxs   = graph.VertexCount();
+        idx_t ncon    = 1;
+        idx_t edgecut = 0;
+
+        idx_t options[METIS_NOPTIONS] = {};
+        METIS_SetDefaultOptions(options);
+        options[METIS_OPTION_NUMBERING] = 0;
+        if (seed >= 0)
+            options[METIS_OPTION_SEED] = seed;
+
+        // METIS не меняет граф, но принимает его по неконстантным указателям
+        int metisResult = METIS_PartGraphKway(&nvtxs,
+                                              &ncon,
+                                              const_cast<idx_t *>(graph.Xadj.data()),
+                                              const_cast<idx_t *>(graph.Adjncy.data()),
+                                              nullptr /* vwgt */,
+                                              nullptr /* vsize */,
+                                              useWeights ? const_cast<idx_t *>(graph.Adjwgt.data()) : nullptr,
+                                              &nParts,
+                                              nullptr /* tpwgts */,
+                                              nullptr /* ubvec */,
+                                              options,
+                                              &edgecut,
+                                              part.data());
+        ASSERT_EQ(metisResult, METIS_OK);
+    }
+
+    // Вес разреза считается по графу, а не берётся из METIS, чтобы все попытки оценивались одинаково.
+    // Копии вершин считаются только для цели Duplicated: пары (часть, вершина) сортируются и считаются разные
+    PartitionScore Score(const CsrGraph           &graph,
+                         bool                      useWeights,
+                         idx_t                     nParts,
+                         const std::vector<idx_t> &part,
+                         std::vector<uint64_t>    &keys) const
+    {
+        PartitionScore score;
+        idx_t          nItems = graph.VertexCount();
+        for (idx_t iItem = 0; iItem < nItems; ++iItem)
+        {
+            for (idx_t i = graph.Xadj[iItem]; i < graph.Xadj[iItem + 1]; ++i)
+            {
+                if (part[graph.Adjncy[i]] != part[iItem])
+                    score.EdgeCut += useWeights ? uint64_t(graph.Adjwgt[i]) : 1;
+            }
+        }
+        score.EdgeCut /= 2;
+
+        keys.assign(size_t(nParts), 0);
+        for (idx_t iItem = 0; iItem < nItems; ++iItem)
+            keys[size_t(part[iItem])]++;
+        score.MaxPart = *std::max_element(keys.begin(), keys.end());
+
+        if (Objective == PartitionObjective::Duplicated)
+        {
+            keys.clear();
+            for (idx_t iItem = 0; iItem < nItems; ++iItem)
+            {
+                for (size_t i = ItemVertexOffsets[iItem]; i < ItemVertexOffsets[iItem + 1]; ++i)
+                    keys.push_back((uint64_t(part[iItem]) << 32) | ItemVertices[i]);
+            }
+            std::sort(keys.begin(), keys.end());
+            uint64_t nPartVertices = std::unique(keys.begin(), keys.end()) - keys.begin();
+
+            // Разных вершин столько же, сколько разных младших половин ключей
+            for (uint64_t &key : keys)
+                key &= 0xFFFFFFFF;
+            keys.resize(size_t(nPartVertices));
+            std::sort(keys.begin(), keys.end());
+            uint64_t nVertices = std::unique(keys.begin(), keys.end()) - keys.begin();
+            score.Duplicated   = nPartVertices - nVertices;
+        }
+        return score;
+    }
+};
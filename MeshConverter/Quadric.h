@@ -0,0 +1,204 @@
+﻿#pragma once
+
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Порог обусловленности для поиска минимума: |det A| / |A|^3
+constexpr double QUADRIC_MIN_CONDITION = 1e-3;
+
+// Квадрика ошибки Q = [A b; b^T c] для точки v = (x, y, z, 1): E(v) = v^T Q v.
+// Матрица симметричная, поэтому храним только 10 уникальных коэффициентов
+// вместо полной матрицы 4x4
+struct SymmetricQuadric
+{
+    float A00 = 0.0f;
+    float A01 = 0.0f;
+    float A02 = 0.0f;
+    float A11 = 0.0f;
+    float A12 = 0.0f;
+    float A22 = 0.0f;
+    float B0  = 0.0f;
+    float B1  = 0.0f;
+    float B2  = 0.0f;
+    float C   = 0.0f;
+
+    // Квадрат расстояния до плоскости (n, d): n . p + d = 0
+    static SymmetricQuadric FromPlane(DirectX::XMVECTOR plane)
+    {
+        DirectX::XMFLOAT4 p;
+        DirectX::XMStoreFloat4(&p, plane);
+
+        SymmetricQuadric q;
+        q.A00 = p.x * p.x;
+        q.A01 = p.x * p.y;
+        q.A02 = p.x * p.z;
+        q.A11 = p.y * p.y;
+        q.A12 = p.y * p.z;
+        q.A22 = p.z * p.z;
+        q.B0  = p.x * p.w;
+        q.B1  = p.y * p.w;
+        q.B2  = p.z * p.w;
+        q.C   = p.w * p.w;
+        return q;
+    }
+
+    SymmetricQuadric &operator+=(const SymmetricQuadric &rhs) noexcept
+    {
+        A00 += rhs.A00;
+        A01 += rhs.A01;
+        A02 += rhs.A02;
+        A11 += rhs.A11;
+        A12 += rhs.A12;
+        A22 += rhs.A22;
+        B0 += rhs.B0;
+        B1 += rhs.B1;
+        B2 += rhs.B2;
+        C += rhs.C;
+        return *this;
+    }
+
+    SymmetricQuadric operator+(const SymmetricQuadric &rhs) const noexcept
+    {
+        SymmetricQuadric res = *this;
+        res += rhs;
+        return res;
+    }
+
+    // Порядок операций совпадает с векторными ядрами ниже,
+    // чтобы результат не зависел от ширины регистров
+    float Evaluate(float x, float y, float z) const noexcept
+    {
+        float ax = A00 * x + A01 * y + A02 * z + B0;
+        float ay = A01 * x + A11 * y + A12 * z + B1;
+        float az = A02 * x + A12 * y + A22 * z + B2;
+        float aw = B0 * x + B1 * y + B2 * z + C;
+        return fabsf(x * ax + y * ay + z * az + aw);
+    }
+
+    float Evaluate(DirectX::XMVECTOR p) const noexcept
+    {
+        DirectX::XMFLOAT3 v;
+        DirectX::XMStoreFloat3(&v, p);
+        return Evaluate(v.x, v.y, v.z);
+    }
+
+    // Точка минимума: решение A p = -b через присоединённую матрицу.
+    // Для почти плоских и цилиндрических окрестностей система вырождена, тогда возвращаем false
+    bool Minimize(DirectX::XMFLOAT3 &out) const noexcept
+    {
+        double a00 = A00, a01 = A01, a02 = A02, a11 = A11, a12 = A12, a22 = A22;
+
+        double c00 = a11 * a22 - a12 * a12;
+        double c01 = a02 * a12 - a01 * a22;
+        double c02 = a01 * a12 - a02 * a11;
+        double c11 = a00 * a22 - a02 * a02;
+        double c12 = a01 * a02 - a00 * a12;
+        double c22 = a00 * a11 - a01 * a01;
+        double det = a00 * c00 + a01 * c01 + a02 * c02;
+
+        double norm = sqrt(a00 * a00 + a11 * a11 + a22 * a22 + 2.0 * (a01 * a01 + a02 * a02 + a12 * a12));
+        if (!(fabs(det) > QUADRIC_MIN_CONDITION * norm * norm * norm))
+            return false;
+
+        out.x = float(-(c00 * B0 + c01 * B1 + c02 * B2) / det);
+        out.y = float(-(c01 * B0 + c11 * B1 + c12 * B2) / det);
+        out.z = float(-(c02 * B0 + c12 * B1 + c22 * B2) / det);
+        return true;
+    }
+
+    // Параметр t минимума на прямой p + t * d, без ограничения на отрезок.
+    // Если вдоль d квадрика не растёт, возвращает 0.5
+    float MinimizeAlong(const DirectX::XMFLOAT3 &p, const DirectX::XMFLOAT3 &d) const noexcept
+    {
+        // A d и A p + b
+        float adx = A00 * d.x + A01 * d.y + A02 * d.z;
+        float ady = A01 * d.x + A11 * d.y + A12 * d.z;
+        float adz = A02 * d.x + A12 * d.y + A22 * d.z;
+        float gx  = A00 * p.x + A01 * p.y + A02 * p.z + B0;
+        float gy  = A01 * p.x + A11 * p.y + A12 * p.z + B1;
+        float gz  = A02 * p.x + A12 * p.y + A22 * p.z + B2;
+
+        float denom = d.x * adx + d.y * ady + d.z * adz;
+        float numer = d.x * gx + d.y * gy + d.z * gz;
+        if (!(denom > 0.0f))
+            return 0.5f;
+        return -numer / denom;
+    }
+};
+
+static_assert(sizeof(SymmetricQuadric) == 10 * sizeof(float));
+
+// Восьмиточечное ядро собрано отдельно с /arch:AVX2 (QuadricAVX2.cpp), остальной конвертер
+// остаётся на SSE2. Возвращает число обработанных точек, кратное восьми
+size_t EvaluateQuadricAVX2(const SymmetricQuadric &q,
+                           const float            *xs,
+                           const float            *ys,
+                           const float            *zs,
+                           float                  *out,
+                           size_t                  n);
+
+// AVX2 проверяется один раз при первом вызове: и поддержка процессором, и сохранение ymm-регистров ОС
+inline bool CpuHasAVX2()
+{
+    static const bool hasAVX2 = [] {
+#if defined(_MSC_VER)
+        int info[4] = {};
+        __cpuid(info, 0);
+        if (info[0] < 7)
+            return false;
+        __cpuid(info, 1);
+        bool hasXSave = (info[2] & (1 << 27)) != 0;
+        bool hasAVX   = (info[2] & (1 << 28)) != 0;
+        if (!hasXSave || !hasAVX || (_xgetbv(0) & 0x6) != 0x6)
+            return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2") != 0;
+#endif
+    }();
+    return hasAVX2;
+}
+
+inline void EvaluateQuadricSSE(const SymmetricQuadric &q, const float *xs, const float *ys, const float *zs, float *out)
+{
+    __m128 x   = _mm_loadu_ps(xs);
+    __m128 y   = _mm_loadu_ps(ys);
+    __m128 z   = _mm_loadu_ps(zs);
+    __m128 a00 = _mm_set1_ps(q.A00);
+    __m128 a01 = _mm_set1_ps(q.A01);
+    __m128 a02 = _mm_set1_ps(q.A02);
+    __m128 a11 = _mm_set1_ps(q.A11);
+    __m128 a12 = _mm_set1_ps(q.A12);
+    __m128 a22 = _mm_set1_ps(q.A22);
+    __m128 b0  = _mm_set1_ps(q.B0);
+    __m128 b1  = _mm_set1_ps(q.B1);
+    __m128 b2  = _mm_set1_ps(q.B2);
+    __m128 c   = _mm_set1_ps(q.C);
+
+    __m128 ax = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(a00, x), _mm_mul_ps(a01, y)), _mm_mul_ps(a02, z)), b0);
+    __m128 ay = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(a01, x), _mm_mul_ps(a11, y)), _mm_mul_ps(a12, z)), b1);
+    __m128 az = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(a02, x), _mm_mul_ps(a12, y)), _mm_mul_ps(a22, z)), b2);
+    __m128 aw = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(b0, x), _mm_mul_ps(b1, y)), _mm_mul_ps(b2, z)), c);
+    __m128 e  = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, ax), _mm_mul_ps(y, ay)), _mm_mul_ps(z, az)), aw);
+    _mm_storeu_ps(out, _mm_andnot_ps(_mm_set1_ps(-0.0f), e));
+}
+
+// Значения одной квадрики в n точках, координаты точек разложены по массивам
+inline void EvaluateQuadricBatch(const SymmetricQuadric &q,
+                                 const float            *xs,
+                                 const float            *ys,
+                                 const float            *zs,
+                                 float                  *out,
+                                 size_t                  n)
+{
+    size_t i = 0;
+    if (n >= 8 && CpuHasAVX2())
+        i = EvaluateQuadricAVX2(q, xs, ys, zs, out, n);
+    for (; i + 4 <= n; i += 4)
+        EvaluateQuadricSSE(q, xs + i, ys + i, zs + i, out + i);
+    for (; i < n; ++i)
+        out[i] = q.Evaluate(xs[i], ys[i], zs[i]);
+}
@@ -0,0 +1,48 @@
+﻿#include <DirectXMath.h>
+
+#include "Quadric.h"
+
+// Единица трансляции собирается с /arch:AVX2, а вызывается только после CpuHasAVX2.
+// Здесь нельзя вызывать inline-функции из общих заголовков: компоновщик может оставить
+// их AVX2-копию для всей программы
+
+size_t EvaluateQuadricAVX2(const SymmetricQuadric &q,
+                           const float            *xs,
+                           const float            *ys,
+                           const float            *zs,
+                           float                  *out,
+                           size_t                  n)
+{
+    __m256 a00 = _mm256_set1_ps(q.A00);
+    __m256 a01 = _mm256_set1_ps(q.A01);
+    __m256 a02 = _mm256_set1_ps(q.A02);
+    __m256 a11 = _mm256_set1_ps(q.A11);
+    __m256 a12 = _mm256_set1_ps(q.A12);
+    __m256 a22 = _mm256_set1_ps(q.A22);
+    __m256 b0  = _mm256_set1_ps(q.B0);
+    __m256 b1  = _mm256_set1_ps(q.B1);
+    __m256 b2  = _mm256_set1_ps(q.B2);
+    __m256 c   = _mm256_set1_ps(q.C);
+    __m256 abs = _mm256_set1_ps(-0.0f);
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(xs + i);
+        __m256 y = _mm256_loadu_ps(ys + i);
+        __m256 z = _mm256_loadu_ps(zs + i);
+
+        __m256 ax = _mm256_add_ps(
+            _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a00, x), _mm256_mul_ps(a01, y)), _mm256_mul_ps(a02, z)), b0);
+        __m256 ay = _mm256_add_ps(
+            _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a01, x), _mm256_mul_ps(a11, y)), _mm256_mul_ps(a12, z)), b1);
+        __m256 az = _mm256_add_ps(
+            _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a02, x), _mm256_mul_ps(a12, y)), _mm256_mul_ps(a22, z)), b2);
+        __m256 aw = _mm256_add_ps(
+            _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(b0, x), _mm256_mul_ps(b1, y)), _mm256_mul_ps(b2, z)), c);
+        __m256 e = _mm256_add_ps(
+            _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, ax), _mm256_mul_ps(y, ay)), _mm256_mul_ps(z, az)), aw);
+        _mm256_storeu_ps(out + i, _mm256_andnot_ps(abs, e));
+    }
+    return i;
+}
@@ -10,7 +10,7 @@ template <typename T, size_t CAPACITY> struct TrivialVector
 
     T Last() const
     {
-        ASSERT(!IsEmpty());
+        ASSERT_CHEAP(!IsEmpty());
         return Data[Size - 1];
     }
 
@@ -20,13 +20,13 @@ template <typename T, size_t CAPACITY> struct TrivialVector
 
     void Push(T x)
     {
-        ASSERT(Size < CAPACITY);
+        ASSERT_CHEAP(Size < CAPACITY);
         Data[Size++] = x;
     }
 
     T Pop()
     {
-        ASSERT(!IsEmpty());
+        ASSERT_CHEAP(!IsEmpty());
         return Data[--Size];
     }
 
@@ -59,13 +59,13 @@ template <typename T> struct Slice
 
     constexpr Slice Subslice(size_t beg, size_t end) const
     {
-        ASSERT(beg <= end);
-        ASSERT(end <= mSize);
+        ASSERT_CHEAP(beg <= end);
+        ASSERT_CHEAP(end <= mSize);
         return Slice(mData + beg, mData + end);
     }
     constexpr Slice Skip(size_t n) const
     {
-        ASSERT(n <= mSize);
+        ASSERT_CHEAP(n <= mSize);
         return Slice(mData + n, mSize - n);
     }
     constexpr Slice Limit(size_t n) const { return Slice(mData, std::min(mSize, n)); }
@@ -107,7 +107,7 @@ template <typename T> struct SplitVector
         {
             size_t iCluster = clusterization[i];
             FillPush(iCluster, i);
-            ASSERT(mSplits[iCluster] <= mSplits[iCluster + 1]);
+            ASSERT_PARANOID(mSplits[iCluster] <= mSplits[iCluster + 1]);
         }
         FillCommit();
     }
@@ -126,8 +126,11 @@ template <typename T> struct SplitVector
         size_t nClusters = mSplits.size() - 1;
         for (size_t i = 2; i <= nClusters; ++i)
             mSplits[i] += mSplits[i - 1];
-        for (size_t i = 0; i < nClusters; ++i)
-            ASSERT(mSplits[i] <= mSplits[i + 1]);
+        if constexpr (VALIDATE_PARANOID)
+        {
+            for (size_t i = 0; i < nClusters; ++i)
+                ASSERT(mSplits[i] <= mSplits[i + 1]);
+        }
     }
 
     void FillPush(size_t iCluster, const T &x)
@@ -149,8 +152,11 @@ template <typename T> struct SplitVector
             mSplits[i] = mSplits[i - 1];
         mSplits[0] = 0;
 
-        for (size_t i = 0; i < nClusters; ++i)
-            ASSERT(mSplits[i] <= mSplits[i + 1]);
+        if constexpr (VALIDATE_PARANOID)
+        {
+            for (size_t i = 0; i < nClusters; ++i)
+                ASSERT(mSplits[i] <= mSplits[i + 1]);
+        }
     }
 
     size_t   PartSize(size_t iPart) const { return mSplits[iPart + 1] - mSplits[iPart]; }
@@ -161,10 +167,24 @@ template <typename T> struct SplitVector
     const T &Flat(size_t i) const { return mVec[i]; }
     size_t   Split(size_t i) const { return mSplits[i]; }
 
+    //   nParts   nObjects ,  Push  PushSplit   
+    void Reserve(size_t nParts, size_t nObjects)
+    {
+        mSplits.reserve(nParts + 1);
+        mVec.reserve(nObjects);
+    }
+
     void Push(const T &x) { mVec.push_back(x); }
     void Push(T &&x) { mVec.push_back(std::move(x)); }
     void PushSplit() { mSplits.push_back(mVec.size()); }
 
+    //    nParts 
+    void Truncate(size_t nParts)
+    {
+        mSplits.resize(nParts + 1);
+        mVec.resize(mSplits[nParts]);
+    }
+
     void Clear()
     {
         mVec.clear();
@@ -1,13 +1,19 @@
 ﻿#include <Common.h>
 
+#include "Adjacency.h"
+#include "AllocationCounter.h"
+#include "DecimationTrace.h"
+#include "GridLattice.h"
+#include "Partition.h"
+#include "Quadric.h"
 #include "Util.h"
 
 #include <algorithm>
 #include <array>
+#include <cctype>
 #include <functional>
 #include <iostream>
 #include <map>
-#include <set>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -38,12 +44,12 @@ template <> struct std::hash<MeshEdge>
 
 struct IntermediateVertex
 {
-    TVertex   m             = {};
-    XMMATRIX Quadric       = XMMatrixIdentity();
-    size_t   OtherIndex    = 0;
-    size_t   TriangleCount = 0;
-    bool     Visited       = false;
-    bool     IsBorder      = false;
+    TVertex          m             = {};
+    SymmetricQuadric Quadric       = {};
+    size_t           OtherIndex    = 0;
+    size_t           TriangleCount = 0;
+    bool             Visited       = false;
+    bool             IsBorder      = false;
 };
 
 struct IntermediateTriangle
@@ -75,98 +81,272 @@ struct IntermediateTriangle
 
 constexpr size_t TARGET_PRIMITIVES = MESHLET_MAX_PRIMITIVES * 3 / 4;
 
+// Рёбра близости в графе группировки мешлетов: ключ слота помечен старшим битом,
+// чтобы не совпасть с рёбрами сетки, а вес равен весу одного общего ребра сетки
+constexpr uint64_t SPATIAL_EDGE_KEY         = uint64_t(1) << 63;
+constexpr idx_t    SPATIAL_EDGE_WEIGHT      = 1;
+constexpr size_t   SPATIAL_NEIGHBOUR_WINDOW = 16;
+
+// Группировка мешлетов слоя. Если слой не уменьшился, пробуем другие затравки METIS
+// и группы крупнее: у них больше треугольников на ту же длину заблокированной границы.
+// Последняя попытка --- весь слой одной группой, у неё заблокированных границ нет вовсе
+struct GroupingAttempt
+{
+    idx_t GroupSize = 4;  // 0 --- весь слой одной группой
+    idx_t Seed      = -1; // -1 --- затравка METIS по умолчанию
+};
+
+constexpr GroupingAttempt GROUPING_ATTEMPTS[] = {
+    {4, -1},
+    {4, 1 },
+    {8, -1},
+    {8, 2 },
+    {0, -1},
+};
+
+// Больше мешлетов одной группой не упрощаем: слишком резкий переход между уровнями
+constexpr size_t ROOT_GROUP_MAX_MESHLETS = 32;
+
+// С бюджетом ошибки группы крупнее: из восьми мешлетов может получиться один
+constexpr idx_t ADAPTIVE_GROUP_SIZE = 8;
+
+// Самая мелкая сетка кластеризации вершин по каждой оси, дальше она огрубляется вдвое
+constexpr size_t CLUSTER_GRID_CELLS = 64;
+
+enum class DecimationEngine
+{
+    Greedy, // Полный перебор рёбер на каждом шаге
+    Heap,   // Куча кандидатов с ленивой инвалидацией
+};
+
+enum class PlacementStrategy
+{
+    Endpoints, // Только концы ребра
+    Optimal,   // Минимум квадрики, затем поиск вдоль ребра, затем концы
+};
+
+enum class PartitionerKind
+{
+    Metis,         // METIS_PartGraphKway, размер частей только в среднем
+    RegionGrowing, // Наращивание областей с жёсткими ограничениями на треугольники и вершины
+    Morton,        // Куски порядка Мортона, для быстрого предварительного просмотра
+};
+
+static const char *PartitionerName(PartitionerKind kind)
+{
+    switch (kind)
+    {
+    case PartitionerKind::Metis: return "metis";
+    case PartitionerKind::RegionGrowing: return "regions";
+    case PartitionerKind::Morton: return "morton";
+    }
+    return "unknown";
+}
+
+struct CollapseCandidate
+{
+    float  Error  = 0.0f;
+    size_t iVert  = 0;
+    size_t jVert  = 0;
+    size_t iStamp = 0;
+    size_t jStamp = 0;
+
+    bool operator>(const CollapseCandidate &rhs) const noexcept
+    {
+        if (Error != rhs.Error)
+            return Error > rhs.Error;
+        if (iVert != rhs.iVert)
+            return iVert > rhs.iVert;
+        return jVert > rhs.jVert;
+    }
+};
+
 struct IntermediateMeshlet
 {
     std::vector<IntermediateVertex>        Vertices;
     std::vector<IntermediateTriangle>      Triangles;
     std::vector<size_t>                    VertexCluster;
     SplitVector<std::pair<size_t, size_t>> ClusterTriangles;
-    float                                  TotalError = 0.0f;
-    std::unordered_set<MeshEdge>           dbgUsedEdges;
+    float                                  TotalError      = 0.0f;
+    DecimationEngine                       Engine          = DecimationEngine::Heap;
+    PlacementStrategy                      Placement       = PlacementStrategy::Optimal;
+    size_t                                 MaxTriangles    = 2 * TARGET_PRIMITIVES; // Цель децимации
+    size_t                                 BudgetTriangles = 2 * TARGET_PRIMITIVES; // Цель, если хватит ErrorBudget
+    float                                  ErrorBudget     = 0.0f;
+    size_t                                 BudgetCollapses = 0; // Стягиваний ниже MaxTriangles
+
+    // Состояние движка с кучей
+    std::vector<size_t>            VertexStamp;
+    std::vector<CollapseCandidate> CollapseHeap;
+    std::vector<CollapseCandidate> CollapseDeferred;
+    std::vector<size_t>            CollapseNeighbours;
+
+    // Рабочие буферы. Объект переиспользуется для всех групп одного потока,
+    // ёмкости выставляет Reserve перед каждой группой
+    std::vector<size_t>               GlobalVertexIds;
+    std::vector<MeshEdge>             ScratchEdges;
+    std::vector<size_t>               ScratchOrder;
+    std::vector<IntermediateTriangle> ScratchTriangles;
+
+    DecimationTraceBuffer    Trace;
+    AdjacencyBuilder         Adjacency;
+    RegionGrowingPartitioner Regions;
+    MortonPartitioner        Morton;
+    BoundaryRefiner          Refiner;
+    MetisTrials              Trials;
+    std::vector<idx_t>       ScratchPart;
+
+    // Буферы кластеризации вершин
+    std::vector<IntermediateVertex>   ClusterSourceVertices;
+    std::vector<IntermediateTriangle> ClusterSourceTriangles;
+    std::vector<uint64_t>             ClusterKeys;
+    std::vector<size_t>               ClusterOrder;
+    std::vector<size_t>               ClusterRemap;
 
     Slice<std::pair<size_t, size_t>> VertexTriangles(size_t iVert)
     {
-        ASSERT(iVert < VertexCluster.size());
+        ASSERT_CHEAP(iVert < VertexCluster.size());
         size_t iCluster = VertexCluster[iVert];
-        ASSERT(iCluster < ClusterTriangles.PartCount());
+        ASSERT_CHEAP(iCluster < ClusterTriangles.PartCount());
         return ClusterTriangles[iCluster];
     }
 
-    void Init(Slice<IntermediateVertex>          globalVertices,
-              SplitVector<IntermediateTriangle> &globalTriangles,
-              Slice<size_t>                      baseMeshlets,
-              size_t                             layerBeg)
+    // Ёмкости под группу из nTriangles треугольников, вершин в ней не больше 3 * nTriangles.
+    // Ёмкость только растёт, поэтому поток обращается к куче, лишь когда ему впервые
+    // достаётся группа крупнее прежних. Сама децимация после этого память не выделяет
+    void Reserve(size_t nTriangles)
+    {
+        size_t nVertices = 3 * nTriangles;
+        Vertices.reserve(nVertices);
+        Triangles.reserve(nTriangles);
+        VertexCluster.reserve(nVertices);
+        // Между перестроениями индекса не больше nTriangles / 4 стягиваний,
+        // и каждое дописывает треугольники вокруг двух вершин
+        ClusterTriangles.Reserve(nVertices + nTriangles, 2 * nVertices);
+
+        if (VertexStamp.size() < nVertices)
+            VertexStamp.resize(nVertices);
+        CollapseHeap.reserve(4 * nTriangles);
+        CollapseDeferred.reserve(4 * nTriangles);
+        CollapseNeighbours.reserve(2 * nTriangles);
+
+        GlobalVertexIds.reserve(nVertices);
+        ScratchEdges.reserve(nVertices);
+        ScratchOrder.reserve(nTriangles);
+        ScratchTriangles.reserve(nTriangles);
+
+        ClusterSourceVertices.reserve(nVertices);
+        ClusterSourceTriangles.reserve(nTriangles);
+        ClusterKeys.reserve(nVertices);
+        ClusterOrder.reserve(nVertices);
+        ClusterRemap.reserve(nVertices);
+    }
+
+    // Глобальные вершины только читаются, поэтому группы можно собирать из разных потоков
+    void Init(const std::vector<IntermediateVertex> &globalVertices,
+              SplitVector<IntermediateTriangle>     &globalTriangles,
+              Slice<size_t>                          baseMeshlets,
+              size_t                                 layerBeg)
     {
         Vertices.clear();
         Triangles.clear();
+        GlobalVertexIds.clear();
 
-        // Помечаем вершины для сбора, собираем треугольники
+        // Собираем треугольники и номера их вершин
         for (size_t iiMeshlet : baseMeshlets)
         {
             size_t iMeshlet = layerBeg + iiMeshlet;
             for (const IntermediateTriangle &tri : globalTriangles[iMeshlet])
             {
                 for (size_t iVert : tri.idx)
-                    globalVertices[iVert].Visited = false;
+                    GlobalVertexIds.push_back(iVert);
                 Triangles.push_back(tri);
             }
         }
+        std::sort(GlobalVertexIds.begin(), GlobalVertexIds.end());
+        GlobalVertexIds.erase(std::unique(GlobalVertexIds.begin(), GlobalVertexIds.end()), GlobalVertexIds.end());
+
+        // Собираем вершины, локальный индекс --- позиция в отсортированном списке
+        Vertices.reserve(GlobalVertexIds.size());
+        for (size_t iVert : GlobalVertexIds)
+        {
+            IntermediateVertex vert = globalVertices[iVert];
+            vert.TriangleCount      = 0;
+            vert.IsBorder           = false;
+            vert.OtherIndex         = iVert;
+            vert.Visited            = true;
+            Vertices.push_back(vert);
+        }
 
-        // Собираем вершины, а также преобразовываем индексы к локальным
+        // Преобразовываем индексы к локальным
         for (IntermediateTriangle &tri : Triangles)
         {
             tri.Error = {};
 
             for (size_t &iVert : tri.idx)
             {
-                size_t              iLocVert = globalVertices[iVert].OtherIndex;
-                IntermediateVertex &globVert = globalVertices[iVert];
-                if (!globVert.Visited)
-                {
-                    globVert.Visited        = true;
-                    iLocVert                = Vertices.size();
-                    globVert.OtherIndex     = iLocVert;
-                    IntermediateVertex vert = globVert;
-                    vert.TriangleCount      = 0;
-                    vert.IsBorder           = false;
-                    vert.OtherIndex         = iVert;
-                    vert.Visited            = true;
-                    Vertices.push_back(vert);
-                }
-                iVert = iLocVert;
-                Vertices[iLocVert].TriangleCount++;
+                auto iter = std::lower_bound(GlobalVertexIds.begin(), GlobalVertexIds.end(), iVert);
+                iVert     = iter - GlobalVertexIds.begin();
+                Vertices[iVert].TriangleCount++;
             }
         }
         MarkBorderVertices();
         BuildVertexTriangleIndex();
     }
 
+    // Граничное ребро встречается ровно в одном треугольнике: сортируем все рёбра и ищем одиночные
     void MarkBorderVertices()
     {
-        std::unordered_map<MeshEdge, size_t> edgeTriangleCount;
+        ScratchEdges.clear();
         for (const IntermediateTriangle &tri : Triangles)
         {
             for (size_t iVert : tri.idx)
                 Vertices[iVert].IsBorder = false;
             for (size_t iTriEdge = 0; iTriEdge < 3; ++iTriEdge)
-            {
-                MeshEdge edge        = tri.EdgeKey(iTriEdge);
-                auto [iter, isFirst] = edgeTriangleCount.try_emplace(edge, 0);
-                iter->second++;
-            }
+                ScratchEdges.push_back(tri.EdgeKey(iTriEdge));
         }
+        std::sort(ScratchEdges.begin(), ScratchEdges.end());
 
-        // Определяем граничные вершины
-        for (const auto &[edge, count] : edgeTriangleCount)
+        for (size_t iBeg = 0, iEnd = 0; iBeg < ScratchEdges.size(); iBeg = iEnd)
         {
-            if (count != 1)
+            iEnd = iBeg + 1;
+            while (iEnd < ScratchEdges.size() && ScratchEdges[iEnd] == ScratchEdges[iBeg])
+                ++iEnd;
+            if (iEnd - iBeg != 1)
                 continue;
+            const MeshEdge &edge           = ScratchEdges[iBeg];
             Vertices[edge.first].IsBorder  = true;
             Vertices[edge.second].IsBorder = true;
-            dbgUsedEdges.insert(edge);
         }
     }
 
+    // Отсортированные рёбра неудалённых треугольников; граничные --- только одиночные
+    void CollectEdges(std::vector<MeshEdge> &edges, bool borderOnly) const
+    {
+        edges.clear();
+        for (const IntermediateTriangle &tri : Triangles)
+        {
+            if (tri.IsDeleted)
+                continue;
+            for (size_t iTriEdge = 0; iTriEdge < 3; ++iTriEdge)
+                edges.push_back(tri.EdgeKey(iTriEdge));
+        }
+        std::sort(edges.begin(), edges.end());
+        if (!borderOnly)
+            return;
+
+        size_t nBorder = 0;
+        for (size_t iBeg = 0, iEnd = 0; iBeg < edges.size(); iBeg = iEnd)
+        {
+            iEnd = iBeg + 1;
+            while (iEnd < edges.size() && edges[iEnd] == edges[iBeg])
+                ++iEnd;
+            if (iEnd - iBeg == 1)
+                edges[nBorder++] = edges[iBeg];
+        }
+        edges.resize(nBorder);
+    }
+
     void BuildVertexTriangleIndex()
     {
         ClusterTriangles.Clear();
@@ -194,19 +374,25 @@ struct IntermediateMeshlet
 
     void Decimate()
     {
-        TotalError = 0.0f;
+        switch (Engine)
+        {
+        case DecimationEngine::Greedy: DecimateGreedy(); break;
+        case DecimationEngine::Heap: DecimateHeap(); break;
+        }
+        FinishDecimation();
+    }
+
+    // Исходный вариант: на каждом шаге перебираем все рёбра группы
+    void DecimateGreedy()
+    {
+        TotalError      = 0.0f;
+        BudgetCollapses = 0;
 
-        size_t            nDeletedTriangles = 0;
-        std::vector<bool> deleted1;
-        std::vector<bool> deleted2;
-        std::vector<bool> deleted1Best;
-        std::vector<bool> deleted2Best;
+        size_t nDeletedTriangles = 0;
 
         InitQuadrics();
 
-        size_t nMerged = 0;
-        dbgSaveAsObj(nMerged);
-        while (Triangles.size() - nDeletedTriangles > 2 * TARGET_PRIMITIVES)
+        while (Triangles.size() - nDeletedTriangles > std::min(MaxTriangles, BudgetTriangles))
         {
             if (4 * nDeletedTriangles >= Triangles.size())
             {
@@ -235,21 +421,13 @@ struct IntermediateMeshlet
                         continue;
 
                     XMVECTOR mid = {};
-                    float    err = CalculateError(iVert, jVert, mid);
-                    deleted1.resize(VertexTriangles(iVert).Size());
-                    std::fill(deleted1.begin(), deleted1.end(), false);
-                    if (Flipped(mid, iVert, jVert, deleted1))
-                        continue;
-                    deleted2.resize(VertexTriangles(jVert).Size());
-                    std::fill(deleted2.begin(), deleted2.end(), false);
-                    if (Flipped(mid, jVert, iVert, deleted2))
+                    float    err = 0.0f;
+                    if (!FindPlacement(iVert, jVert, mid, err))
                         continue;
 
                     if (foundBest && err >= errBest)
                         continue;
 
-                    deleted1Best.swap(deleted1);
-                    deleted2Best.swap(deleted2);
                     iVertBest = iVert;
                     jVertBest = jVert;
                     midBest   = mid;
@@ -258,72 +436,247 @@ struct IntermediateMeshlet
                 }
             }
 
-            if (!foundBest)
+            if (!foundBest || !IsWithinBudget(Triangles.size() - nDeletedTriangles, errBest))
                 break;
 
             TotalError += errBest;
+            Collapse(iVertBest, jVertBest, midBest, errBest, nDeletedTriangles);
+        }
+    }
+
+    // Рёбра лежат в куче по значению квадрики. Устаревшие кандидаты отсеиваются
+    // при извлечении по счётчикам изменений вершин, проверка на переворот
+    // треугольников делается только для вершины кучи
+    void DecimateHeap()
+    {
+        TotalError      = 0.0f;
+        BudgetCollapses = 0;
 
-            IntermediateVertex &vert1 = Vertices[iVertBest];
-            IntermediateVertex &vert2 = Vertices[jVertBest];
-            if (vert1.IsBorder)
+        size_t nDeletedTriangles = 0;
+
+        InitQuadrics();
+
+        // Счётчики только сравниваются на равенство со снятыми при постановке в кучу,
+        // а куча очищается для каждой группы, поэтому обнулять их не нужно. Размер выставлен в Reserve
+        ASSERT_CHEAP(VertexStamp.size() >= Vertices.size());
+        CollapseHeap.clear();
+        CollapseDeferred.clear();
+
+        ScratchEdges.clear();
+        for (const IntermediateTriangle &tri : Triangles)
+        {
+            if (tri.IsDeleted)
+                continue;
+            for (size_t iTriEdge = 0; iTriEdge < 3; ++iTriEdge)
+                ScratchEdges.push_back(tri.EdgeKey(iTriEdge));
+        }
+        std::sort(ScratchEdges.begin(), ScratchEdges.end());
+        ScratchEdges.erase(std::unique(ScratchEdges.begin(), ScratchEdges.end()), ScratchEdges.end());
+        for (const MeshEdge &edge : ScratchEdges)
+            PushCollapseCandidate(edge.first, edge.second);
+
+        bool progress = false;
+        while (Triangles.size() - nDeletedTriangles > std::min(MaxTriangles, BudgetTriangles))
+        {
+            if (4 * nDeletedTriangles >= Triangles.size())
+            {
+                // Квадрики не сбрасываем, иначе пришлось бы пересчитывать всю кучу
+                RemoveDeletedTriangles();
+                nDeletedTriangles = 0;
+            }
+
+            if (CollapseHeap.empty())
             {
-                vert1.Quadric += vert2.Quadric;
-                GatherTriangles(iVertBest, iVertBest, nDeletedTriangles, deleted1Best);
-                GatherTriangles(iVertBest, jVertBest, nDeletedTriangles, deleted2Best);
-                VertexCluster[iVertBest] = ClusterTriangles.PartCount();
-                ClusterTriangles.PushSplit();
-                dbgSaveAsObj(++nMerged);
+                // Отложенные из-за переворота рёбра могли стать допустимыми,
+                // если соседние вершины сдвинулись
+                if (!progress)
+                    break;
+                progress = false;
+                for (const CollapseCandidate &cand : CollapseDeferred)
+                {
+                    if (!IsStale(cand))
+                        CollapseHeap.push_back(cand);
+                }
+                CollapseDeferred.clear();
+                std::make_heap(CollapseHeap.begin(), CollapseHeap.end(), std::greater<>{});
                 continue;
             }
-            if (vert2.IsBorder)
+
+            std::pop_heap(CollapseHeap.begin(), CollapseHeap.end(), std::greater<>{});
+            CollapseCandidate cand = CollapseHeap.back();
+            CollapseHeap.pop_back();
+            if (IsStale(cand))
+                continue;
+
+            XMVECTOR mid = {};
+            float    err = 0.0f;
+            if (!FindPlacement(cand.iVert, cand.jVert, mid, err))
             {
-                vert2.Quadric += vert1.Quadric;
-                GatherTriangles(jVertBest, iVertBest, nDeletedTriangles, deleted1Best);
-                GatherTriangles(jVertBest, jVertBest, nDeletedTriangles, deleted2Best);
-                VertexCluster[jVertBest] = ClusterTriangles.PartCount();
-                ClusterTriangles.PushSplit();
-                dbgSaveAsObj(++nMerged);
+                if (CollapseDeferred.size() == CollapseDeferred.capacity())
+                    DropStaleCandidates(CollapseDeferred);
+                CollapseDeferred.push_back(cand);
                 continue;
             }
-            XMStoreFloat3(&vert1.m.Position, midBest);
-            vert1.Quadric += vert2.Quadric;
+            if (!IsWithinBudget(Triangles.size() - nDeletedTriangles, err))
+                break;
+
+            TotalError += err;
+            size_t iKept = Collapse(cand.iVert, cand.jVert, mid, err, nDeletedTriangles);
+            VertexStamp[cand.iVert]++;
+            VertexStamp[cand.jVert]++;
+            PushVertexCandidates(iKept);
+            progress = true;
+        }
+    }
+
+    // До MaxTriangles стягиваем всегда, дальше, вплоть до BudgetTriangles, --- пока суммарная ошибка
+    // остаётся в пределах ErrorBudget. Рёбра идут по возрастанию ошибки, поэтому на первом отказе останавливаемся
+    bool IsWithinBudget(size_t nTriangles, float err)
+    {
+        if (nTriangles > MaxTriangles)
+            return true;
+        if (TotalError + err > ErrorBudget)
+            return false;
+        BudgetCollapses++;
+        return true;
+    }
+
+    // Точка стягивания ребра, не переворачивающая треугольники.
+    // Если лучшая по квадрике точка переворачивает соседей, пробуем концы ребра
+    bool FindPlacement(size_t iVert, size_t jVert, XMVECTOR &mid, float &err)
+    {
+        PlacementStrategy placement = Placement;
+        for (;;)
+        {
+            err = CalculateError(iVert, jVert, mid, placement);
+            if (!Flipped(mid, iVert, jVert) && !Flipped(mid, jVert, iVert))
+                return true;
+            if (placement == PlacementStrategy::Endpoints)
+                return false;
+            placement = PlacementStrategy::Endpoints;
+        }
+    }
+
+    bool IsStale(const CollapseCandidate &cand) const noexcept
+    {
+        return VertexStamp[cand.iVert] != cand.iStamp || VertexStamp[cand.jVert] != cand.jStamp;
+    }
+
+    // Живых кандидатов не больше, чем рёбер в группе, поэтому, когда ёмкость из Reserve исчерпана,
+    // место освобождается выбрасыванием устаревших, а не ростом вектора
+    void DropStaleCandidates(std::vector<CollapseCandidate> &cands) const
+    {
+        cands.erase(std::remove_if(cands.begin(),
+                                   cands.end(),
+                                   [&](const CollapseCandidate &cand) { return IsStale(cand); }),
+                    cands.end());
+    }
+
+    void PushCollapseCandidate(size_t iVert, size_t jVert)
+    {
+        if (Vertices[iVert].IsBorder && Vertices[jVert].IsBorder)
+            return;
+        XMVECTOR          mid  = {};
+        CollapseCandidate cand = {};
+        cand.Error             = CalculateError(iVert, jVert, mid);
+        cand.iVert             = iVert;
+        cand.jVert             = jVert;
+        cand.iStamp            = VertexStamp[iVert];
+        cand.jStamp            = VertexStamp[jVert];
+        if (CollapseHeap.size() == CollapseHeap.capacity())
+        {
+            DropStaleCandidates(CollapseHeap);
+            std::make_heap(CollapseHeap.begin(), CollapseHeap.end(), std::greater<>{});
+        }
+        CollapseHeap.push_back(cand);
+        std::push_heap(CollapseHeap.begin(), CollapseHeap.end(), std::greater<>{});
+    }
+
+    // Пересчитываем только рёбра вокруг изменившейся вершины
+    void PushVertexCandidates(size_t iVert)
+    {
+        CollapseNeighbours.clear();
+        for (const auto &[iTriangle, iTriVert] : VertexTriangles(iVert))
+        {
+            const IntermediateTriangle &tri = Triangles[iTriangle];
+            if (tri.IsDeleted)
+                continue;
+            CollapseNeighbours.push_back(tri.idx[(iTriVert + 1) % 3]);
+            CollapseNeighbours.push_back(tri.idx[(iTriVert + 2) % 3]);
+        }
+        std::sort(CollapseNeighbours.begin(), CollapseNeighbours.end());
+        CollapseNeighbours.erase(std::unique(CollapseNeighbours.begin(), CollapseNeighbours.end()),
+                                 CollapseNeighbours.end());
+        for (size_t jVert : CollapseNeighbours)
+        {
+            if (jVert != iVert)
+                PushCollapseCandidate(iVert, jVert);
+        }
+    }
+
+    // Стягивает ребро, возвращает индекс оставшейся вершины.
+    // Граничные вершины не двигаем
+    size_t Collapse(size_t iVert, size_t jVert, XMVECTOR mid, float error, size_t &nDeletedTriangles)
+    {
+        IntermediateVertex &vert1 = Vertices[iVert];
+        IntermediateVertex &vert2 = Vertices[jVert];
+        size_t              iKept = iVert;
+        size_t              iGone = jVert;
+        if (!vert1.IsBorder && vert2.IsBorder)
+            std::swap(iKept, iGone);
+        if (!vert1.IsBorder && !vert2.IsBorder)
+        {
+            XMStoreFloat3(&vert1.m.Position, mid);
             vert1.OtherIndex = UINT32_MAX;
             vert1.Visited    = false;
-            GatherTriangles(iVertBest, iVertBest, nDeletedTriangles, deleted1Best);
-            GatherTriangles(iVertBest, jVertBest, nDeletedTriangles, deleted2Best);
-            VertexCluster[iVertBest] = ClusterTriangles.PartCount();
-            ClusterTriangles.PushSplit();
-            dbgSaveAsObj(++nMerged);
         }
+        Vertices[iKept].Quadric += Vertices[iGone].Quadric;
+        GatherTriangles(iKept, iVert, jVert, nDeletedTriangles);
+        GatherTriangles(iKept, jVert, iVert, nDeletedTriangles);
+        VertexCluster[iKept] = ClusterTriangles.PartCount();
+        ClusterTriangles.PushSplit();
+        Trace.Collapse(iVert, jVert, iKept, Vertices[iKept].m.Position, error);
+        return iKept;
+    }
 
-        // TODO: найти другой метод фильтрации дублирующихся треугольников
-        std::set<IntermediateTriangle> resultTrianglesSet;
-
+    void FinishDecimation()
+    {
+        ScratchOrder.clear();
         for (size_t iTriangle = 0; iTriangle < Triangles.size(); ++iTriangle)
         {
-            const IntermediateTriangle &tri = Triangles[iTriangle];
+            IntermediateTriangle &tri = Triangles[iTriangle];
             for (size_t iTriEdge = 0; iTriEdge < 3; ++iTriEdge)
             {
                 size_t iVert = tri.idx[iTriEdge];
                 size_t jVert = tri.idx[(iTriEdge + 1) % 3];
                 if (iVert == jVert)
-                    Triangles[iTriangle].IsDeleted = true;
+                    tri.IsDeleted = true;
             }
 
-            if (Triangles[iTriangle].IsDeleted)
+            if (tri.IsDeleted)
                 continue;
 
-            for (size_t iTriEdge = 0; iTriEdge < 3; ++iTriEdge)
-            {
-                MeshEdge edge = tri.EdgeKey(iTriEdge);
-                dbgUsedEdges.erase(edge);
-            }
-
-            resultTrianglesSet.insert(tri);
+            ScratchOrder.push_back(iTriangle);
         }
 
-        Triangles = std::vector(resultTrianglesSet.begin(), resultTrianglesSet.end());
-        // ASSERT(dbgUsedEdges.empty());
+        // Убираем дубликаты сортировкой. При равенстве побеждает треугольник с меньшим номером
+        std::sort(ScratchOrder.begin(), ScratchOrder.end(), [&](size_t iLhs, size_t iRhs) {
+            const IntermediateTriangle &lhs = Triangles[iLhs];
+            const IntermediateTriangle &rhs = Triangles[iRhs];
+            if (lhs < rhs)
+                return true;
+            if (rhs < lhs)
+                return false;
+            return iLhs < iRhs;
+        });
+        ScratchTriangles.clear();
+        for (size_t iTriangle : ScratchOrder)
+        {
+            if (!ScratchTriangles.empty() && ScratchTriangles.back() == Triangles[iTriangle])
+                continue;
+            ScratchTriangles.push_back(Triangles[iTriangle]);
+        }
+        Triangles.swap(ScratchTriangles);
 
         RemoveDeletedTriangles();
         RestoreNormals();
@@ -365,73 +718,88 @@ struct IntermediateMeshlet
     }
 
     float CalculateError(size_t iVert, size_t jVert, XMVECTOR &out)
+    {
+        return CalculateError(iVert, jVert, out, Placement);
+    }
+
+    float CalculateError(size_t iVert, size_t jVert, XMVECTOR &out, PlacementStrategy placement)
     {
         IntermediateVertex &vert1 = Vertices[iVert];
         IntermediateVertex &vert2 = Vertices[jVert];
-        XMMATRIX            q     = vert1.Quadric + vert2.Quadric;
-        XMVECTOR            p1    = XMLoadFloat3(&vert1.m.Position);
-        XMVECTOR            p2    = XMLoadFloat3(&vert2.m.Position);
+        SymmetricQuadric    q     = vert1.Quadric + vert2.Quadric;
 
         // Если мы на границе, то не имеем права двигать вершину
         if (vert1.IsBorder)
         {
             out = XMLoadFloat3(&vert1.m.Position);
-            return VertexError(q, out);
+            return q.Evaluate(out);
         }
         if (vert2.IsBorder)
         {
             out = XMLoadFloat3(&vert2.m.Position);
-            return VertexError(q, out);
+            return q.Evaluate(out);
         }
 
-        /*
-        XMVECTOR det  = XMVectorZero();
-        XMMATRIX qInv = XMMatrixInverse(&det, q);
-        if (fabs(XMVectorGetX(det)) >= 0.01)
+        const float3 &p1 = vert1.m.Position;
+        const float3 &p2 = vert2.m.Position;
+        if (placement == PlacementStrategy::Endpoints)
         {
-            out = XMVector4Transform(XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f), qInv);
-            return VertexError(q, out);
+            float xs[2]  = {p1.x, p2.x};
+            float ys[2]  = {p1.y, p2.y};
+            float zs[2]  = {p1.z, p2.z};
+            float err[2] = {};
+            EvaluateQuadricBatch(q, xs, ys, zs, err, 2);
+            out = XMLoadFloat3(err[0] <= err[1] ? &p1 : &p2);
+            return std::min(err[0], err[1]);
         }
-        */
 
-        XMVECTOR p3   = 0.5 * (p1 + p2);
-        float    err1 = VertexError(q, p1);
-        float    err2 = VertexError(q, p2);
-        float    err3 = VertexError(q, p3);
-        /*
-        if (err1 <= err2 && err1 <= err3)
-        {
-            out = p1;
-            return err1;
-        }
-        if (err2 <= err1 && err2 <= err3)
-        {
-            out = p2;
-            return err2;
-        }
-        out = p3;
-        return err3;
-        */
-        if (err1 <= err2)
+        // Все кандидаты считаем одним пакетом из восьми точек:
+        // концы, середина, четверти, минимум на прямой ребра и минимум квадрики.
+        // Концы идут первыми, поэтому при равной ошибке выбираются они
+        constexpr size_t N_CANDIDATES = 8;
+
+        float xs[N_CANDIDATES]  = {p1.x, p2.x};
+        float ys[N_CANDIDATES]  = {p1.y, p2.y};
+        float zs[N_CANDIDATES]  = {p1.z, p2.z};
+        float err[N_CANDIDATES] = {};
+
+        float3 d     = {p2.x - p1.x, p2.y - p1.y, p2.z - p1.z};
+        float  tLine = std::clamp(q.MinimizeAlong(p1, d), 0.0f, 1.0f);
+        float  ts[]  = {0.5f, 0.25f, 0.75f, tLine, 0.5f};
+        for (size_t i = 0; i < std::size(ts); ++i)
         {
-            out = p1;
-            return err1;
+            xs[2 + i] = p1.x + ts[i] * d.x;
+            ys[2 + i] = p1.y + ts[i] * d.y;
+            zs[2 + i] = p1.z + ts[i] * d.z;
         }
-        else
+
+        // Минимум квадрики заменяет последнего кандидата, только если система обусловлена
+        // и точка не уходит от середины ребра дальше длины ребра
+        float3 opt = {};
+        if (q.Minimize(opt))
         {
-            out = p2;
-            return err2;
+            float dx = opt.x - xs[2];
+            float dy = opt.y - ys[2];
+            float dz = opt.z - zs[2];
+            if (dx * dx + dy * dy + dz * dz <= d.x * d.x + d.y * d.y + d.z * d.z)
+            {
+                xs[N_CANDIDATES - 1] = opt.x;
+                ys[N_CANDIDATES - 1] = opt.y;
+                zs[N_CANDIDATES - 1] = opt.z;
+            }
         }
-    }
 
-    float VertexError(const XMMATRIX &q, XMVECTOR v)
-    {
-        v          = XMVectorSetW(v, 1.0f);
-        XMVECTOR u = XMVector3Transform(v, q);
-        return fabs(XMVectorGetX(XMVector4Dot(v, u)));
+        EvaluateQuadricBatch(q, xs, ys, zs, err, N_CANDIDATES);
+        size_t iBest = 0;
+        for (size_t i = 1; i < N_CANDIDATES; ++i)
+            if (err[i] < err[iBest])
+                iBest = i;
+        out = XMVectorSet(xs[iBest], ys[iBest], zs[iBest], 0.0f);
+        return err[iBest];
     }
 
-    void GatherTriangles(size_t iNewVert, size_t iVert, size_t &nDeletedTriangles, const std::vector<bool> &deleted)
+    // Треугольники вокруг iVert переходят к iNewVert, а содержащие стягиваемое ребро (iVert, iOther) удаляются
+    void GatherTriangles(size_t iNewVert, size_t iVert, size_t iOther, size_t &nDeletedTriangles)
     {
         XMVECTOR p           = {};
         size_t   iCluster    = VertexCluster[iVert];
@@ -444,13 +812,13 @@ struct IntermediateMeshlet
             IntermediateTriangle &tri         = Triangles[iTriangle];
             if (tri.IsDeleted)
                 continue;
-            if (deleted[iiTriangle - vertTrisBeg])
+            if (tri.idx[(iTriVert + 1) % 3] == iOther || tri.idx[(iTriVert + 2) % 3] == iOther)
             {
                 nDeletedTriangles++;
                 tri.IsDeleted = true;
                 continue;
             }
-            ASSERT_EQ(tri.idx[iTriVert], iVert);
+            ASSERT_EQ_CHEAP(tri.idx[iTriVert], iVert);
             tri.idx[iTriVert] = iNewVert;
             tri.Error[0]      = CalculateError(tri.idx[0], tri.idx[1], p);
             tri.Error[1]      = CalculateError(tri.idx[1], tri.idx[2], p);
@@ -466,16 +834,21 @@ struct IntermediateMeshlet
 
             ClusterTriangles.Push({iTriangle, iTriVert});
         }
-        for (const IntermediateTriangle &tri : Triangles)
+        // Полный обход группы после каждого стягивания
+        if constexpr (VALIDATE_PARANOID)
         {
-            if (tri.IsDeleted)
-                continue;
-            for (size_t jVert : tri.idx)
-                ASSERT(jVert == iNewVert || jVert != iVert);
+            for (const IntermediateTriangle &tri : Triangles)
+            {
+                if (tri.IsDeleted)
+                    continue;
+                for (size_t jVert : tri.idx)
+                    ASSERT(jVert == iNewVert || jVert != iVert);
+            }
         }
     }
 
-    bool Flipped(XMVECTOR p, size_t iVert, size_t jVert, std::vector<bool> &deleted)
+    // Треугольники со стягиваемым ребром исчезают и не проверяются
+    bool Flipped(XMVECTOR p, size_t iVert, size_t jVert)
     {
         size_t                           nBorder = 0;
         IntermediateVertex              &vert1   = Vertices[iVert];
@@ -493,10 +866,7 @@ struct IntermediateMeshlet
             size_t iVert1 = tri.idx[(iTriVert + 1) % 3];
             size_t iVert2 = tri.idx[(iTriVert + 2) % 3];
             if (iVert1 == jVert || iVert2 == jVert)
-            {
-                deleted[iiiTriangle] = true;
                 continue;
-            }
 
             XMVECTOR ob      = XMLoadFloat3(&Vertices[iVert1].m.Position);
             XMVECTOR oc      = XMLoadFloat3(&Vertices[iVert2].m.Position);
@@ -530,24 +900,7 @@ struct IntermediateMeshlet
     void InitQuadrics()
     {
         for (IntermediateVertex &vert : Vertices)
-        {
-            vert.Quadric = XMMatrixSet(0.0f,
-                                       0.0f,
-                                       0.0f,
-                                       0.0f,
-                                       0.0f,
-                                       0.0f,
-                                       0.0f,
-                                       0.0f,
-                                       0.0f,
-                                       0.0f,
-                                       0.0f,
-                                       0.0f,
-                                       0.0f,
-                                       0.0f,
-                                       0.0f,
-                                       0.0f);
-        }
+            vert.Quadric = {};
         for (IntermediateTriangle &tri : Triangles)
         {
             XMVECTOR p[3] = {};
@@ -557,10 +910,9 @@ struct IntermediateMeshlet
                 IntermediateVertex &vert  = Vertices[iVert];
                 p[iTriVert]               = XMLoadFloat3(&vert.m.Position);
             }
-            tri.Normal    = XMVector3Normalize(XMVector3Cross(p[1] - p[0], p[2] - p[0]));
-            float    off  = -XMVectorGetX(XMVector3Dot(tri.Normal, p[0]));
-            XMVECTOR v    = XMVectorSetW(tri.Normal, off);
-            XMMATRIX prod = XMMatrixVectorTensorProduct(v, v);
+            tri.Normal            = XMVector3Normalize(XMVector3Cross(p[1] - p[0], p[2] - p[0]));
+            float            off  = -XMVectorGetX(XMVector3Dot(tri.Normal, p[0]));
+            SymmetricQuadric prod = SymmetricQuadric::FromPlane(XMVectorSetW(tri.Normal, off));
             for (size_t iVert : tri.idx)
             {
                 IntermediateVertex &vert = Vertices[iVert];
@@ -580,13 +932,150 @@ struct IntermediateMeshlet
         }
     }
 
-    void dbgSaveAsObj(size_t iteration, bool overrideDebug = true)
+    // Запасной упрощатель для групп, которые квадрики не довели до MaxTriangles
+    // (заблокированные границы, отказы из-за переворотов). Внутренние вершины сливаются
+    // по ячейкам сетки, и сетка огрубляется вдвое, пока треугольников не станет достаточно мало.
+    // Граничные вершины не двигаются, поэтому стыки с соседними группами сохраняются.
+    // Перевороты здесь не проверяются. Возвращает true, если группа была упрощена
+    bool ClusterDecimate()
+    {
+        if (Triangles.size() <= MaxTriangles)
+            return false;
+
+        ClusterSourceVertices.assign(Vertices.begin(), Vertices.end());
+        ClusterSourceTriangles.assign(Triangles.begin(), Triangles.end());
+
+        XMVECTOR boxMin  = XMVectorReplicate(FLT_MAX);
+        XMVECTOR boxMax  = XMVectorReplicate(-FLT_MAX);
+        for (const IntermediateTriangle &tri : Triangles)
+        {
+            for (size_t iVert : tri.idx)
+            {
+                XMVECTOR pos = XMLoadFloat3(&Vertices[iVert].m.Position);
+                boxMin       = XMVectorMin(boxMin, pos);
+                boxMax       = XMVectorMax(boxMax, pos);
+            }
+        }
+
+        float clusterError = 0.0f;
+        for (size_t nCells = CLUSTER_GRID_CELLS;; nCells /= 2)
+        {
+            Vertices.assign(ClusterSourceVertices.begin(), ClusterSourceVertices.end());
+            Triangles.assign(ClusterSourceTriangles.begin(), ClusterSourceTriangles.end());
+            clusterError = 0.0f;
+
+            XMVECTOR cellSize = XMVectorMax((boxMax - boxMin) / float(nCells), XMVectorReplicate(FLT_MIN));
+            auto     cellOf   = [&](const float3 &p) {
+                XMFLOAT3 cell;
+                XMStoreFloat3(&cell, (XMLoadFloat3(&p) - boxMin) / cellSize);
+                uint64_t x = std::min(uint64_t(std::max(cell.x, 0.0f)), uint64_t(nCells - 1));
+                uint64_t y = std::min(uint64_t(std::max(cell.y, 0.0f)), uint64_t(nCells - 1));
+                uint64_t z = std::min(uint64_t(std::max(cell.z, 0.0f)), uint64_t(nCells - 1));
+                return (x * nCells + y) * nCells + z;
+            };
+
+            ClusterKeys.assign(Vertices.size(), UINT64_MAX);
+            ClusterOrder.clear();
+            for (const IntermediateTriangle &tri : Triangles)
+            {
+                for (size_t iVert : tri.idx)
+                {
+                    if (Vertices[iVert].IsBorder || ClusterKeys[iVert] != UINT64_MAX)
+                        continue;
+                    ClusterKeys[iVert] = cellOf(Vertices[iVert].m.Position);
+                    ClusterOrder.push_back(iVert);
+                }
+            }
+            std::sort(ClusterOrder.begin(), ClusterOrder.end(), [&](size_t iLhs, size_t iRhs) {
+                return ClusterKeys[iLhs] < ClusterKeys[iRhs] || (ClusterKeys[iLhs] == ClusterKeys[iRhs] && iLhs < iRhs);
+            });
+
+            // Ячейка стягивается в вершину с меньшим номером: в минимум суммарной квадрики,
+            // если он внутри ячейки, иначе в среднее
+            ClusterRemap.resize(Vertices.size());
+            for (size_t iVert = 0; iVert < Vertices.size(); ++iVert)
+                ClusterRemap[iVert] = iVert;
+            for (size_t iBeg = 0, iEnd = 0; iBeg < ClusterOrder.size(); iBeg = iEnd)
+            {
+                iEnd = iBeg + 1;
+                while (iEnd < ClusterOrder.size() && ClusterKeys[ClusterOrder[iEnd]] == ClusterKeys[ClusterOrder[iBeg]])
+                    ++iEnd;
+                if (iEnd - iBeg == 1)
+                    continue;
+
+                size_t           iKept   = ClusterOrder[iBeg];
+                SymmetricQuadric quadric = {};
+                XMVECTOR         sum     = XMVectorZero();
+                for (size_t i = iBeg; i < iEnd; ++i)
+                {
+                    const IntermediateVertex &vert = Vertices[ClusterOrder[i]];
+                    quadric += vert.Quadric;
+                    sum += XMLoadFloat3(&vert.m.Position);
+                    ClusterRemap[ClusterOrder[i]] = iKept;
+                }
+
+                float3 pos = {};
+                if (!quadric.Minimize(pos) || cellOf(pos) != ClusterKeys[iKept])
+                    XMStoreFloat3(&pos, sum / float(iEnd - iBeg));
+
+                IntermediateVertex &kept = Vertices[iKept];
+                kept.m.Position          = pos;
+                kept.Quadric             = quadric;
+                kept.OtherIndex          = UINT32_MAX;
+                kept.Visited             = false;
+                clusterError += quadric.Evaluate(pos.x, pos.y, pos.z);
+            }
+
+            for (IntermediateTriangle &tri : Triangles)
+            {
+                for (size_t &iVert : tri.idx)
+                    iVert = ClusterRemap[iVert];
+            }
+            FinishDecimation();
+
+            if (Triangles.size() <= MaxTriangles || nCells == 1)
+                break;
+        }
+        TotalError += clusterError;
+        TraceClusters();
+        return true;
+    }
+
+    // Итоговая кластеризация в журнале: каждая вершина ячейки стягивается в оставшуюся.
+    // Проигрывание таких стягиваний даёт ту же сетку, что и ClusterDecimate, с точностью до дубликатов
+    void TraceClusters()
+    {
+        if (!Trace.Enabled)
+            return;
+        for (size_t iBeg = 0, iEnd = 0; iBeg < ClusterOrder.size(); iBeg = iEnd)
+        {
+            iEnd = iBeg + 1;
+            while (iEnd < ClusterOrder.size() && ClusterKeys[ClusterOrder[iEnd]] == ClusterKeys[ClusterOrder[iBeg]])
+                ++iEnd;
+
+            size_t        iKept = ClusterOrder[iBeg];
+            const float3 &pos   = Vertices[iKept].m.Position;
+            float         error = Vertices[iKept].Quadric.Evaluate(pos.x, pos.y, pos.z);
+            for (size_t i = iBeg + 1; i < iEnd; ++i)
+                Trace.Collapse(iKept, ClusterOrder[i], iKept, pos, error);
+        }
+    }
+
+    // Состояние группы перед децимацией, если для неё включён журнал
+    void TraceBegin(size_t iLayer, size_t iGroup)
     {
-        if (!overrideDebug)
+        if (!Trace.Enabled)
             return;
-        std::ostringstream ossFilename;
-        ossFilename << "dbg/dbg" << std::setfill('0') << std::setw(4) << iteration << ".obj";
-        std::ofstream fout(ossFilename.str());
+        Trace.Begin(iLayer, iGroup, Vertices.size(), Triangles.size());
+        for (const IntermediateVertex &vert : Vertices)
+            Trace.Vertex(vert.m.Position, vert.IsBorder);
+        for (const IntermediateTriangle &tri : Triangles)
+            Trace.Triangle(tri.idx[0], tri.idx[1], tri.idx[2]);
+    }
+
+    void dbgSaveAsObj(const std::filesystem::path &path)
+    {
+        std::ofstream fout(path);
         for (IntermediateVertex &v : Vertices)
             fout << "v " << v.m.Position.x << " " << v.m.Position.y << " " << v.m.Position.z << "\n";
         for (IntermediateVertex &v : Vertices)
@@ -608,36 +1097,236 @@ struct IntermediateMeshlet
     }
 };
 
-struct IntermediateMesh
+// Настройки конвертации, задаются из командной строки
+struct ConverterOptions
 {
-    template <size_t N> using EdgeIndicesMap = std::unordered_map<MeshEdge, std::vector<size_t>>;
+    DecimationEngine   Engine            = DecimationEngine::Heap;
+    PlacementStrategy  Placement         = PlacementStrategy::Optimal;
+    PartitionerKind    Partitioner       = PartitionerKind::Metis;
+    size_t             RefinePasses      = 4;     // Проходы уточнения разбиения треугольников, 0 --- без него
+    size_t             SpatialNeighbours = 4;     // Ближайших мешлетов в графе группировки, 0 --- только общие рёбра
+    size_t             FirstChunkSize    = 0;     // Треугольников в куске первого разбиения, 0 --- без кусков
+    bool               StallRecovery     = true;  // Перегруппировка застрявших слоёв и кластеризация вершин
+    size_t             PartitionTrials   = 1;     // Попыток METIS с разными затравками, остаётся лучшая
+    PartitionObjective TrialObjective    = PartitionObjective::EdgeCut;
+    float              ErrorBudget       = 0.0f;  // Доля диагонали; 0 --- группы всегда упрощаются вдвое
+    GridMode           Grid              = GridMode::Auto;
+    size_t             ThreadCount       = 0;     // 0 --- по числу ядер
+    bool               BenchPlacement    = false; // Сравнить стратегии размещения вместо конвертации
+    bool               BenchPartition    = false; // Сравнить METIS и порядок Мортона вместо конвертации
+    bool               BenchBudget       = false; // Сравнить бюджет ошибки с постоянным упрощением вдвое
+    bool               BenchCulling      = false; // Замерить отсечение мешлетов после конвертации
+    bool               QuantizeVertices  = false; // Сохранить также сжатый поток вершин (VertexQuantization.h)
+    uint               PrimitiveEncoding = 0;     // Маска PrimitiveEncodingBit; 0 --- Primitives без сжатия
+
+    // Журнал децимации: пишутся первые TraceGroups групп каждого слоя
+    // и не больше TraceCollapses стягиваний в группе
+    std::string TracePath;
+    size_t      TraceGroups    = 4;
+    size_t      TraceCollapses = 1024;
+
+    // Проигрывание журнала в OBJ-снимки вместо конвертации
+    std::string ReplayTracePath;
+    std::string ReplayDir  = "dbg";
+    size_t      ReplayStep = 1;
+
+    // Проверка готового файла модели вместо конвертации
+    std::string InspectModelPath;
+};
 
+// Результат децимации одной группы мешлетов до слияния с общей сеткой
+struct DecimatedGroup
+{
     std::vector<IntermediateVertex>   Vertices;
     std::vector<IntermediateTriangle> Triangles;
-    XMVECTOR                          BoxMax = XMVectorZero();
-    XMVECTOR                          BoxMin = XMVectorZero();
+    float                             TotalError = 0.0f;
+    float                             AccumError = 0.0f; // TotalError плюс наибольшая накопленная у мешлетов группы
+    std::vector<idx_t>                TrianglePart;
+    idx_t                             PartCount       = 0;
+    std::vector<uint>                 TraceWords;
+    RefinementStats                   Refinement;
+    PartitionTrialStats               Trials;
+    bool                              QemStalled = false; // Квадрики не довели группу до цели
+    bool                              Clustered  = false; // К группе применена кластеризация вершин
+    bool                              Stalled    = false; // Группа так и осталась больше цели
+    bool                              OverTarget = false; // Бюджет ошибки позволил упростить группу сильнее
+};
 
-    std::vector<size_t> MeshletLayerOffsets;
+// Результат прореживания одной группы на быстром пути для решёток.
+// Треугольники разложены по четвертям группы, пустые четверти мешлетами не становятся
+struct GridGroup
+{
+    std::vector<size_t>                              Members; // Мешлеты слоя, индексы внутри слоя
+    std::array<std::vector<IntermediateTriangle>, 4> QuadrantTriangles;
+    std::array<GridRect, 4>                          QuadrantRects;
+    float                                            TotalError = 0.0f;
+};
 
-    SplitVector<IntermediateTriangle> MeshletTriangles;
-    std::vector<size_t>               MeshletParentOffset;
-    std::vector<size_t>               MeshletParentCount;
-    std::vector<float>                MeshletError;
+// Каждый треугольник владеет тремя слотами --- своими рёбрами
+static void PushTriangleEdges(AdjacencyBuilder &adjacency, const std::vector<IntermediateTriangle> &triangles)
+{
+    adjacency.Clear();
+    for (const IntermediateTriangle &tri : triangles)
+    {
+        for (size_t iTriEdge = 0; iTriEdge < 3; ++iTriEdge)
+            adjacency.SlotKeys.push_back(PackEdgeKey(tri.idx[iTriEdge], tri.idx[(iTriEdge + 1) % 3]));
+        adjacency.PushItem();
+    }
+}
 
-    SplitVector<MeshEdge> MeshletEdges;
-    EdgeIndicesMap<2>     EdgeMeshlets;
+// Вершины треугольников как вершины объектов для оценки копий вершин
+static void PushTriangleItems(MetisTrials &trials, const std::vector<IntermediateTriangle> &triangles)
+{
+    trials.ClearItems();
+    if (!trials.NeedsItemVertices())
+        return;
+    for (const IntermediateTriangle &tri : triangles)
+    {
+        for (size_t iVert : tri.idx)
+            trials.ItemVertices.push_back(uint(iVert));
+        trials.PushItem();
+    }
+}
 
-    std::vector<size_t> dbgVertexMeshletCount;
+static void PrintPartitionTrials(const PartitionTrialStats &stats, PartitionObjective objective)
+{
+    std::cout << "\tPartition trials: " << PartitionObjectiveName(objective) << " " << stats.FirstValue << " -> "
+              << stats.BestValue << ", improved " << stats.Improved << " of " << stats.Calls << "\n";
+}
 
-    size_t LayerMeshletCount(size_t iLayer) const noexcept
+static float3 TriangleCentroid(const IntermediateTriangle &tri, const std::vector<IntermediateVertex> &vertices)
+{
+    XMVECTOR center = XMVectorZero();
+    for (size_t iTriVert = 0; iTriVert < 3; ++iTriVert)
+        center += XMLoadFloat3(&vertices[tri.idx[iTriVert]].m.Position);
+    float3 centroid = {};
+    XMStoreFloat3(&centroid, center / 3.0f);
+    return centroid;
+}
+
+static void PushTriangleCentroids(std::vector<float3>                     &centroids,
+                                  const std::vector<IntermediateTriangle> &triangles,
+                                  const std::vector<IntermediateVertex>   &vertices)
+{
+    centroids.clear();
+    for (const IntermediateTriangle &tri : triangles)
+        centroids.push_back(TriangleCentroid(tri, vertices));
+}
+
+static void PushRegionTriangles(RegionGrowingPartitioner                &regions,
+                                const std::vector<IntermediateTriangle> &triangles,
+                                const std::vector<IntermediateVertex>   &vertices)
+{
+    regions.Clear();
+    for (const IntermediateTriangle &tri : triangles)
     {
-        return MeshletLayerOffsets[iLayer + 1] - MeshletLayerOffsets[iLayer];
+        for (size_t iTriVert = 0; iTriVert < 3; ++iTriVert)
+            regions.TriangleVertices.push_back(uint(tri.idx[iTriVert]));
     }
+    PushTriangleCentroids(regions.Centroids, triangles, vertices);
+}
 
-    void LoadGLB(const std::string &path)
+static void PushRefinerInput(BoundaryRefiner                         &refiner,
+                             const std::vector<IntermediateTriangle> &triangles,
+                             const std::vector<IntermediateVertex>   &vertices)
+{
+    refiner.Clear();
+    for (const IntermediateTriangle &tri : triangles)
     {
-        TMonoLodCPU mono;
-        mono.LoadGLB(path);
+        for (size_t iTriVert = 0; iTriVert < 3; ++iTriVert)
+            refiner.TriangleVertices.push_back(uint(tri.idx[iTriVert]));
+    }
+    for (const IntermediateVertex &vert : vertices)
+        refiner.Positions.push_back(vert.m.Position);
+}
+
+static void PrintRefinement(const RefinementStats &stats)
+{
+    std::cout << "\tRefinement: duplicated vertices " << stats.DuplicatedBefore << " -> " << stats.DuplicatedAfter
+              << ", box volume " << stats.VolumeBefore << " -> " << stats.VolumeAfter << ", moves " << stats.Moves
+              << "\n";
+}
+
+// Качество разбиения одного слоя
+struct PartitionQuality
+{
+    size_t EdgeCut         = 0; // Рёбра сетки, общие для нескольких мешлетов
+    size_t MeshletVertices = 0; // Сумма числа вершин по мешлетам
+    size_t UniqueVertices  = 0; // Разных вершин в слое
+
+    size_t DuplicatedVertices() const noexcept { return MeshletVertices - UniqueVertices; }
+
+    PartitionQuality &operator+=(const PartitionQuality &rhs) noexcept
+    {
+        EdgeCut += rhs.EdgeCut;
+        MeshletVertices += rhs.MeshletVertices;
+        UniqueVertices += rhs.UniqueVertices;
+        return *this;
+    }
+};
+
+struct IntermediateMesh
+{
+    ConverterOptions Options;
+
+    std::vector<IntermediateVertex>   Vertices;
+    std::vector<IntermediateTriangle> Triangles;
+    XMVECTOR                          BoxMax = XMVectorZero();
+    XMVECTOR                          BoxMin = XMVectorZero();
+
+    std::vector<size_t> MeshletLayerOffsets;
+
+    SplitVector<IntermediateTriangle> MeshletTriangles;
+    std::vector<size_t>               MeshletParentOffset;
+    std::vector<size_t>               MeshletParentCount;
+    std::vector<float>                MeshletError;
+    std::vector<float>                MeshletAccumError; // Ошибка, накопленная от листьев: наибольшая у детей + своя
+    double                            DecimationError = 0.0; // Сумма ошибок всех групп
+
+    std::vector<size_t> dbgVertexMeshletCount;
+
+    // Буферы децимации переживают слои: по одному мешлету на поток и по результату на группу
+    std::vector<IntermediateMeshlet> ThreadMeshlets;
+    std::vector<DecimatedGroup>      DecimatedGroups;
+
+    RefinementStats FirstRefinement;     // Уточнение первого разбиения
+    size_t          FirstChunkCount = 0; // Кусков первого разбиения, 0 --- сетка целиком
+    RefinementStats LayerRefinement; // Уточнение повторных разбиений последнего слоя
+
+    PartitionTrialStats FirstTrials; // Попытки METIS первого разбиения
+    PartitionTrialStats LayerTrials; // Попытки METIS группировки и повторных разбиений последнего слоя
+
+    // Диагностика последнего слоя
+    size_t      LayerAttempts   = 0; // Попыток группировки
+    size_t      LayerGroupSize  = 0; // Мешлетов в группе у последней попытки
+    size_t      LayerGroupCount = 0;
+    size_t      LayerQemStalls  = 0; // Групп, которые квадрики не довели до цели
+    size_t      LayerClustered  = 0; // Из них упрощённых кластеризацией
+    size_t      LayerStalled    = 0; // Групп, оставшихся больше цели
+    size_t      LayerOverTarget = 0; // Групп, упрощённых сильнее за счёт бюджета ошибки
+    const char *LayerStopReason = "";
+
+    std::vector<uint> TraceWords; // Журналы групп в порядке слияния
+
+    GridLattice            Grid;             // Решётка, если сетка распознана как регулярная
+    std::vector<GridRect>  GridMeshletRects; // Узлы, которые покрывает каждый мешлет быстрого пути
+    std::vector<GridGroup> GridGroups;
+
+    AdjacencyBuilder       Adjacency;
+    MortonPartitioner      Morton;
+    SpatialNeighbourFinder Spatial;
+    MetisTrials            Trials;
+    std::vector<uint64_t>  ScratchEdgeKeys;
+
+    size_t LayerMeshletCount(size_t iLayer) const noexcept
+    {
+        return MeshletLayerOffsets[iLayer + 1] - MeshletLayerOffsets[iLayer];
+    }
+
+    void LoadGLB(const std::string &path)
+    {
+        TMonoLodCPU mono;
+        mono.LoadGLB(path);
 
         Vertices.clear();
         Vertices.reserve(mono.Vertices.size());
@@ -792,117 +1481,228 @@ struct IntermediateMesh
         }
     }
 
-    EdgeIndicesMap<2> BuildTriangleEdgeIndex(Slice<IntermediateTriangle> triangles)
+    // Треугольники смежны, если у них есть общее ребро; вес --- длина этого ребра.
+    // Нормировка по диагонали всей сетки, чтобы веса в кусках совпадали с весами целой сетки
+    void BuildTriangleGraph(const std::vector<IntermediateTriangle> &triangles,
+                            const std::vector<IntermediateVertex>   &vertices,
+                            size_t                                   nThreads,
+                            AdjacencyBuilder                        &adjacency)
     {
-        EdgeIndicesMap<2> edgeTriangles;
-        for (size_t iTriangle = 0; iTriangle < triangles.Size(); ++iTriangle)
+        ASSERT_TEXT(vertices.size() <= (size_t(1) << 32), "Too many vertices for packed edge keys");
+        PushTriangleEdges(adjacency, triangles);
+
+        XMVECTOR maxDiff = BoxMax - BoxMin;
+        float    maxLen  = XMVectorGetX(XMVector3Length(maxDiff)) * (1.0f + FLT_EPSILON);
+
+        adjacency.Build(false, nThreads, [&](size_t iSlot) {
+            MeshEdge edge  = triangles[iSlot / 3].EdgeKey(iSlot % 3);
+            XMVECTOR posiv = XMLoadFloat3(&vertices[edge.first].m.Position);
+            XMVECTOR posjv = XMLoadFloat3(&vertices[edge.second].m.Position);
+            float    len   = XMVectorGetX(XMVector3Length(posjv - posiv));
+            return idx_t(IDX_C(0x7FFFFFFF) * len / maxLen);
+        });
+
+        if constexpr (false)
         {
-            for (size_t iTriEdge = 0; iTriEdge < 3; ++iTriEdge)
+            std::vector<idx_t> &xadj   = adjacency.Graph.Xadj;
+            std::vector<idx_t> &adjncy = adjacency.Graph.Adjncy;
+
+            std::cout << "\nAdjacency:\n";
+            for (idx_t iTriangle = 0; iTriangle < idx_t(triangles.size()); ++iTriangle)
             {
-                MeshEdge edge        = triangles[iTriangle].EdgeKey(iTriEdge);
-                auto [iter, isFirst] = edgeTriangles.try_emplace(edge);
-                auto &vec            = iter->second;
-                ASSERT(!LastEquals(vec, iTriangle));
-                vec.push_back(iTriangle);
+                std::cout << iTriangle << ':';
+                idx_t beg = xadj[iTriangle];
+                idx_t end = xadj[size_t(iTriangle) + 1];
+                for (idx_t i = beg; i < end; ++i)
+                    std::cout << ' ' << adjncy[i];
+                std::cout << '\n';
             }
         }
-        return edgeTriangles;
     }
 
-    void DoFirstPartition()
+    // Разбивает треугольники на мешлеты выбранным способом и уточняет результат.
+    // Рабочие буферы берутся из scratch; возвращает число мешлетов
+    size_t PartitionTriangles(const std::vector<IntermediateTriangle> &triangles,
+                              const std::vector<IntermediateVertex>   &vertices,
+                              size_t                                   nThreads,
+                              IntermediateMeshlet                     &scratch,
+                              std::vector<idx_t>                      &part,
+                              RefinementStats                         &refinement)
     {
-        size_t nMeshlets = (Triangles.size() + TARGET_PRIMITIVES - 1) / TARGET_PRIMITIVES;
-
-        MeshletLayerOffsets = {0, nMeshlets};
+        size_t nTriangles = triangles.size();
+        size_t nMeshlets  = (nTriangles + TARGET_PRIMITIVES - 1) / TARGET_PRIMITIVES;
+        part.assign(nTriangles, 0);
+        scratch.Trials.Stats = {};
 
-        size_t             nTriangles = Triangles.size();
-        std::vector<idx_t> triangleMeshlet(nTriangles, 0);
-        if (nMeshlets == 1)
+        if (Options.Partitioner == PartitionerKind::Morton)
         {
-            std::fill(triangleMeshlet.begin(), triangleMeshlet.end(), IDX_C(0));
-            return;
+            // Граф смежности не нужен, в этом и выигрыш
+            PushTriangleCentroids(scratch.Morton.Centroids, triangles, vertices);
+            scratch.Morton.Partition(BoxMin, BoxMax, nMeshlets, nThreads, part);
+        }
+        else if (Options.Partitioner == PartitionerKind::RegionGrowing)
+        {
+            // Число мешлетов здесь не задаётся, а получается из ограничений
+            BuildTriangleGraph(triangles, vertices, nThreads, scratch.Adjacency);
+            PushRegionTriangles(scratch.Regions, triangles, vertices);
+            nMeshlets = scratch.Regions.Partition(
+                vertices.size(), scratch.Adjacency.Graph, MESHLET_MAX_PRIMITIVES, MESHLET_MAX_VERTICES, part);
         }
+        else if (nMeshlets > 1)
+        {
+            BuildTriangleGraph(triangles, vertices, nThreads, scratch.Adjacency);
 
-        auto edgeTriangles = BuildTriangleEdgeIndex(Triangles);
+            scratch.Trials.TrialCount = Options.PartitionTrials;
+            scratch.Trials.Objective  = Options.TrialObjective;
+            PushTriangleItems(scratch.Trials, triangles);
+            scratch.Trials.Partition(scratch.Adjacency.Graph, true, idx_t(nMeshlets), -1, nThreads, part);
+        }
 
-        // std::cout << "Preparing METIS structure...\n";
-        idx_t nparts = nMeshlets;
-        idx_t nvtxs  = nTriangles;
-        idx_t ncon   = 1;
+        // Порядок Мортона нужен ради скорости, поэтому его не уточняем
+        refinement = {};
+        if (Options.Partitioner != PartitionerKind::Morton && nMeshlets > 1 && Options.RefinePasses > 0)
+        {
+            PushRefinerInput(scratch.Refiner, triangles, vertices);
+            refinement = scratch.Refiner.Refine(scratch.Adjacency.Graph,
+                                                nMeshlets,
+                                                MESHLET_MAX_PRIMITIVES,
+                                                MESHLET_MAX_VERTICES,
+                                                Options.RefinePasses,
+                                                part);
+        }
+        return nMeshlets;
+    }
 
-        std::vector<idx_t> xadj;
-        xadj.reserve(size_t(nvtxs) + 1);
-        xadj.push_back(0);
+    // Первое разбиение по кускам: сетка делится пополам по длинной оси центров треугольников,
+    // пока куски больше FirstChunkSize, затем куски разбиваются параллельно, каждый в своём потоке.
+    // Рёбра между кусками в графы не попадают, так что память и время на поток зависят
+    // только от размера куска. Возвращает число мешлетов
+    size_t PartitionByChunks(std::vector<idx_t> &triangleMeshlet)
+    {
+        size_t nTriangles = Triangles.size();
 
-        std::vector<idx_t> adjncy;
-        std::vector<idx_t> adjwgt;
+        std::vector<float3> centroids;
+        PushTriangleCentroids(centroids, Triangles, Vertices);
 
-        XMVECTOR maxDiff = BoxMax - BoxMin;
-        float    maxLen  = XMVectorGetX(XMVector3Length(maxDiff)) * (1.0f + FLT_EPSILON);
+        std::vector<size_t> order(nTriangles);
+        for (size_t iTriangle = 0; iTriangle < nTriangles; ++iTriangle)
+            order[iTriangle] = iTriangle;
 
-        for (idx_t iTriangle = 0; iTriangle < nTriangles; ++iTriangle)
+        // Левая половина обходится раньше правой, поэтому куски идут подряд по order
+        std::vector<size_t>                    chunkOffsets = {0};
+        std::vector<std::pair<size_t, size_t>> ranges       = {{0, nTriangles}};
+        while (!ranges.empty())
         {
-            for (idx_t iTriEdge = 0; iTriEdge < 3; ++iTriEdge)
+            auto [beg, end] = ranges.back();
+            ranges.pop_back();
+            if (end - beg <= Options.FirstChunkSize)
             {
-                MeshEdge edge  = Triangles[iTriangle].EdgeKey(iTriEdge);
-                size_t   iVert = edge.first;
-                size_t   jVert = edge.second;
-                auto    &vec   = edgeTriangles[edge];
-
-                float3   posi   = Vertices[iVert].m.Position;
-                float3   posj   = Vertices[jVert].m.Position;
-                XMVECTOR posiv  = XMLoadFloat3(&posi);
-                XMVECTOR posjv  = XMLoadFloat3(&posj);
-                float    len    = XMVectorGetX(XMVector3Length(posjv - posiv));
-                idx_t    weight = idx_t(IDX_C(0x7FFFFFFF) * len / maxLen);
-
-                for (size_t jTriangle : vec)
-                {
-                    if (jTriangle == iTriangle)
-                        continue;
-                    adjncy.push_back(jTriangle);
-                    adjwgt.push_back(weight);
-                }
+                chunkOffsets.push_back(end);
+                continue;
             }
-            xadj.push_back(idx_t(adjncy.size()));
-        }
 
-        idx_t edgecut = 0;
+            float3 lo = centroids[order[beg]];
+            float3 hi = lo;
+            for (size_t i = beg; i < end; ++i)
+            {
+                const float3 &c = centroids[order[i]];
+                lo              = {std::min(lo.x, c.x), std::min(lo.y, c.y), std::min(lo.z, c.z)};
+                hi              = {std::max(hi.x, c.x), std::max(hi.y, c.y), std::max(hi.z, c.z)};
+            }
+            float3 extent = {hi.x - lo.x, hi.y - lo.y, hi.z - lo.z};
+            size_t axis   = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+            auto   coord  = [&](size_t iTriangle) {
+                const float3 &c = centroids[iTriangle];
+                return axis == 0 ? c.x : (axis == 1 ? c.y : c.z);
+            };
+
+            size_t mid = beg + (end - beg) / 2;
+            std::nth_element(order.begin() + beg, order.begin() + mid, order.begin() + end, [&](size_t i, size_t j) {
+                float ci = coord(i);
+                float cj = coord(j);
+                return ci < cj || (ci == cj && i < j);
+            });
+            ranges.emplace_back(mid, end);
+            ranges.emplace_back(beg, mid);
+        }
 
-        if constexpr (false)
-        {
-            std::cout << "\nAdjacency:\n";
-            for (idx_t iTriangle = 0; iTriangle < nTriangles; ++iTriangle)
+        size_t                       nChunks = chunkOffsets.size() - 1;
+        std::vector<size_t>          chunkMeshlets(nChunks, 0);
+        std::vector<RefinementStats>     chunkRefinement(nChunks);
+        std::vector<PartitionTrialStats> chunkTrials(nChunks);
+        ParallelFor(nChunks, Options.ThreadCount, [&](size_t iThread, size_t iChunk) {
+            IntermediateMeshlet &loc = ThreadMeshlets[iThread];
+            size_t               beg = chunkOffsets[iChunk];
+            size_t               end = chunkOffsets[iChunk + 1];
+
+            // Локальная копия куска с плотной нумерацией вершин
+            loc.GlobalVertexIds.clear();
+            for (size_t i = beg; i < end; ++i)
             {
-                std::cout << iTriangle << ':';
-                idx_t beg = xadj[iTriangle];
-                idx_t end = xadj[size_t(iTriangle) + 1];
-                for (idx_t i = beg; i < end; ++i)
-                    std::cout << ' ' << adjncy[i];
-                std::cout << '\n';
+                for (size_t iVert : Triangles[order[i]].idx)
+                    loc.GlobalVertexIds.push_back(iVert);
             }
+            std::sort(loc.GlobalVertexIds.begin(), loc.GlobalVertexIds.end());
+            loc.GlobalVertexIds.erase(std::unique(loc.GlobalVertexIds.begin(), loc.GlobalVertexIds.end()),
+                                      loc.GlobalVertexIds.end());
+
+            loc.Vertices.clear();
+            for (size_t iVert : loc.GlobalVertexIds)
+                loc.Vertices.push_back(Vertices[iVert]);
+            loc.Triangles.clear();
+            for (size_t i = beg; i < end; ++i)
+            {
+                IntermediateTriangle tri = Triangles[order[i]];
+                for (size_t &iVert : tri.idx)
+                    iVert = std::lower_bound(loc.GlobalVertexIds.begin(), loc.GlobalVertexIds.end(), iVert)
+                          - loc.GlobalVertexIds.begin();
+                loc.Triangles.push_back(tri);
+            }
+
+            // Уже внутри параллельного цикла по кускам, поэтому в один поток
+            chunkMeshlets[iChunk]
+                = PartitionTriangles(loc.Triangles, loc.Vertices, 1, loc, loc.ScratchPart, chunkRefinement[iChunk]);
+            chunkTrials[iChunk] = loc.Trials.Stats;
+            for (size_t i = beg; i < end; ++i)
+                triangleMeshlet[order[i]] = loc.ScratchPart[i - beg];
+        });
+
+        // Сшиваем: номера мешлетов куска сдвигаются на число мешлетов в предыдущих кусках
+        size_t nMeshlets = 0;
+        FirstRefinement  = {};
+        FirstTrials      = {};
+        for (size_t iChunk = 0; iChunk < nChunks; ++iChunk)
+        {
+            for (size_t i = chunkOffsets[iChunk]; i < chunkOffsets[iChunk + 1]; ++i)
+                triangleMeshlet[order[i]] += idx_t(nMeshlets);
+            nMeshlets += chunkMeshlets[iChunk];
+            FirstRefinement += chunkRefinement[iChunk];
+            FirstTrials += chunkTrials[iChunk];
+        }
+        FirstChunkCount = nChunks;
+        return nMeshlets;
+    }
+
+    void DoFirstPartition()
+    {
+        size_t             nTriangles = Triangles.size();
+        std::vector<idx_t> triangleMeshlet(nTriangles, 0);
+
+        if (ThreadMeshlets.size() < ParallelThreadCount(Options.ThreadCount))
+            ThreadMeshlets.resize(ParallelThreadCount(Options.ThreadCount));
+
+        size_t nMeshlets = 0;
+        FirstChunkCount  = 0;
+        if (Options.FirstChunkSize > 0 && nTriangles > Options.FirstChunkSize)
+            nMeshlets = PartitionByChunks(triangleMeshlet);
+        else
+        {
+            nMeshlets = PartitionTriangles(
+                Triangles, Vertices, Options.ThreadCount, ThreadMeshlets[0], triangleMeshlet, FirstRefinement);
+            FirstTrials = ThreadMeshlets[0].Trials.Stats;
         }
 
-        idx_t options[METIS_NOPTIONS] = {};
-        METIS_SetDefaultOptions(options);
-        options[METIS_OPTION_NUMBERING] = 0;
-
-        // Для разделения кроме первой фазы нужно будет
-        // использовать графы
-        int metisResult = METIS_PartGraphKway(&nvtxs,
-                                              &ncon,
-                                              xadj.data(),
-                                              adjncy.data(),
-                                              nullptr /* vwgt */,
-                                              nullptr /* vsize */,
-                                              adjwgt.data(),
-                                              &nparts,
-                                              nullptr /* tpwgts */,
-                                              nullptr /* ubvec */,
-                                              options /* options */,
-                                              &edgecut /* edgecut */,
-                                              triangleMeshlet.data() /* part */);
-        ASSERT_EQ(metisResult, METIS_OK);
+        MeshletLayerOffsets = {0, nMeshlets};
 
         SplitVector<size_t> meshletTriangleIndices(nMeshlets, Slice(triangleMeshlet));
         MeshletTriangles.Clear();
@@ -915,266 +1715,403 @@ struct IntermediateMesh
         MeshletParentOffset = std::vector<size_t>(nMeshlets, 0);
         MeshletParentCount  = std::vector<size_t>(nMeshlets, 0);
         MeshletError        = std::vector<float>(nMeshlets, 0.0f);
+        MeshletAccumError   = std::vector<float>(nMeshlets, 0.0f);
     }
 
-    void BuildMeshletEdgeIndex(size_t iLayer)
+    // Центр мешлета --- среднее центров его треугольников
+    void PushMeshletCentroids(size_t iLayer, std::vector<float3> &centroids)
     {
-        size_t layerBeg  = MeshletLayerOffsets[iLayer];
-        size_t layerEnd  = MeshletLayerOffsets[iLayer + 1];
-        size_t nMeshlets = layerEnd - layerBeg;
+        centroids.clear();
+        for (size_t iMeshlet = MeshletLayerOffsets[iLayer]; iMeshlet < MeshletLayerOffsets[iLayer + 1]; ++iMeshlet)
+        {
+            XMVECTOR center = XMVectorZero();
+            for (const IntermediateTriangle &tri : MeshletTriangles[iMeshlet])
+            {
+                float3 triCenter = TriangleCentroid(tri, Vertices);
+                center += XMLoadFloat3(&triCenter);
+            }
+            float3 centroid = {};
+            XMStoreFloat3(&centroid, center / float(std::max<size_t>(MeshletTriangles.PartSize(iMeshlet), 1)));
+            centroids.push_back(centroid);
+        }
+    }
+
+    // Мешлеты слоя смежны, если у них есть общие рёбра сетки; вес --- число общих рёбер.
+    // Кроме того, каждый мешлет соединяется с ближайшими по центрам, чтобы несвязные
+    // острова (листва, обломки, куски скана) тоже попадали в группы и упрощались вместе
+    void BuildMeshletGraph(size_t iLayer)
+    {
+        size_t layerBeg = MeshletLayerOffsets[iLayer];
+        size_t layerEnd = MeshletLayerOffsets[iLayer + 1];
 
-        MeshletEdges.Clear();
-        EdgeMeshlets.clear();
+        bool useSpatial = Options.SpatialNeighbours > 0;
+        if (useSpatial)
+        {
+            ASSERT_TEXT(Vertices.size() < (size_t(1) << 31), "Too many vertices for spatial edge keys");
+            PushMeshletCentroids(iLayer, Spatial.Centroids);
+            Spatial.Build(BoxMin, BoxMax, Options.SpatialNeighbours, SPATIAL_NEIGHBOUR_WINDOW, Options.ThreadCount);
+        }
 
+        Adjacency.Clear();
         for (size_t iMeshlet = layerBeg; iMeshlet < layerEnd; ++iMeshlet)
         {
-            size_t                       iiMeshlet = iMeshlet - layerBeg;
-            std::unordered_set<MeshEdge> seenEdges;
+            ScratchEdgeKeys.clear();
             for (const IntermediateTriangle &tri : MeshletTriangles[iMeshlet])
             {
                 for (size_t iTriEdge = 0; iTriEdge < 3; ++iTriEdge)
-                {
-                    MeshEdge edge        = tri.EdgeKey(iTriEdge);
-                    auto [iter, isFirst] = EdgeMeshlets.try_emplace(edge);
-                    auto &vec            = iter->second;
-                    if (!LastEquals(vec, iiMeshlet))
-                        vec.push_back(iiMeshlet);
-                    seenEdges.insert(edge);
-                }
+                    ScratchEdgeKeys.push_back(PackEdgeKey(tri.idx[iTriEdge], tri.idx[(iTriEdge + 1) % 3]));
             }
+            std::sort(ScratchEdgeKeys.begin(), ScratchEdgeKeys.end());
+            ScratchEdgeKeys.erase(std::unique(ScratchEdgeKeys.begin(), ScratchEdgeKeys.end()), ScratchEdgeKeys.end());
+            Adjacency.SlotKeys.insert(Adjacency.SlotKeys.end(), ScratchEdgeKeys.begin(), ScratchEdgeKeys.end());
 
-            for (const MeshEdge &edge : seenEdges)
-                MeshletEdges.Push(edge);
-            MeshletEdges.PushSplit();
+            // Ключ пары одинаков с обеих сторон, поэтому ребро близости получается симметричным
+            if (useSpatial)
+            {
+                size_t iiMeshlet = iMeshlet - layerBeg;
+                for (size_t i = Spatial.Offsets[iiMeshlet]; i < Spatial.Offsets[iiMeshlet + 1]; ++i)
+                    Adjacency.SlotKeys.push_back(SPATIAL_EDGE_KEY | PackEdgeKey(iiMeshlet, Spatial.Neighbours[i]));
+            }
+            Adjacency.PushItem();
         }
+        Adjacency.Build(true, Options.ThreadCount, [&](size_t iSlot) {
+            return (Adjacency.SlotKeys[iSlot] & SPATIAL_EDGE_KEY) ? SPATIAL_EDGE_WEIGHT : IDX_C(1);
+        });
     }
 
-    bool PartitionMeshlets()
+    idx_t GroupSize(const GroupingAttempt &attempt) const noexcept
+    {
+        if (attempt.GroupSize > 0 && Options.ErrorBudget > 0.0f)
+            return std::max(attempt.GroupSize, ADAPTIVE_GROUP_SIZE);
+        return attempt.GroupSize;
+    }
+
+    // Строит следующий слой из последнего. Возвращает false, если группировать нечего
+    bool BuildLayer(size_t iLayer, const GroupingAttempt &attempt)
     {
-        size_t iLayer   = MeshletLayerOffsets.size() - 2;
         size_t layerBeg = MeshletLayerOffsets[iLayer];
         size_t layerEnd = MeshletLayerOffsets[iLayer + 1];
 
-        // std::cout << "Building meshlet-edge index...\n";
-        BuildMeshletEdgeIndex(iLayer);
-        // std::cout << "Building meshlet-edge index done\n";
-
-        idx_t              nMeshlets = layerEnd - layerBeg;
-        idx_t              nParts    = (nMeshlets + 3) / 4;
+        idx_t              groupSize    = GroupSize(attempt);
+        idx_t              nMeshlets    = layerEnd - layerBeg;
+        idx_t              nParts       = groupSize > 0 ? (nMeshlets + groupSize - 1) / groupSize : 1;
+        size_t             maxTriangles = 2 * TARGET_PRIMITIVES;
         std::vector<idx_t> meshletPart(nMeshlets, 0);
+        Trials.Stats = {};
 
         if (nParts < 3)
-            return false;
-
-        idx_t ncon = 1;
-
-        std::vector<idx_t> xadj;
-        xadj.reserve(nMeshlets + 1);
-        xadj.push_back(0);
-
-        std::vector<idx_t> adjncy;
-        std::vector<idx_t> adjwgt;
-
-        std::vector<idx_t> commonEdgesWith(nMeshlets, 0);
-        for (size_t iMeshlet = layerBeg; iMeshlet < layerEnd; ++iMeshlet)
         {
-            size_t iiMeshlet = iMeshlet - layerBeg;
-
-            // Пометим все смежные мешлеты как непосещённые
-            for (MeshEdge edge : MeshletEdges[iiMeshlet])
-            {
-                for (size_t jjMeshlet : EdgeMeshlets[edge])
-                {
-                    if (jjMeshlet != iiMeshlet)
-                        commonEdgesWith[jjMeshlet] = 0;
-                }
-            }
-
-            // Посчитаем веса рёбер как количество смежных рёбер сетки
-            for (MeshEdge edge : MeshletEdges[iiMeshlet])
-            {
-                for (size_t jjMeshlet : EdgeMeshlets[edge])
-                {
-                    if (jjMeshlet != iiMeshlet)
-                        commonEdgesWith[jjMeshlet]++;
-                }
-            }
+            if (!Options.StallRecovery || nMeshlets < 2)
+                return false;
+            // Верхушка иерархии: весь слой одной группой, которая должна уместиться в один мешлет
+            nParts       = 1;
+            maxTriangles = TARGET_PRIMITIVES;
+        }
 
-            // Посчитаем веса рёбер как количество смежных рёбер сетки
-            for (MeshEdge edge : MeshletEdges[iiMeshlet])
+        if (nParts == 1)
+        {
+            // Всё уже в части 0
+        }
+        else if (Options.Partitioner == PartitionerKind::Morton)
+        {
+            PushMeshletCentroids(iLayer, Morton.Centroids);
+            Morton.Partition(BoxMin, BoxMax, nParts, Options.ThreadCount, meshletPart);
+        }
+        else
+        {
+            // std::cout << "Building meshlet graph...\n";
+            BuildMeshletGraph(iLayer);
+            // std::cout << "Building meshlet graph done\n";
+
+            // Объекты здесь --- мешлеты, их вершины берутся из треугольников с повторами
+            Trials.TrialCount = Options.PartitionTrials;
+            Trials.Objective  = Options.TrialObjective;
+            Trials.ClearItems();
+            if (Trials.NeedsItemVertices())
             {
-                for (size_t jjMeshlet : EdgeMeshlets[edge])
+                for (size_t iMeshlet = layerBeg; iMeshlet < layerEnd; ++iMeshlet)
                 {
-                    if (jjMeshlet != iiMeshlet && commonEdgesWith[jjMeshlet] != 0)
+                    for (const IntermediateTriangle &tri : MeshletTriangles[iMeshlet])
                     {
-                        adjncy.push_back(jjMeshlet);
-                        adjwgt.push_back(commonEdgesWith[jjMeshlet]);
-                        commonEdgesWith[jjMeshlet] = 0;
+                        for (size_t iVert : tri.idx)
+                            Trials.ItemVertices.push_back(uint(iVert));
                     }
+                    Trials.PushItem();
                 }
             }
-
-            xadj.push_back(adjncy.size());
+            Trials.Partition(Adjacency.Graph, true, nParts, attempt.Seed, Options.ThreadCount, meshletPart);
         }
 
-        idx_t options[METIS_NOPTIONS] = {};
-        METIS_SetDefaultOptions(options);
-        options[METIS_OPTION_NUMBERING] = 0;
-
-        idx_t edgecut = 0;
-
-        int metisResult = METIS_PartGraphKway(&nMeshlets /* nvtxs */,
-                                              &ncon /* ncon */,
-                                              xadj.data(),
-                                              adjncy.data(),
-                                              nullptr /* vwgt */,
-                                              nullptr /* vsize */,
-                                              adjwgt.data(),
-                                              &nParts,
-                                              nullptr /* tpwgts */,
-                                              nullptr /* ubvec */,
-                                              options,
-                                              &edgecut,
-                                              meshletPart.data() /* part */);
-        ASSERT_EQ(metisResult, METIS_OK);
-
         SplitVector<size_t> partMeshlets(nParts, Slice(meshletPart));
 
-        for (size_t iMeshlet = layerBeg; iMeshlet < layerEnd; ++iMeshlet)
-        {
-            size_t iiMeshlet = iMeshlet - layerBeg;
-            size_t iPart     = meshletPart[iiMeshlet];
-        }
-
         // Отладочный второй способ подсчёта граничных вершин
-        dbgVertexMeshletCount.resize(Vertices.size());
-        std::fill(dbgVertexMeshletCount.begin(), dbgVertexMeshletCount.end(), 0);
-        for (size_t iPart = 0; iPart < nParts; ++iPart)
+        if constexpr (VALIDATE_PARANOID)
         {
-            for (size_t iiMeshlet : partMeshlets[iPart])
+            dbgVertexMeshletCount.resize(Vertices.size());
+            std::fill(dbgVertexMeshletCount.begin(), dbgVertexMeshletCount.end(), 0);
+            for (size_t iPart = 0; iPart < size_t(nParts); ++iPart)
             {
-                size_t iMeshlet = layerBeg + iiMeshlet;
-                for (const IntermediateTriangle &tri : MeshletTriangles[iMeshlet])
+                for (size_t iiMeshlet : partMeshlets[iPart])
                 {
-                    for (size_t iVert : tri.idx)
-                        Vertices[iVert].Visited = false;
+                    size_t iMeshlet = layerBeg + iiMeshlet;
+                    for (const IntermediateTriangle &tri : MeshletTriangles[iMeshlet])
+                    {
+                        for (size_t iVert : tri.idx)
+                            Vertices[iVert].Visited = false;
+                    }
                 }
-            }
-            for (size_t iiMeshlet : partMeshlets[iPart])
-            {
-                size_t iMeshlet = layerBeg + iiMeshlet;
-                for (const IntermediateTriangle &tri : MeshletTriangles[iMeshlet])
+                for (size_t iiMeshlet : partMeshlets[iPart])
                 {
-                    for (size_t iVert : tri.idx)
+                    size_t iMeshlet = layerBeg + iiMeshlet;
+                    for (const IntermediateTriangle &tri : MeshletTriangles[iMeshlet])
                     {
-                        if (!Vertices[iVert].Visited)
+                        for (size_t iVert : tri.idx)
                         {
-                            Vertices[iVert].Visited = true;
-                            dbgVertexMeshletCount[iVert]++;
+                            if (!Vertices[iVert].Visited)
+                            {
+                                Vertices[iVert].Visited = true;
+                                dbgVertexMeshletCount[iVert]++;
+                            }
+                            ASSERT(dbgVertexMeshletCount[iVert] > 0);
                         }
-                        ASSERT(dbgVertexMeshletCount[iVert] > 0);
                     }
                 }
             }
         }
 
-        // Децимация
-        for (size_t iPart = 0; iPart < nParts; ++iPart)
-            DecimateSuperMeshlet(iLayer, partMeshlets[iPart]);
+        // Децимация: группы обрабатываются параллельно, затем результаты сливаются по порядку
+        // Пулы только растут, чтобы не терять ёмкость уже прогретых буферов
+        if (ThreadMeshlets.size() < ParallelThreadCount(Options.ThreadCount))
+            ThreadMeshlets.resize(ParallelThreadCount(Options.ThreadCount));
+        if (DecimatedGroups.size() < size_t(nParts))
+            DecimatedGroups.resize(nParts);
+        ParallelFor(nParts, Options.ThreadCount, [&](size_t iThread, size_t iPart) {
+            // С бюджетом ошибки обязательно упрощаем вдвое при любом размере группы, остальное --- по бюджету
+            size_t groupMaxTriangles = maxTriangles;
+            if (Options.ErrorBudget > 0.0f && nParts > 1)
+                groupMaxTriangles = std::max(maxTriangles, (partMeshlets[iPart].Size() + 1) / 2 * TARGET_PRIMITIVES);
+            DecimateSuperMeshlet(iLayer,
+                                 iPart,
+                                 partMeshlets[iPart],
+                                 groupMaxTriangles,
+                                 ThreadMeshlets[iThread],
+                                 DecimatedGroups[iPart]);
+        });
+        LayerRefinement = {};
+        LayerTrials     = Trials.Stats;
+        LayerGroupSize  = groupSize;
+        LayerGroupCount = nParts;
+        LayerQemStalls  = 0;
+        LayerClustered  = 0;
+        LayerStalled    = 0;
+        LayerOverTarget = 0;
+        for (size_t iPart = 0; iPart < size_t(nParts); ++iPart)
+            MergeSuperMeshlet(iLayer, partMeshlets[iPart], DecimatedGroups[iPart]);
 
         // Каждая часть становится двумя новыми мешлетами
         MeshletLayerOffsets.push_back(MeshletTriangles.PartCount());
+        return true;
+    }
 
-        if (LayerMeshletCount(iLayer + 1) >= LayerMeshletCount(iLayer))
-            return false;
+    // Строит следующий слой. Если он не меньше текущего, слой откатывается и строится
+    // заново с другой группировкой. Последняя неудачная попытка остаётся, как и без восстановления
+    bool PartitionMeshlets()
+    {
+        size_t iLayer    = MeshletLayerOffsets.size() - 2;
+        size_t nAttempts = Options.StallRecovery ? std::size(GROUPING_ATTEMPTS) : 1;
+
+        // Состояние до слоя, к которому возвращаемся при откате
+        size_t nVertices       = Vertices.size();
+        size_t nMeshletsTotal  = MeshletTriangles.PartCount();
+        double decimationError = DecimationError;
+        size_t nTraceWords     = TraceWords.size();
+
+        size_t nMeshlets   = LayerMeshletCount(iLayer);
+        bool   triedSingle = false;
+        bool   isBuilt     = false;
+        for (size_t iAttempt = 0; iAttempt < nAttempts; ++iAttempt)
+        {
+            const GroupingAttempt &attempt = GROUPING_ATTEMPTS[iAttempt];
 
-        return true;
+            // Одна группа на весь слой от затравки и размера группы не зависит, поэтому пробуем её один раз
+            idx_t groupSize = GroupSize(attempt);
+            bool  isSingle  = groupSize == 0 || (nMeshlets + groupSize - 1) / groupSize < 3;
+            if (isSingle && (triedSingle || nMeshlets > ROOT_GROUP_MAX_MESHLETS))
+                continue;
+            triedSingle = triedSingle || isSingle;
+
+            if (isBuilt)
+            {
+                MeshletLayerOffsets.pop_back();
+                Vertices.resize(nVertices);
+                MeshletTriangles.Truncate(nMeshletsTotal);
+                MeshletParentOffset.resize(nMeshletsTotal);
+                MeshletParentCount.resize(nMeshletsTotal);
+                MeshletError.resize(nMeshletsTotal);
+                MeshletAccumError.resize(nMeshletsTotal);
+                for (size_t iMeshlet = MeshletLayerOffsets[iLayer]; iMeshlet < MeshletLayerOffsets[iLayer + 1];
+                     ++iMeshlet)
+                {
+                    MeshletParentOffset[iMeshlet] = 0;
+                    MeshletParentCount[iMeshlet]  = 0;
+                }
+                DecimationError = decimationError;
+                TraceWords.resize(nTraceWords);
+            }
+
+            LayerAttempts = iAttempt + 1;
+            if (!BuildLayer(iLayer, attempt))
+                break;
+            isBuilt = true;
+            if (LayerMeshletCount(iLayer + 1) < LayerMeshletCount(iLayer))
+                return true;
+        }
+        LayerStopReason = isBuilt ? "layer did not shrink" : "too few meshlets to group";
+        return false;
     }
 
-    void DecimateSuperMeshlet(size_t iLayer, Slice<size_t> baseMeshlets)
+    // Выполняется в рабочем потоке: общие данные сетки здесь только читаются
+    void DecimateSuperMeshlet(size_t               iLayer,
+                              size_t               iGroup,
+                              Slice<size_t>        baseMeshlets,
+                              size_t               maxTriangles,
+                              IntermediateMeshlet &loc,
+                              DecimatedGroup      &result)
     {
         size_t layerBeg = MeshletLayerOffsets[iLayer];
-        size_t layerEnd = MeshletLayerOffsets[iLayer + 1];
 
-        // TODO: Квадрики
-        // TODO: Оптимизировать поиск граничных рёбер
-        IntermediateMeshlet loc;
-        loc.Init(Vertices, MeshletTriangles, baseMeshlets, layerBeg);
+        // Бюджет считается от ошибки, накопленной вдоль самого грубого пути от листьев до группы
+        float  childError = 0.0f;
+        size_t nTriangles = 0;
+        for (size_t iiMeshlet : baseMeshlets)
+        {
+            childError = std::max(childError, MeshletAccumError[layerBeg + iiMeshlet]);
+            nTriangles += MeshletTriangles.PartSize(layerBeg + iiMeshlet);
+        }
+
+        // Прогрев: буферы потока дорастают до группы, дальше децимация к куче не обращается
+        loc.Reserve(nTriangles);
+        size_t allocsStart = ThreadAllocationCount();
 
-        // Проверим, что правильно определили граничные вершины
-        for (size_t iLocVert = 0; iLocVert < loc.Vertices.size(); ++iLocVert)
+        loc.Engine       = Options.Engine;
+        loc.Placement    = Options.Placement;
+        loc.MaxTriangles = maxTriangles;
+        loc.BudgetTriangles = maxTriangles;
+        loc.ErrorBudget     = 0.0f;
+        if (Options.ErrorBudget > 0.0f)
         {
-            size_t iVert = loc.Vertices[iLocVert].OtherIndex;
-            // С плоской панелью некоторые вершины на границе мешлета
-            // не принадлежат другим мешлетам
-            // if (!loc.Vertices[iLocVert].IsBorder)
-            //     ASSERT_EQ(dbgVertexMeshletCount[iVert], 1);
+            float diagonal      = XMVectorGetX(XMVector3Length(BoxMax - BoxMin));
+            float limit         = Options.ErrorBudget * diagonal * Options.ErrorBudget * diagonal;
+            loc.BudgetTriangles = TARGET_PRIMITIVES;
+            loc.ErrorBudget     = std::max(limit - childError, 0.0f);
         }
+        loc.Trace.Start(!Options.TracePath.empty() && iGroup < Options.TraceGroups, Options.TraceCollapses);
+        loc.Init(Vertices, MeshletTriangles, baseMeshlets, layerBeg);
+        loc.TraceBegin(iLayer, iGroup);
 
         loc.Decimate();
+        result.QemStalled = loc.Triangles.size() > loc.MaxTriangles;
+        result.Clustered  = result.QemStalled && Options.StallRecovery && loc.ClusterDecimate();
+        result.Stalled    = loc.Triangles.size() > loc.MaxTriangles;
+        result.OverTarget = loc.BudgetCollapses > 0;
+        loc.Trace.End(loc.Triangles.size());
+
+        // Журнал растёт вместе с числом стягиваний, поэтому с ним выделения допустимы
+        size_t nAllocations = ThreadAllocationCount() - allocsStart;
+        if constexpr (ALLOCATIONS_COUNTED)
+            ASSERT_TEXT(loc.Trace.Enabled || nAllocations == 0, "Group decimation allocated memory after warm-up");
+
+        // Все граничные рёбра группы должны сохраниться, иначе на стыке с соседями появятся дыры.
+        // Исходная граница восстанавливается по глобальным треугольникам группы
+        if constexpr (VALIDATE_PARANOID)
+        {
+            IntermediateMeshlet source;
+            source.Init(Vertices, MeshletTriangles, baseMeshlets, layerBeg);
+            std::vector<MeshEdge> borderEdges;
+            std::vector<MeshEdge> edges;
+            source.CollectEdges(borderEdges, true);
+            loc.CollectEdges(edges, false);
+            ASSERT(std::includes(edges.begin(), edges.end(), borderEdges.begin(), borderEdges.end()));
+        }
+
+        // Результат копируется в слот группы, а буферы потока сохраняют ёмкость для следующей группы
+        result.Vertices.assign(loc.Vertices.begin(), loc.Vertices.end());
+        result.Triangles.assign(loc.Triangles.begin(), loc.Triangles.end());
+        result.TraceWords.swap(loc.Trace.Words);
+        result.TotalError = loc.TotalError;
+        result.AccumError = childError + loc.TotalError;
 
-        idx_t nvtxs  = loc.Triangles.size();
-        idx_t ncon   = 1;
+        // Повторное разбиение в счётчик не входит: METIS выделяет память внутри себя
+        idx_t nvtxs  = result.Triangles.size();
         idx_t nparts = (nvtxs + TARGET_PRIMITIVES - 1) / TARGET_PRIMITIVES;
         if (nvtxs <= MESHLET_MAX_PRIMITIVES)
             nparts = 1;
 
-        std::vector<idx_t> part(nvtxs, 0);
+        std::vector<idx_t> &part = result.TrianglePart;
+        part.assign(nvtxs, 0);
 
-        if (nparts > 1)
+        bool useRegions = Options.Partitioner == PartitionerKind::RegionGrowing;
+        bool useMorton  = Options.Partitioner == PartitionerKind::Morton;
+        if ((nparts > 1 && !useMorton) || useRegions)
         {
             // Разбиваем децимированный мешлет
-            EdgeIndicesMap<2> edgeTriangles = BuildTriangleEdgeIndex(loc.Triangles);
-
-            std::vector<idx_t> xadj;
-            xadj.reserve(nvtxs + 1);
-            xadj.push_back(0);
-
-            std::vector<idx_t> adjncy;
-            for (size_t iTriangle = 0; iTriangle < loc.Triangles.size(); ++iTriangle)
-            {
-                for (size_t iTriEdge = 0; iTriEdge < 3; ++iTriEdge)
-                {
-                    MeshEdge edge = loc.Triangles[iTriangle].EdgeKey(iTriEdge);
-                    auto    &vec  = edgeTriangles[edge];
-                    for (size_t jTriangle : vec)
-                    {
-                        if (jTriangle == iTriangle)
-                            continue;
-                        adjncy.push_back(jTriangle);
-                    }
-                }
-                xadj.push_back(adjncy.size());
-            }
-
-            idx_t options[METIS_NOPTIONS] = {};
-            METIS_SetDefaultOptions(options);
-            options[METIS_OPTION_NUMBERING] = 0;
+            PushTriangleEdges(loc.Adjacency, result.Triangles);
+            // Уже внутри параллельного цикла по группам, поэтому в один поток
+            loc.Adjacency.Build(false, 1, [](size_t) { return IDX_C(1); });
+        }
 
-            idx_t edgecut = 0;
+        result.Trials = {};
+        if (useRegions)
+        {
+            // Даже малой группе может понадобиться разбиение из-за ограничения на вершины
+            PushRegionTriangles(loc.Regions, result.Triangles, result.Vertices);
+            nparts = loc.Regions.Partition(
+                result.Vertices.size(), loc.Adjacency.Graph, MESHLET_MAX_PRIMITIVES, MESHLET_MAX_VERTICES, part);
+        }
+        else if (nparts > 1 && useMorton)
+        {
+            PushTriangleCentroids(loc.Morton.Centroids, result.Triangles, result.Vertices);
+            loc.Morton.Partition(BoxMin, BoxMax, nparts, 1, part);
+        }
+        else if (nparts > 1)
+        {
+            // Свободных потоков здесь нет, поэтому попытки идут по очереди
+            loc.Trials.TrialCount = Options.PartitionTrials;
+            loc.Trials.Objective  = Options.TrialObjective;
+            loc.Trials.Stats      = {};
+            PushTriangleItems(loc.Trials, result.Triangles);
+            loc.Trials.Partition(loc.Adjacency.Graph, false, nparts, -1, 1, part);
+            result.Trials = loc.Trials.Stats;
+        }
+        result.PartCount = nparts;
 
-            int metisResult = METIS_PartGraphKway(&nvtxs,
-                                                  &ncon,
-                                                  xadj.data(),
-                                                  adjncy.data(),
-                                                  /* vwgt */ nullptr,
-                                                  /* vsize */ nullptr,
-                                                  /* adjwgt */ nullptr,
-                                                  &nparts,
-                                                  /* tpwgts */ nullptr,
-                                                  /* ubvec */ nullptr,
-                                                  options,
-                                                  &edgecut,
-                                                  part.data());
-            ASSERT_EQ(metisResult, METIS_OK);
+        result.Refinement = {};
+        if (!useMorton && nparts > 1 && Options.RefinePasses > 0)
+        {
+            PushRefinerInput(loc.Refiner, result.Triangles, result.Vertices);
+            result.Refinement = loc.Refiner.Refine(loc.Adjacency.Graph,
+                                                   nparts,
+                                                   MESHLET_MAX_PRIMITIVES,
+                                                   MESHLET_MAX_VERTICES,
+                                                   Options.RefinePasses,
+                                                   part);
         }
+    }
+
+    // Переносит результат группы в общую сетку. Вызывается последовательно в порядке групп,
+    // поэтому нумерация новых вершин и мешлетов не зависит от числа потоков
+    void MergeSuperMeshlet(size_t iLayer, Slice<size_t> baseMeshlets, DecimatedGroup &result)
+    {
+        size_t layerBeg = MeshletLayerOffsets[iLayer];
+        idx_t  nvtxs    = result.Triangles.size();
+        idx_t  nparts   = result.PartCount;
 
-        for (IntermediateTriangle &tri : loc.Triangles)
+        for (IntermediateTriangle &tri : result.Triangles)
         {
             for (size_t iTriVert = 0; iTriVert < 3; ++iTriVert)
             {
                 size_t              iVert = tri.idx[iTriVert];
-                IntermediateVertex &vert  = loc.Vertices[iVert];
+                IntermediateVertex &vert  = result.Vertices[iVert];
                 if (!vert.Visited)
                 {
                     vert.Visited    = true;
@@ -1192,18 +2129,428 @@ struct IntermediateMesh
             MeshletParentCount[iMeshlet]  = nparts;
         }
 
-        SplitVector<size_t> triangleIdx(nparts, Slice(part));
+        DecimationError += result.TotalError;
+        LayerRefinement += result.Refinement;
+        LayerTrials += result.Trials;
+        LayerQemStalls += result.QemStalled;
+        LayerClustered += result.Clustered;
+        LayerStalled += result.Stalled;
+        LayerOverTarget += result.OverTarget;
+        TraceWords.insert(TraceWords.end(), result.TraceWords.begin(), result.TraceWords.end());
+
+        SplitVector<size_t> triangleIdx(nparts, Slice(result.TrianglePart));
         for (size_t iPart = 0; iPart < triangleIdx.PartCount(); ++iPart)
         {
             if (triangleIdx[iPart].Size() > MESHLET_MAX_PRIMITIVES)
                 std::cerr << "Decimation fail: size = " << triangleIdx[iPart].Size() << " out of " << nvtxs << " and "
                           << nparts << " parts\n";
             for (size_t iTriangle : triangleIdx[iPart])
-                MeshletTriangles.Push(loc.Triangles[iTriangle]);
+                MeshletTriangles.Push(result.Triangles[iTriangle]);
             MeshletTriangles.PushSplit();
             MeshletParentOffset.push_back(0);
             MeshletParentCount.push_back(0);
-            MeshletError.push_back(loc.TotalError);
+            MeshletError.push_back(result.TotalError);
+            MeshletAccumError.push_back(result.AccumError);
+        }
+    }
+
+    // Разрез считается по рёбрам сетки, а не графа мешлетов, чтобы разные разбиения были сравнимы
+    PartitionQuality MeasureLayer(size_t iLayer)
+    {
+        size_t layerBeg = MeshletLayerOffsets[iLayer];
+        size_t layerEnd = MeshletLayerOffsets[iLayer + 1];
+
+        PartitionQuality quality;
+
+        std::vector<KeyedSlot> edges;
+        std::vector<KeyedSlot> temp;
+        std::vector<size_t>    vertexStamp(Vertices.size(), 0);
+        std::vector<bool>      vertexInLayer(Vertices.size(), false);
+        for (size_t iMeshlet = layerBeg; iMeshlet < layerEnd; ++iMeshlet)
+        {
+            for (const IntermediateTriangle &tri : MeshletTriangles[iMeshlet])
+            {
+                for (size_t iTriEdge = 0; iTriEdge < 3; ++iTriEdge)
+                    edges.push_back({PackEdgeKey(tri.idx[iTriEdge], tri.idx[(iTriEdge + 1) % 3]), iMeshlet});
+                for (size_t iVert : tri.idx)
+                {
+                    if (vertexStamp[iVert] != iMeshlet + 1)
+                    {
+                        vertexStamp[iVert] = iMeshlet + 1;
+                        quality.MeshletVertices++;
+                    }
+                    if (!vertexInLayer[iVert])
+                    {
+                        vertexInLayer[iVert] = true;
+                        quality.UniqueVertices++;
+                    }
+                }
+            }
+        }
+
+        RadixSortByKey(edges, temp, Options.ThreadCount);
+        for (size_t beg = 0, end = 0; beg < edges.size(); beg = end)
+        {
+            bool isCut = false;
+            for (end = beg + 1; end < edges.size() && edges[end].Key == edges[beg].Key; ++end)
+                isCut = isCut || edges[end].Slot != edges[beg].Slot;
+            quality.EdgeCut += isCut;
+        }
+        return quality;
+    }
+
+    // Распознаёт регулярную сетку. С GridMode::Force отказ прерывает конвертацию
+    bool DetectGrid(bool verbose)
+    {
+        const char *reason = Grid.Detect(
+            Vertices.size(),
+            [&](size_t iVert) -> const float3 & { return Vertices[iVert].m.Position; },
+            Triangles.size(),
+            [&](size_t iTriangle) { return Triangles[iTriangle].idx; });
+        if (reason)
+        {
+            ASSERT_TEXT(Options.Grid != GridMode::Force, reason);
+            if (verbose)
+                std::cout << "Grid fast path skipped: " << reason << "\n";
+            return false;
+        }
+        if (verbose)
+            std::cout << "Grid fast path: " << Grid.Width << " x " << Grid.Height << " nodes, up axis " << Grid.UpAxis
+                      << "\n";
+        return true;
+    }
+
+    // Слой 0 --- квадраты по GRID_TILE_CELLS клеток с исходными треугольниками клеток
+    void DoGridFirstPartition()
+    {
+        int64_t nTilesX = (Grid.Width - 2) / GRID_TILE_CELLS + 1;
+        int64_t nTilesZ = (Grid.Height - 2) / GRID_TILE_CELLS + 1;
+
+        MeshletTriangles.Clear();
+        GridMeshletRects.clear();
+        for (int64_t iTileZ = 0; iTileZ < nTilesZ; ++iTileZ)
+        {
+            for (int64_t iTileX = 0; iTileX < nTilesX; ++iTileX)
+            {
+                GridRect rect = {};
+                rect.X0       = iTileX * GRID_TILE_CELLS;
+                rect.Z0       = iTileZ * GRID_TILE_CELLS;
+                rect.X1       = std::min(rect.X0 + GRID_TILE_CELLS, Grid.Width - 1);
+                rect.Z1       = std::min(rect.Z0 + GRID_TILE_CELLS, Grid.Height - 1);
+                for (int64_t z = rect.Z0; z < rect.Z1; ++z)
+                {
+                    for (int64_t x = rect.X0; x < rect.X1; ++x)
+                    {
+                        size_t iCell = size_t(z * (Grid.Width - 1) + x);
+                        MeshletTriangles.Push(Triangles[Grid.CellTriangles[2 * iCell]]);
+                        MeshletTriangles.Push(Triangles[Grid.CellTriangles[2 * iCell + 1]]);
+                    }
+                }
+                MeshletTriangles.PushSplit();
+                GridMeshletRects.push_back(rect);
+            }
+        }
+
+        size_t nMeshlets    = GridMeshletRects.size();
+        MeshletLayerOffsets = {0, nMeshlets};
+        MeshletParentOffset = std::vector<size_t>(nMeshlets, 0);
+        MeshletParentCount  = std::vector<size_t>(nMeshlets, 0);
+        MeshletError        = std::vector<float>(nMeshlets, 0.0f);
+        MeshletAccumError   = std::vector<float>(nMeshlets, 0.0f);
+    }
+
+    // Прореживает группу вдвое: клетки шага 2 * Step от начала группы, на заблокированных сторонах
+    // остаются все вершины мешлетов группы. Ошибка --- наибольший квадрат отклонения по высоте
+    // вершин мешлетов группы от новой поверхности
+    void DecimateGridGroup(size_t iLayer, int64_t iGroupX, int64_t iGroupZ, GridGroup &group)
+    {
+        GridLayerParams params(iLayer);
+        size_t          layerBeg = MeshletLayerOffsets[iLayer];
+        int64_t         step     = 2 * params.Step;
+        int64_t         nCells   = params.GroupSize() / step;
+        int64_t         originX  = params.Offset + iGroupX * params.GroupSize();
+        int64_t         originZ  = params.Offset + iGroupZ * params.GroupSize();
+
+        GridRect rect = {};
+        rect.X0       = std::max<int64_t>(originX, 0);
+        rect.Z0       = std::max<int64_t>(originZ, 0);
+        rect.X1       = std::min(originX + params.GroupSize(), Grid.Width - 1);
+        rect.Z1       = std::min(originZ + params.GroupSize(), Grid.Height - 1);
+
+        // Стороны группы в порядке TriangulateGridCell; край сетки не блокируется
+        std::array<bool, 4> isLocked = {rect.Z0 > 0, rect.X1 < Grid.Width - 1, rect.Z1 < Grid.Height - 1, rect.X0 > 0};
+
+        std::vector<size_t> memberVertices;
+        for (size_t iiMeshlet : group.Members)
+        {
+            for (const IntermediateTriangle &tri : MeshletTriangles[layerBeg + iiMeshlet])
+                memberVertices.insert(memberVertices.end(), tri.idx.begin(), tri.idx.end());
+        }
+        std::sort(memberVertices.begin(), memberVertices.end());
+        memberVertices.erase(std::unique(memberVertices.begin(), memberVertices.end()), memberVertices.end());
+
+        std::array<std::vector<int64_t>, 4> lockedCoords;
+        for (size_t iVert : memberVertices)
+        {
+            GridNode node = Grid.Node(iVert);
+            if (isLocked[0] && node.Z == rect.Z0)
+                lockedCoords[0].push_back(node.X);
+            if (isLocked[1] && node.X == rect.X1)
+                lockedCoords[1].push_back(node.Z);
+            if (isLocked[2] && node.Z == rect.Z1)
+                lockedCoords[2].push_back(node.X);
+            if (isLocked[3] && node.X == rect.X0)
+                lockedCoords[3].push_back(node.Z);
+        }
+        for (std::vector<int64_t> &coords : lockedCoords)
+            std::sort(coords.begin(), coords.end());
+
+        // Узлы заблокированной стороны строго между lo и hi
+        auto sideRange = [&](size_t iSide, int64_t lo, int64_t hi, std::vector<int64_t> &out) {
+            out.clear();
+            const std::vector<int64_t> &coords = lockedCoords[iSide];
+            auto beg = std::upper_bound(coords.begin(), coords.end(), lo);
+            auto end = std::lower_bound(coords.begin(), coords.end(), hi);
+            if (beg < end)
+                out.assign(beg, end);
+        };
+
+        std::vector<std::array<GridNode, 3>> cellTriangles;
+        std::vector<size_t>                  cellOffsets(nCells * nCells + 1, 0);
+        std::array<std::vector<int64_t>, 4>  sides;
+        std::vector<GridNode>                polygon;
+        for (auto &triangles : group.QuadrantTriangles)
+            triangles.clear();
+        for (int64_t iCellZ = 0; iCellZ < nCells; ++iCellZ)
+        {
+            for (int64_t iCellX = 0; iCellX < nCells; ++iCellX)
+            {
+                GridRect cell = {};
+                cell.X0       = std::max(originX + iCellX * step, rect.X0);
+                cell.Z0       = std::max(originZ + iCellZ * step, rect.Z0);
+                cell.X1       = std::min(originX + (iCellX + 1) * step, rect.X1);
+                cell.Z1       = std::min(originZ + (iCellZ + 1) * step, rect.Z1);
+
+                size_t iCell = size_t(iCellZ * nCells + iCellX);
+                size_t beg   = cellTriangles.size();
+                if (cell.X0 < cell.X1 && cell.Z0 < cell.Z1)
+                {
+                    sideRange(0, cell.X0, cell.Z0 == rect.Z0 ? cell.X1 : cell.X0, sides[0]);
+                    sideRange(1, cell.Z0, cell.X1 == rect.X1 ? cell.Z1 : cell.Z0, sides[1]);
+                    sideRange(2, cell.X0, cell.Z1 == rect.Z1 ? cell.X1 : cell.X0, sides[2]);
+                    sideRange(3, cell.Z0, cell.X0 == rect.X0 ? cell.Z1 : cell.Z0, sides[3]);
+                    TriangulateGridCell(cell, sides, polygon, cellTriangles);
+                }
+                cellOffsets[iCell + 1] = cellTriangles.size();
+
+                size_t iQuadrant = (iCellX >= nCells / 2) + 2 * (iCellZ >= nCells / 2);
+                for (size_t iTriangle = beg; iTriangle < cellTriangles.size(); ++iTriangle)
+                {
+                    IntermediateTriangle tri = {};
+                    for (size_t iTriVert = 0; iTriVert < 3; ++iTriVert)
+                        tri.idx[iTriVert] = Grid.Vertex(cellTriangles[iTriangle][iTriVert]);
+                    if (Grid.Clockwise)
+                        std::swap(tri.idx[1], tri.idx[2]);
+                    group.QuadrantTriangles[iQuadrant].push_back(tri);
+                }
+            }
+        }
+
+        for (size_t iQuadrant = 0; iQuadrant < 4; ++iQuadrant)
+        {
+            int64_t   half = params.GroupSize() / 2;
+            GridRect &quad = group.QuadrantRects[iQuadrant];
+            quad.X0        = std::max(originX + half * int64_t(iQuadrant % 2), rect.X0);
+            quad.Z0        = std::max(originZ + half * int64_t(iQuadrant / 2), rect.Z0);
+            quad.X1        = std::min(originX + half * int64_t(iQuadrant % 2 + 1), rect.X1);
+            quad.Z1        = std::min(originZ + half * int64_t(iQuadrant / 2 + 1), rect.Z1);
+            ASSERT_CHEAP(group.QuadrantTriangles[iQuadrant].size() <= MESHLET_MAX_PRIMITIVES);
+        }
+
+        // Высота в вершине ищется по клетке и целочисленным барицентрическим координатам в её треугольниках.
+        // Узел на дальнем краю группы относится к клетке перед ним: следующая могла обрезаться до пустой
+        group.TotalError = 0.0f;
+        for (size_t iVert : memberVertices)
+        {
+            GridNode node   = Grid.Node(iVert);
+            int64_t  iCellX = (std::min(node.X, rect.X1 - 1) - originX) / step;
+            int64_t  iCellZ = (std::min(node.Z, rect.Z1 - 1) - originZ) / step;
+            size_t   iCell  = size_t(iCellZ * nCells + iCellX);
+            bool     found  = false;
+            for (size_t iTriangle = cellOffsets[iCell]; iTriangle < cellOffsets[iCell + 1] && !found; ++iTriangle)
+            {
+                const std::array<GridNode, 3> &tri = cellTriangles[iTriangle];
+
+                int64_t w0 = GridCross(tri[1], tri[2], node);
+                int64_t w1 = GridCross(tri[2], tri[0], node);
+                int64_t w2 = GridCross(tri[0], tri[1], node);
+                if (w0 < 0 || w1 < 0 || w2 < 0)
+                    continue;
+                found = true;
+
+                double elevation = 0.0;
+                for (size_t iTriVert = 0; iTriVert < 3; ++iTriVert)
+                {
+                    int64_t w = iTriVert == 0 ? w0 : iTriVert == 1 ? w1 : w2;
+                    elevation += double(w) * Grid.Elevation(Vertices[Grid.Vertex(tri[iTriVert])].m.Position);
+                }
+                elevation /= double(w0 + w1 + w2);
+                double deviation = Grid.Elevation(Vertices[iVert].m.Position) - elevation;
+                group.TotalError = std::max(group.TotalError, float(deviation * deviation));
+            }
+            ASSERT_TEXT(found, "Grid vertex is outside of its group");
+        }
+    }
+
+    // Группирует мешлеты последнего слоя по квадратам GRID_GROUP_TILES x GRID_GROUP_TILES и прореживает группы.
+    // Возвращает число групп
+    size_t BuildGridLayer(size_t iLayer)
+    {
+        GridLayerParams params(iLayer);
+        size_t          layerBeg  = MeshletLayerOffsets[iLayer];
+        size_t          nMeshlets = LayerMeshletCount(iLayer);
+
+        // По середине мешлета: его края могут совпадать с краями соседних групп
+        int64_t minGroupX = params.GroupIndex(0);
+        int64_t minGroupZ = params.GroupIndex(0);
+        int64_t nGroupsX  = params.GroupIndex(Grid.Width - 1) - minGroupX + 1;
+        int64_t nGroupsZ  = params.GroupIndex(Grid.Height - 1) - minGroupZ + 1;
+
+        std::vector<size_t> meshletGroup(nMeshlets);
+        for (size_t iiMeshlet = 0; iiMeshlet < nMeshlets; ++iiMeshlet)
+        {
+            const GridRect &rect   = GridMeshletRects[layerBeg + iiMeshlet];
+            int64_t         groupX = params.GroupIndex((rect.X0 + rect.X1) / 2) - minGroupX;
+            int64_t         groupZ = params.GroupIndex((rect.Z0 + rect.Z1) / 2) - minGroupZ;
+            meshletGroup[iiMeshlet] = size_t(groupZ * nGroupsX + groupX);
+        }
+        SplitVector<size_t> groupMeshlets(size_t(nGroupsX * nGroupsZ), Slice(meshletGroup));
+
+        std::vector<size_t> groupIds;
+        for (size_t iGroup = 0; iGroup < groupMeshlets.PartCount(); ++iGroup)
+        {
+            if (groupMeshlets.PartSize(iGroup) > 0)
+                groupIds.push_back(iGroup);
+        }
+        if (GridGroups.size() < groupIds.size())
+            GridGroups.resize(groupIds.size());
+
+        ParallelFor(groupIds.size(), Options.ThreadCount, [&](size_t, size_t iiGroup) {
+            size_t     iGroup = groupIds[iiGroup];
+            GridGroup &group  = GridGroups[iiGroup];
+            group.Members.assign(groupMeshlets[iGroup].begin(), groupMeshlets[iGroup].end());
+            DecimateGridGroup(iLayer,
+                              int64_t(iGroup % nGroupsX) + minGroupX,
+                              int64_t(iGroup / nGroupsX) + minGroupZ,
+                              group);
+        });
+
+        // Слияние по порядку групп, как в MergeSuperMeshlet
+        for (size_t iiGroup = 0; iiGroup < groupIds.size(); ++iiGroup)
+        {
+            GridGroup &group      = GridGroups[iiGroup];
+            size_t     nParents   = 0;
+            float      childError = 0.0f;
+            for (const auto &triangles : group.QuadrantTriangles)
+                nParents += !triangles.empty();
+            for (size_t iiMeshlet : group.Members)
+            {
+                MeshletParentOffset[layerBeg + iiMeshlet] = MeshletTriangles.PartCount();
+                MeshletParentCount[layerBeg + iiMeshlet]  = nParents;
+            }
+            for (size_t iiMeshlet : group.Members)
+                childError = std::max(childError, MeshletAccumError[layerBeg + iiMeshlet]);
+            for (size_t iQuadrant = 0; iQuadrant < 4; ++iQuadrant)
+            {
+                if (group.QuadrantTriangles[iQuadrant].empty())
+                    continue;
+                for (const IntermediateTriangle &tri : group.QuadrantTriangles[iQuadrant])
+                    MeshletTriangles.Push(tri);
+                MeshletTriangles.PushSplit();
+                MeshletParentOffset.push_back(0);
+                MeshletParentCount.push_back(0);
+                MeshletError.push_back(group.TotalError);
+                MeshletAccumError.push_back(childError + group.TotalError);
+                GridMeshletRects.push_back(group.QuadrantRects[iQuadrant]);
+            }
+            DecimationError += group.TotalError;
+        }
+        MeshletLayerOffsets.push_back(MeshletTriangles.PartCount());
+        return groupIds.size();
+    }
+
+    // Иерархия регулярной сетки: слой 0 из квадратов, затем слои до единственного мешлета.
+    // Граница группы всегда лежит на средней линии групп предыдущего слоя, поэтому мешлеты не растут
+    void BuildGridHierarchy(bool verbose)
+    {
+        constexpr size_t GRID_MAX_LAYERS = 64;
+
+        DoGridFirstPartition();
+        for (size_t i = 0; LayerMeshletCount(i) > 1; ++i)
+        {
+            ASSERT_TEXT(i < GRID_MAX_LAYERS, "Grid hierarchy does not converge");
+            size_t nGroups = BuildGridLayer(i);
+            if (verbose)
+                std::cout << "Grid layer " << i << ": " << LayerMeshletCount(i) << " meshlets, " << nGroups
+                          << " groups, step " << GridLayerParams(i).Step << "\n";
+        }
+        if (verbose)
+        {
+            std::cout << "Root meshlets: " << LayerMeshletCount(MeshletLayerOffsets.size() - 2) << "\n";
+            std::cout << "Layers: " << MeshletLayerOffsets.size() - 1 << ", meshlets: " << MeshletTriangles.PartCount()
+                      << "\n";
+        }
+    }
+
+    // Первое разбиение и все слои децимации
+    void BuildHierarchy(bool verbose = true)
+    {
+        if (Options.Grid != GridMode::Off && DetectGrid(verbose))
+        {
+            BuildGridHierarchy(verbose);
+            return;
+        }
+
+        DoFirstPartition();
+        if (verbose && FirstChunkCount > 0)
+            std::cout << "First partition chunks: " << FirstChunkCount << "\n";
+        if (verbose && Options.RefinePasses > 0)
+            PrintRefinement(FirstRefinement);
+        if (verbose && Options.PartitionTrials > 1)
+            PrintPartitionTrials(FirstTrials, Options.TrialObjective);
+        for (size_t i = 0;; ++i)
+        {
+            if (verbose)
+            {
+                std::cout << "Partitioning layer " << i << "...\n";
+                std::cout << "\tCurrent meshlets: " << LayerMeshletCount(i) << "\n";
+            }
+            if (!PartitionMeshlets())
+            {
+                if (verbose)
+                    std::cout << "\tStopped after " << LayerAttempts << " attempts: " << LayerStopReason << "\n";
+                break;
+            }
+            if (verbose)
+            {
+                std::cout << "\tGroups: " << LayerGroupCount << " of up to " << LayerGroupSize << " meshlets, attempt "
+                          << LayerAttempts << "\n";
+                std::cout << "\tQEM stalls: " << LayerQemStalls << ", clustered: " << LayerClustered
+                          << ", still over target: " << LayerStalled << "\n";
+                if (Options.ErrorBudget > 0.0f)
+                    std::cout << "\tSimplified past target within error budget: " << LayerOverTarget << "\n";
+                if (Options.RefinePasses > 0)
+                    PrintRefinement(LayerRefinement);
+                if (Options.PartitionTrials > 1)
+                    PrintPartitionTrials(LayerTrials, Options.TrialObjective);
+                std::cout << "Partitioning layer " << i << " done\n";
+            }
+        }
+        if (verbose)
+        {
+            std::cout << "Root meshlets: " << LayerMeshletCount(MeshletLayerOffsets.size() - 2) << "\n";
+            std::cout << "Layers: " << MeshletLayerOffsets.size() - 1 << ", meshlets: " << MeshletTriangles.PartCount()
+                      << "\n";
         }
     }
 
@@ -1290,6 +2637,15 @@ struct IntermediateMesh
         outModel.Vertices.resize(Vertices.size());
         for (size_t iVert = 0; iVert < Vertices.size(); ++iVert)
             outModel.Vertices[iVert] = Vertices[iVert].m;
+
+        outModel.BuildGroups();
+        outModel.BuildLods();
+        outModel.BuildCullData();
+        outModel.BuildHierarchyBounds(Options.ThreadCount);
+        if (Options.QuantizeVertices)
+            outModel.BuildQuantizedVertices(Options.ThreadCount);
+        if (Options.PrimitiveEncoding != 0)
+            outModel.EncodePrimitives(Options.PrimitiveEncoding, Options.ThreadCount);
     }
 
     void dbgSaveAsObj(const std::filesystem::path &path)
@@ -1316,9 +2672,590 @@ struct IntermediateMesh
     }
 };
 
-int main()
+// Если аргумент имеет вид "<prefix><значение>", возвращает значение
+static bool MatchOption(std::string_view arg, std::string_view prefix, std::string_view &value)
+{
+    if (arg.substr(0, prefix.size()) != prefix)
+        return false;
+    value = arg.substr(prefix.size());
+    return true;
+}
+
+// Неотрицательное целое без знака и лишних символов. std::stoul сам принимает "-1" и переворачивает его
+// в огромное число, поэтому первый символ обязан быть цифрой
+static size_t ParseCount(std::string_view value)
+{
+    if (value.empty() || !std::isdigit(static_cast<unsigned char>(value[0])))
+        throw std::invalid_argument("Expected a non-negative integer");
+    size_t             end    = 0;
+    unsigned long long number = std::stoull(std::string(value), &end);
+    if (end != value.size())
+        throw std::invalid_argument("Expected a non-negative integer");
+    return size_t(number);
+}
+
+static float ParseFloat(std::string_view value)
+{
+    size_t end    = 0;
+    float  number = std::stof(std::string(value), &end);
+    if (end != value.size())
+        throw std::invalid_argument("Expected a number");
+    return number;
+}
+
+// Разбирает один аргумент; false, если он не распознан. ParseCount и ParseFloat на неверном вводе
+// бросают исключение
+static bool ParseOption(std::string_view arg, ConverterOptions &options)
+{
+    std::string_view value = {};
+    if (MatchOption(arg, "--threads=", value))
+        options.ThreadCount = ParseCount(value);
+    else if (arg == "--engine=greedy")
+        options.Engine = DecimationEngine::Greedy;
+    else if (arg == "--engine=heap")
+        options.Engine = DecimationEngine::Heap;
+    else if (arg == "--placement=endpoints")
+        options.Placement = PlacementStrategy::Endpoints;
+    else if (arg == "--placement=optimal")
+        options.Placement = PlacementStrategy::Optimal;
+    else if (arg == "--partitioner=metis")
+        options.Partitioner = PartitionerKind::Metis;
+    else if (arg == "--partitioner=regions")
+        options.Partitioner = PartitionerKind::RegionGrowing;
+    else if (arg == "--partitioner=morton")
+        options.Partitioner = PartitionerKind::Morton;
+    else if (arg == "--bench-partition")
+        options.BenchPartition = true;
+    else if (arg == "--bench-placement")
+        options.BenchPlacement = true;
+    else if (arg == "--bench-budget")
+        options.BenchBudget = true;
+    else if (arg == "--bench-culling")
+        options.BenchCulling = true;
+    else if (arg == "--quantize-vertices")
+        options.QuantizeVertices = true;
+    else if (arg == "--primitive-encoding=packed10")
+        options.PrimitiveEncoding = PrimitiveEncodingBit(PrimitiveEncoding::Packed10);
+    else if (arg == "--primitive-encoding=packed8")
+        options.PrimitiveEncoding = PrimitiveEncodingBit(PrimitiveEncoding::Packed8);
+    else if (arg == "--primitive-encoding=strip")
+        options.PrimitiveEncoding = PrimitiveEncodingBit(PrimitiveEncoding::Strip);
+    else if (arg == "--primitive-encoding=auto")
+        options.PrimitiveEncoding = PRIMITIVE_ENCODING_GPU;
+    else if (arg == "--grid=auto")
+        options.Grid = GridMode::Auto;
+    else if (arg == "--grid=off")
+        options.Grid = GridMode::Off;
+    else if (arg == "--grid=force")
+        options.Grid = GridMode::Force;
+    else if (MatchOption(arg, "--error-budget=", value))
+        options.ErrorBudget = ParseFloat(value);
+    else if (MatchOption(arg, "--refine-passes=", value))
+        options.RefinePasses = ParseCount(value);
+    else if (MatchOption(arg, "--spatial-neighbours=", value))
+        options.SpatialNeighbours = ParseCount(value);
+    else if (MatchOption(arg, "--first-chunk=", value))
+        options.FirstChunkSize = ParseCount(value);
+    else if (arg == "--stall-recovery=on")
+        options.StallRecovery = true;
+    else if (arg == "--stall-recovery=off")
+        options.StallRecovery = false;
+    else if (MatchOption(arg, "--partition-trials=", value))
+        options.PartitionTrials = std::max<size_t>(ParseCount(value), 1);
+    else if (arg == "--partition-objective=edgecut")
+        options.TrialObjective = PartitionObjective::EdgeCut;
+    else if (arg == "--partition-objective=maxpart")
+        options.TrialObjective = PartitionObjective::MaxPart;
+    else if (arg == "--partition-objective=duplicated")
+        options.TrialObjective = PartitionObjective::Duplicated;
+    else if (MatchOption(arg, "--trace=", value))
+        options.TracePath = value;
+    else if (MatchOption(arg, "--trace-groups=", value))
+        options.TraceGroups = ParseCount(value);
+    else if (MatchOption(arg, "--trace-collapses=", value))
+        options.TraceCollapses = ParseCount(value);
+    else if (MatchOption(arg, "--replay-trace=", value))
+        options.ReplayTracePath = value;
+    else if (MatchOption(arg, "--replay-dir=", value))
+        options.ReplayDir = value;
+    else if (MatchOption(arg, "--replay-step=", value))
+        options.ReplayStep = ParseCount(value);
+    else if (MatchOption(arg, "--inspect-model=", value))
+        options.InspectModelPath = value;
+    else
+        return false;
+    return true;
+}
+
+static bool ParseOptions(int argc, char **argv, ConverterOptions &options)
+{
+    for (int iArg = 1; iArg < argc; ++iArg)
+    {
+        std::string_view arg     = argv[iArg];
+        bool             isKnown = false;
+        try
+        {
+            isKnown = ParseOption(arg, options);
+        }
+        catch (const std::logic_error &)
+        {
+            // std::invalid_argument и std::out_of_range из разбора чисел
+            isKnown = false;
+        }
+        if (!isKnown)
+        {
+            std::cerr << "Unknown argument: " << arg << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Обход по группам с порогом только по ошибке должен выбрать те же мешлеты, что и проверка каждого
+// мешлета в отдельности: ошибка его группы больше порога, а группы, из которой он получен, --- нет.
+// Возвращает число порогов, на которых разрезы разошлись
+static size_t CheckGroupTraversal(const TMeshletModelCPU &model)
+{
+    size_t            nMeshlets = model.Meshlets.size();
+    std::vector<uint> memberGroup(nMeshlets, MESHLET_NO_GROUP);
+    std::vector<float> errors;
+    for (uint iGroup = 0; iGroup < model.Groups.size(); ++iGroup)
+    {
+        const TMeshletGroup &group = model.Groups[iGroup];
+        for (uint i = group.MeshletOffset; i < group.MeshletOffset + group.MeshletCount; ++i)
+            memberGroup[model.GroupMeshlets[i]] = iGroup;
+        errors.push_back(group.Error);
+    }
+    std::sort(errors.begin(), errors.end());
+    errors.push_back(INFINITY);
+
+    size_t            nMismatches = 0;
+    std::vector<uint> traversed;
+    std::vector<uint> expected;
+    for (size_t iQuantile = 0; iQuantile <= 4; ++iQuantile)
+    {
+        float threshold = errors[iQuantile * (errors.size() - 1) / 4];
+        auto  isEnough  = [&](float error) { return error <= threshold; };
+        model.TraverseGroups([](const TBoundingBox &) { return false; },
+                             [&](float error, const TBoundingBox &) { return isEnough(error); },
+                             traversed);
+
+        expected.clear();
+        for (uint iMeshlet = 0; iMeshlet < nMeshlets; ++iMeshlet)
+        {
+            uint iGroup  = memberGroup[iMeshlet];
+            uint iSource = model.MeshletSourceGroup[iMeshlet];
+            bool isFine  = iSource == MESHLET_NO_GROUP || isEnough(model.Groups[iSource].Error);
+            bool isCoarseEnough = iGroup != MESHLET_NO_GROUP && isEnough(model.Groups[iGroup].Error);
+            if (isFine && !isCoarseEnough)
+                expected.push_back(iMeshlet);
+        }
+        std::sort(traversed.begin(), traversed.end());
+        nMismatches += traversed != expected;
+    }
+    return nMismatches;
+}
+
+// Строит иерархию с каждой стратегией размещения и сравнивает суммарную ошибку и число треугольников по слоям
+static void RunPlacementBenchmark(const IntermediateMesh &source)
+{
+    const std::pair<PlacementStrategy, const char *> strategies[] = {
+        {PlacementStrategy::Endpoints, "endpoints"},
+        {PlacementStrategy::Optimal,   "optimal"  },
+    };
+
+    for (const auto &[placement, name] : strategies)
+    {
+        IntermediateMesh mesh  = source;
+        mesh.Options.Placement = placement;
+
+        auto beforeTS = std::chrono::steady_clock::now();
+        mesh.BuildHierarchy(false);
+        auto afterTS = std::chrono::steady_clock::now();
+
+        std::chrono::duration<double> duration{afterTS - beforeTS};
+        size_t                        nLayers = mesh.MeshletLayerOffsets.size() - 1;
+
+        std::cout << "Placement " << name << ":\n"
+                  << "\tTime        : " << duration.count() << " s\n"
+                  << "\tLayers      : " << nLayers << "\n"
+                  << "\tTotal error : " << mesh.DecimationError << "\n";
+
+        size_t nTrianglesTotal = 0;
+        for (size_t iLayer = 0; iLayer < nLayers; ++iLayer)
+        {
+            size_t nTriangles = 0;
+            float  maxError   = 0.0f;
+            for (size_t iMeshlet = mesh.MeshletLayerOffsets[iLayer]; iMeshlet < mesh.MeshletLayerOffsets[iLayer + 1];
+                 ++iMeshlet)
+            {
+                nTriangles += mesh.MeshletTriangles.PartSize(iMeshlet);
+                maxError = std::max(maxError, mesh.MeshletError[iMeshlet]);
+            }
+            nTrianglesTotal += nTriangles;
+            std::cout << "\tLayer " << iLayer << ": meshlets = " << mesh.LayerMeshletCount(iLayer)
+                      << ", triangles = " << nTriangles << ", max meshlet error = " << maxError << "\n";
+        }
+        std::cout << "\tTriangles in all layers: " << nTrianglesTotal << "\n";
+    }
+}
+
+// Строит иерархию с постоянным упрощением вдвое и с бюджетом ошибки и сравнивает глубину и число мешлетов
+static void RunBudgetBenchmark(const IntermediateMesh &source)
+{
+    const float budgets[] = {0.0f, source.Options.ErrorBudget > 0.0f ? source.Options.ErrorBudget : 0.01f};
+
+    for (float budget : budgets)
+    {
+        IntermediateMesh mesh    = source;
+        mesh.Options.ErrorBudget = budget;
+
+        auto beforeTS = std::chrono::steady_clock::now();
+        mesh.BuildHierarchy(false);
+        auto afterTS = std::chrono::steady_clock::now();
+
+        std::chrono::duration<double> duration{afterTS - beforeTS};
+        size_t                        nLayers = mesh.MeshletLayerOffsets.size() - 1;
+
+        // Бюджет ограничивает ошибку, накопленную от листьев, поэтому и сравнивается она
+        float maxError = 0.0f;
+        for (float error : mesh.MeshletAccumError)
+            maxError = std::max(maxError, error);
+
+        if (budget > 0.0f)
+            std::cout << "Error budget " << budget << ":\n";
+        else
+            std::cout << "Fixed ratio:\n";
+        std::cout << "\tTime              : " << duration.count() << " s\n"
+                  << "\tLayers            : " << nLayers << "\n"
+                  << "\tMeshlets          : " << mesh.MeshletTriangles.PartCount() << "\n"
+                  << "\tRoot meshlets     : " << mesh.LayerMeshletCount(nLayers - 1) << "\n"
+                  << "\tMax accum error   : " << maxError << "\n"
+                  << "\tTotal error       : " << mesh.DecimationError << "\n";
+    }
+}
+
+// Строит иерархию с METIS и с порядком Мортона и сообщает выигрыш по времени и потерю качества
+static void RunPartitionBenchmark(const IntermediateMesh &source)
+{
+    const PartitionerKind partitioners[] = {PartitionerKind::Metis, PartitionerKind::Morton};
+
+    double           durations[2] = {};
+    PartitionQuality firstLayer[2];
+    PartitionQuality allLayers[2];
+    for (size_t iRun = 0; iRun < 2; ++iRun)
+    {
+        IntermediateMesh mesh    = source;
+        mesh.Options.Partitioner = partitioners[iRun];
+
+        auto beforeTS = std::chrono::steady_clock::now();
+        mesh.BuildHierarchy(false);
+        auto afterTS = std::chrono::steady_clock::now();
+
+        std::chrono::duration<double> duration{afterTS - beforeTS};
+        size_t                        nLayers = mesh.MeshletLayerOffsets.size() - 1;
+
+        durations[iRun]  = duration.count();
+        firstLayer[iRun] = mesh.MeasureLayer(0);
+        for (size_t iLayer = 0; iLayer < nLayers; ++iLayer)
+            allLayers[iRun] += mesh.MeasureLayer(iLayer);
+
+        std::cout << "Partitioner " << PartitionerName(partitioners[iRun]) << ":\n"
+                  << "\tTime                 : " << durations[iRun] << " s\n"
+                  << "\tLayers               : " << nLayers << "\n"
+                  << "\tMeshlets             : " << mesh.MeshletTriangles.PartCount() << "\n"
+                  << "\tLayer 0 edge cut     : " << firstLayer[iRun].EdgeCut << "\n"
+                  << "\tLayer 0 duplicated   : " << firstLayer[iRun].DuplicatedVertices() << " of "
+                  << firstLayer[iRun].UniqueVertices << " vertices\n"
+                  << "\tAll layers edge cut  : " << allLayers[iRun].EdgeCut << "\n"
+                  << "\tAll layers duplicated: " << allLayers[iRun].DuplicatedVertices() << "\n";
+    }
+
+    auto ratio = [](double num, double den) { return den > 0.0 ? num / den : 0.0; };
+    std::cout << "Morton vs METIS:\n"
+              << "\tSpeedup                    : " << ratio(durations[0], durations[1]) << "x\n"
+              << "\tLayer 0 edge cut ratio     : "
+              << ratio(double(firstLayer[1].EdgeCut), double(firstLayer[0].EdgeCut)) << "\n"
+              << "\tLayer 0 duplicated ratio   : "
+              << ratio(double(firstLayer[1].DuplicatedVertices()), double(firstLayer[0].DuplicatedVertices())) << "\n"
+              << "\tAll layers edge cut ratio  : " << ratio(double(allLayers[1].EdgeCut), double(allLayers[0].EdgeCut))
+              << "\n"
+              << "\tAll layers duplicated ratio: "
+              << ratio(double(allLayers[1].DuplicatedVertices()), double(allLayers[0].DuplicatedVertices())) << "\n";
+}
+
+// Отсекает полную детализацию модели с камер вокруг неё, сравнивает скалярное ядро с SSE
+// и сообщает, какая доля мешлетов отброшена пирамидой видимости и конусами нормалей
+static void RunCullingBenchmark(const TMeshletModelCPU &model)
+{
+    constexpr size_t N_VIEWS       = 64;
+    constexpr size_t N_REPETITIONS = 256;
+
+    std::vector<TMeshletCullData> culling;
+    for (uint iMeshlet = 0; iMeshlet < model.Meshlets.size(); ++iMeshlet)
+    {
+        if (model.MeshletSourceGroup[iMeshlet] == MESHLET_NO_GROUP)
+            culling.push_back(model.MeshletCulling[iMeshlet]);
+    }
+    size_t nMeshlets = culling.size();
+    if (nMeshlets == 0)
+        return;
+
+    float3 boxMin = culling[0].Center;
+    float3 boxMax = culling[0].Center;
+    for (const TMeshletCullData &cull : culling)
+    {
+        boxMin = float3(std::min(boxMin.x, cull.Center.x - cull.Radius),
+                        std::min(boxMin.y, cull.Center.y - cull.Radius),
+                        std::min(boxMin.z, cull.Center.z - cull.Radius));
+        boxMax = float3(std::max(boxMax.x, cull.Center.x + cull.Radius),
+                        std::max(boxMax.y, cull.Center.y + cull.Radius),
+                        std::max(boxMax.z, cull.Center.z + cull.Radius));
+    }
+    XMVECTOR center = 0.5f * (XMLoadFloat3(&boxMin) + XMLoadFloat3(&boxMax));
+    float    radius = 0.5f * XMVectorGetX(XMVector3Length(XMLoadFloat3(&boxMax) - XMLoadFloat3(&boxMin)));
+
+    std::vector<uint8_t> scalarResult(nMeshlets);
+    std::vector<uint8_t> batchResult(nMeshlets);
+    size_t               nFrustum    = 0;
+    size_t               nBackface   = 0;
+    size_t               nVisible    = 0;
+    size_t               nMismatches = 0;
+    double               scalarTime  = 0.0;
+    double               batchTime   = 0.0;
+    size_t               checksum    = 0;
+    for (size_t iView = 0; iView < N_VIEWS; ++iView)
+    {
+        // Точки спирали Фибоначчи на сфере. Чётные камеры ближе и с узким углом обзора,
+        // чтобы большая часть модели оказывалась за кадром
+        bool     isClose  = iView % 2 == 0;
+        float    y        = 1.0f - 2.0f * (iView + 0.5f) / N_VIEWS;
+        float    ring     = std::sqrt(1.0f - y * y);
+        bool     isPolar  = std::abs(y) > 0.9f;
+        float    phi      = 2.39996323f * iView;
+        float    distance = (isClose ? 1.2f : 3.0f) * radius;
+        float    fovY     = isClose ? XM_PI / 12 : XM_PI / 4;
+        XMVECTOR eye      = center + distance * XMVectorSet(ring * std::cos(phi), y, ring * std::sin(phi), 0.0f);
+        XMVECTOR up       = isPolar ? XMVectorSet(1.0f, 0.0f, 0.0f, 0.0f) : XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
+        XMMATRIX proj     = XMMatrixPerspectiveFovRH(fovY, 16.0f / 9.0f, 0.01f * radius, 10.0f * radius);
+        XMMATRIX viewProj = XMMatrixMultiply(XMMatrixLookAtRH(eye, center, up), proj);
+        float3   eyePos;
+        XMStoreFloat3(&eyePos, eye);
+        TCullView view = MakeCullView(viewProj, eyePos);
+
+        auto beforeScalarTS = std::chrono::steady_clock::now();
+        for (size_t iRep = 0; iRep < N_REPETITIONS; ++iRep)
+        {
+            for (size_t iMeshlet = 0; iMeshlet < nMeshlets; ++iMeshlet)
+                scalarResult[iMeshlet] = uint8_t(CullMeshlet(view, culling[iMeshlet]));
+            checksum += scalarResult[iRep % nMeshlets];
+        }
+        auto beforeBatchTS = std::chrono::steady_clock::now();
+        for (size_t iRep = 0; iRep < N_REPETITIONS; ++iRep)
+            checksum += CullMeshletBatch(view, culling.data(), batchResult.data(), nMeshlets);
+        auto afterBatchTS = std::chrono::steady_clock::now();
+
+        scalarTime += std::chrono::duration<double>(beforeBatchTS - beforeScalarTS).count();
+        batchTime += std::chrono::duration<double>(afterBatchTS - beforeBatchTS).count();
+        nMismatches += scalarResult != batchResult;
+        for (uint8_t result : batchResult)
+        {
+            if (result & MESHLET_CULL_FRUSTUM)
+                nFrustum++;
+            else if (result & MESHLET_CULL_BACKFACE)
+                nBackface++;
+            else
+                nVisible++;
+        }
+    }
+
+    double nTests  = double(N_VIEWS * N_REPETITIONS * nMeshlets);
+    auto   percent = [&](size_t count) { return 100.0 * count / double(N_VIEWS * nMeshlets); };
+    std::cout << "Culling " << nMeshlets << " leaf meshlets from " << N_VIEWS << " views:\n"
+              << "\tFrustum culled  : " << percent(nFrustum) << " %\n"
+              << "\tBackface culled : " << percent(nBackface) << " %\n"
+              << "\tVisible         : " << percent(nVisible) << " %\n"
+              << "\tScalar          : " << 1e9 * scalarTime / nTests << " ns/meshlet\n"
+              << "\tSSE             : " << 1e9 * batchTime / nTests << " ns/meshlet\n"
+              << "\t(checksum " << checksum << ")\n";
+    if (nMismatches > 0)
+        std::cout << "SSE culling differs from scalar in " << nMismatches << " views\n";
+}
+
+// Распаковывает сжатые вершины и печатает экономию памяти и точность: ошибку позиций относительно
+// допусков мешлетов, угол нормалей и расхождения скалярного декодера с SSE. Размер несжатого потока ---
+// то, что загружается на GPU: по TVertex на каждый элемент GlobalIndices.
+// Возвращает число нарушений: вершин за допуском, расхождений декодеров и мешлетов с допуском больше ошибки
+static size_t ReportVertexQuantization(const TMeshletModelCPU &model, size_t nThreads)
+{
+    size_t nVertices  = model.QuantizedVertices.size();
+    size_t plainBytes = nVertices * sizeof(TVertex);
+    size_t quantBytes = nVertices * sizeof(TQuantizedVertex)
+                      + model.MeshletQuantization.size() * sizeof(TVertexQuantization);
+
+    auto                beforeTS = std::chrono::steady_clock::now();
+    TQuantizationReport report   = model.ValidateQuantizedVertices(nThreads);
+    auto                afterTS  = std::chrono::steady_clock::now();
+
+    std::cout << "Quantized vertices: " << nVertices << "\n"
+              << "\tBytes              : " << plainBytes << " -> " << quantBytes << " ("
+              << double(plainBytes) / double(std::max<size_t>(quantBytes, 1)) << "x)\n"
+              << "\tMax position error : " << report.MaxPositionError << " (" << report.MaxBoundRatio
+              << " of meshlet bound)\n"
+              << "\tMax normal angle   : " << report.MaxNormalAngle * 180.0f / XM_PI << " deg\n"
+              << "\tValidation time    : " << std::chrono::duration<double>(afterTS - beforeTS).count() << " s\n";
+    if (report.nOverBound > 0)
+        std::cout << "Quantized positions exceed the meshlet bound for " << report.nOverBound << " vertices\n";
+    if (report.nDecodeMismatch > 0)
+        std::cout << "SSE vertex decoder differs from scalar for " << report.nDecodeMismatch << " vertices\n";
+    if (report.nOverLodError > 0)
+        std::cout << "Quantization bound exceeds the simplification error of " << report.nOverLodError
+                  << " meshlets\n";
+    return report.nOverBound + report.nDecodeMismatch + report.nOverLodError;
+}
+
+// Кодирует треугольники всех мешлетов каждой кодировкой, декодирует обратно и сравнивает: декодер должен
+// вернуть ровно то, что записал кодировщик, а набор треугольников с точностью до поворота --- совпасть с исходным.
+// Печатает размеры потоков и проверяет, что сохранённый поток модели разворачивается в её Primitives.
+// Возвращает число нарушений: мешлетов, не прошедших круг кодирования, и несовпадение сохранённого потока
+static size_t ReportPrimitiveEncodings(const TMeshletModelCPU &model)
+{
+    auto canonical = [](uint packed) {
+        uint idx[3];
+        UnpackPrimitive(packed, idx);
+        uint iFirst = uint(std::min_element(idx, idx + 3) - idx);
+        return PackPrimitive(idx[iFirst], idx[(iFirst + 1) % 3], idx[(iFirst + 2) % 3]);
+    };
+
+    size_t               plainBytes = model.Primitives.size() * sizeof(uint);
+    std::vector<uint8_t> stream;
+    std::vector<uint>    encoded;
+    std::vector<uint>    decoded;
+    std::vector<uint>    expected;
+    std::vector<uint>    actual;
+    size_t               nErrors = 0;
+    std::cout << "Primitive encodings:\n";
+    for (uint iEncoding = 0; iEncoding < PRIMITIVE_ENCODING_COUNT; ++iEncoding)
+    {
+        auto   encoding    = PrimitiveEncoding(iEncoding);
+        size_t nBytes      = 0;
+        size_t nSkipped    = 0;
+        size_t nMismatches = 0;
+        for (const TMeshletDesc &meshlet : model.Meshlets)
+        {
+            const uint *prims = model.Primitives.data() + meshlet.PrimOffset;
+            encoded.assign(prims, prims + meshlet.PrimCount);
+            stream.clear();
+            if (!EncodePrimitives(encoding, encoded.data(), meshlet.PrimCount, stream))
+            {
+                nSkipped++;
+                continue;
+            }
+            nBytes += stream.size();
+
+            decoded.resize(meshlet.PrimCount);
+            bool isDecoded
+                = DecodePrimitives(encoding, stream.data(), stream.size(), meshlet.PrimCount, decoded.data());
+
+            expected.clear();
+            actual.clear();
+            for (uint iTri = 0; iTri < meshlet.PrimCount; ++iTri)
+            {
+                expected.push_back(canonical(prims[iTri]));
+                actual.push_back(canonical(decoded[iTri]));
+            }
+            std::sort(expected.begin(), expected.end());
+            std::sort(actual.begin(), actual.end());
+            nMismatches += !isDecoded || decoded != encoded || actual != expected;
+        }
+        std::cout << "\t" << std::setw(8) << PrimitiveEncodingName(encoding) << " : " << nBytes << " bytes ("
+                  << 100.0 * nBytes / double(std::max<size_t>(plainBytes, 1)) << " %)";
+        if (nSkipped > 0)
+            std::cout << ", " << nSkipped << " meshlets do not fit";
+        std::cout << "\n";
+        if (nMismatches > 0)
+            std::cout << "Primitive encoding " << PrimitiveEncodingName(encoding) << " does not round-trip for "
+                      << nMismatches << " meshlets\n";
+        nErrors += nMismatches;
+    }
+
+    if (model.MeshletPrimitives.empty())
+        return nErrors;
+
+    size_t nChosen[PRIMITIVE_ENCODING_COUNT] = {};
+    for (const TMeshletPrimitiveDesc &desc : model.MeshletPrimitives)
+        nChosen[uint(desc.Encoding)]++;
+    size_t storedBytes = model.PrimitiveStream.size() + model.MeshletPrimitives.size() * sizeof(TMeshletPrimitiveDesc);
+    std::cout << "\tStored   : " << storedBytes << " bytes with meshlet table ("
+              << 100.0 * storedBytes / double(std::max<size_t>(plainBytes, 1)) << " %), meshlets:";
+    for (uint iEncoding = 0; iEncoding < PRIMITIVE_ENCODING_COUNT; ++iEncoding)
+        std::cout << " " << PrimitiveEncodingName(PrimitiveEncoding(iEncoding)) << " = " << nChosen[iEncoding];
+    std::cout << "\n";
+    // Без Strip поток уходит на GPU как есть, с ним модель при загрузке разворачивается в Packed10
+    if (model.HasGpuPrimitiveStream())
+        std::cout << "\tGPU      : " << storedBytes << " bytes, MainMS reads the stored stream\n";
+    else
+        std::cout << "\tGPU      : " << plainBytes << " bytes, strip meshlets are decoded at load\n";
+
+    TMeshletModelCPU copy;
+    copy.Meshlets          = model.Meshlets;
+    copy.PrimitiveStream   = model.PrimitiveStream;
+    copy.MeshletPrimitives = model.MeshletPrimitives;
+    copy.DecodePrimitives();
+    if (copy.Primitives != model.Primitives)
+    {
+        std::cout << "Stored primitive stream does not decode to the model primitives\n";
+        nErrors++;
+    }
+    return nErrors;
+}
+
+// Открывает файл модели отображением в память, печатает таблицу секций и проверяет контрольные суммы.
+// Открытие читает только заголовок и таблицу, поэтому его время от размера файла не зависит
+static void InspectModelFile(const std::filesystem::path &path)
+{
+    if (!TModelFileView::IsContainer(path))
+    {
+        std::cout << "Legacy model file without section table, loading it fully...\n";
+        TMeshletModelCPU model;
+        model.LoadFromFile(path);
+        std::cout << "Meshlets: " << model.Meshlets.size() << ", groups: " << model.Groups.size() << "\n";
+        return;
+    }
+
+    TModelFileView view;
+    auto           beforeOpenTS = std::chrono::steady_clock::now();
+    view.Open(path);
+    auto        afterOpenTS = std::chrono::steady_clock::now();
+    const char *corrupted   = view.VerifySections();
+    auto        afterVerifyTS = std::chrono::steady_clock::now();
+
+    const TModelFileHeader &header = view.Header();
+    std::cout << "Model file version " << header.Version << ", " << header.FileSize << " bytes, "
+              << header.SectionCount << " sections:\n";
+    for (const TModelSectionDesc &desc : view.Sections())
+    {
+        std::cout << "\t" << std::left << std::setw(22) << ModelSectionName(desc.Id) << std::right << std::setw(12)
+                  << desc.Count << " x " << std::setw(2) << desc.ElementSize << " bytes at " << desc.Offset
+                  << ", crc " << std::hex << std::setw(8) << std::setfill('0') << desc.Checksum << std::dec
+                  << std::setfill(' ') << "\n";
+    }
+
+    std::chrono::duration<double> openDuration{afterOpenTS - beforeOpenTS};
+    std::chrono::duration<double> verifyDuration{afterVerifyTS - afterOpenTS};
+    std::cout << "Open   : " << 1e3 * openDuration.count() << " ms\n"
+              << "Verify : " << 1e3 * verifyDuration.count() << " ms\n";
+    if (corrupted)
+        std::cout << "Checksum mismatch in section " << corrupted << "\n";
+    else
+        std::cout << "All checksums match\n";
+}
+
+int main(int argc, char **argv)
 {
     IntermediateMesh mesh;
+    if (!ParseOptions(argc, argv, mesh.Options))
+        return 1;
 
 #if false
     // Для отладки самой децимации пока будем выводить результат децимации сферы
@@ -1332,12 +3269,39 @@ int main()
     std::cout << "Init triangles: " << meshlet.Triangles.size() << std::endl;
     meshlet.Decimate();
     std::cout << "Triangles left: " << meshlet.Triangles.size() << std::endl;
-    meshlet.dbgSaveAsObj(9999, true);
+    meshlet.dbgSaveAsObj("dbg/dbg9999.obj");
     return 0;
 #endif
 
+    if (!mesh.Options.ReplayTracePath.empty())
+    {
+        std::cout << "Replaying decimation trace...\n";
+        std::vector<uint> traceWords = LoadDecimationTrace(mesh.Options.ReplayTracePath);
+
+        size_t nFiles = ReplayDecimationTrace(traceWords, mesh.Options.ReplayDir, mesh.Options.ReplayStep);
+        std::cout << "Replaying decimation trace done, " << nFiles << " snapshots written\n";
+        return 0;
+    }
+
+    if (!mesh.Options.InspectModelPath.empty())
+    {
+        InspectModelFile(mesh.Options.InspectModelPath);
+        return 0;
+    }
+
     auto beforeLoadTS = std::chrono::steady_clock::now();
 
+    std::cout << "Decimation engine: "
+              << (mesh.Options.Engine == DecimationEngine::Heap ? "heap" : "greedy") << "\n";
+    std::cout << "Vertex placement: "
+              << (mesh.Options.Placement == PlacementStrategy::Optimal ? "optimal" : "endpoints") << "\n";
+    std::cout << "Partitioner: " << PartitionerName(mesh.Options.Partitioner) << "\n";
+    if (mesh.Options.ErrorBudget > 0.0f)
+        std::cout << "Error budget: " << mesh.Options.ErrorBudget << " of bounding box diagonal\n";
+    if (mesh.Options.PartitionTrials > 1)
+        std::cout << "Partition trials: " << mesh.Options.PartitionTrials << ", objective "
+                  << PartitionObjectiveName(mesh.Options.TrialObjective) << "\n";
+
     std::cout << "Loading model...\n";
     // mesh.LoadGLB("../Assets/plane1.glb");
     // mesh.LoadGLB("../Assets/input.glb");
@@ -1351,34 +3315,31 @@ int main()
     size_t nVertices  = mesh.Vertices.size();
     size_t nTriangles = mesh.Triangles.size();
 
-    if constexpr (false)
+    if (mesh.Options.BenchPlacement)
     {
-        auto edgeTriangles = mesh.BuildTriangleEdgeIndex(mesh.Triangles);
-        std::cout << "\nBy edge:\n";
-        for (const auto &[edge, tris] : edgeTriangles)
-        {
-            std::cout << "V[" << edge.first << ", " << edge.second << "]: T[";
-            for (size_t i = 0; i < tris.size(); ++i)
-            {
-                if (i != 0)
-                    std::cout << ", ";
-                std::cout << tris[i];
-            }
-            std::cout << "]\n";
-        }
+        RunPlacementBenchmark(mesh);
+        return 0;
     }
 
-    // std::cout << "Partitioning meshlets...\n";
-    mesh.DoFirstPartition();
-    // std::cout << "Partitioning meshlets done\n";
+    if (mesh.Options.BenchPartition)
+    {
+        RunPartitionBenchmark(mesh);
+        return 0;
+    }
+
+    if (mesh.Options.BenchBudget)
+    {
+        RunBudgetBenchmark(mesh);
+        return 0;
+    }
+
+    mesh.BuildHierarchy();
 
-    for (int i = 0;; ++i)
+    if (!mesh.Options.TracePath.empty())
     {
-        std::cout << "Partitioning layer " << i << "...\n";
-        std::cout << "\tCurrent meshlets: " << mesh.LayerMeshletCount(i) << "\n";
-        if (!mesh.PartitionMeshlets())
-            break;
-        std::cout << "Partitioning layer " << i << " done\n";
+        std::cout << "Saving decimation trace...\n";
+        SaveDecimationTrace(mesh.Options.TracePath, mesh.TraceWords);
+        std::cout << "Saving decimation trace done\n";
     }
 
     TMeshletModelCPU outModel;
@@ -1396,6 +3357,34 @@ int main()
             if (meshletSize > MESHLET_MAX_PRIMITIVES)
                 std::cout << "Meshlet[" << iMeshlet << "].Size = " << meshletSize << "\n";
         }
+        for (size_t iMeshlet = 0; iMeshlet < outModel.Meshlets.size(); ++iMeshlet)
+        {
+            uint vertCount = outModel.Meshlets[iMeshlet].VertCount;
+            if (vertCount > MESHLET_MAX_VERTICES)
+                std::cout << "Meshlet[" << iMeshlet << "].VertCount = " << vertCount << "\n";
+        }
+        if (size_t nMismatches = CheckGroupTraversal(outModel))
+            std::cout << "Group traversal differs from per-meshlet selection at " << nMismatches << " thresholds\n";
+        if (size_t nViolations = outModel.ValidateLods())
+            std::cout << "LOD bounds are not monotone for " << nViolations << " parent-child pairs\n";
+    }
+
+    // Сжатие проверяется на всей модели, и файл с нарушениями не сохраняется
+    size_t nValidationErrors = 0;
+    if (mesh.Options.QuantizeVertices)
+        nValidationErrors += ReportVertexQuantization(outModel, mesh.Options.ThreadCount);
+    if (mesh.Options.PrimitiveEncoding != 0)
+        nValidationErrors += ReportPrimitiveEncodings(outModel);
+
+    std::cout << "Meshlet groups: " << outModel.Groups.size() << "\n";
+
+    if (mesh.Options.BenchCulling)
+        RunCullingBenchmark(outModel);
+
+    if (nValidationErrors > 0)
+    {
+        std::cerr << "Conversion failed: " << nValidationErrors << " validation errors, model is not saved\n";
+        return 1;
     }
 
     std::cout << "Saving model...\n";